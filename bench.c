@@ -0,0 +1,1039 @@
+/******************************************************************************/
+/* bench.c                                                                    */
+/* BENCHMARKS OF LOZ-FILE LIBRARY                                             */
+/*                                                                            */
+/* Copyright (c) 2016 Sergey Mashkin                                          */
+/******************************************************************************/
+
+#include  <stdio.h>
+#include  <unistd.h>
+#include  <stdlib.h>
+#include  <string.h>
+#include  <fcntl.h>
+#include  <pthread.h>
+#include  <time.h>
+#include  <sys/time.h>
+
+#include  "lozfile.h"
+#include  "compress_lz.h"
+
+#define MYLOGDEVICE 1 //MYLOGDEVICE_STDOUT
+#include  "mylog.h"
+
+//internal functions of section index (lozfile.c)
+int      loz_index_add                  ( lozfile_t * lozfile, lozfile_section_t * section );
+int      loz_index_find                 ( lozfile_t * lozfile, off_t rawpos, lozfile_index_t * entry );
+int      loz_index_ready                ( lozfile_t * lozfile );
+
+/******************************************************************************/
+/* GLOBAL VARIABLES                                                           */
+/******************************************************************************/
+
+#define BENCH_FILENAME          "bench.loz"
+#define BENCH_SEGMENTSIZE       16384
+#define BENCH_DATASIZE          64      //MB of generated data
+#define BENCH_OPEN_SIZE         1024    //MB of raw data of torn archive
+#define BENCH_OPEN_TORN         1024    //KB of zeros at the end of torn archive
+#define BENCH_OPEN_SAVE         (1024*1024) //bytes saved before torn tail (to undo repair of loz_close)
+#define BENCH_RUNS              3
+#define BENCH_LZ_SIZE           1       //MB of every data set of LZ benchmark
+#define BENCH_LZ_BLOCK          65536   //block size of LZ benchmark
+#define BENCH_READSIZE          (1024*1024) //size of loz_read() calls
+#define BENCH_INDEX_SIZE        10      //millions of sections of index benchmark
+#define BENCH_INDEX_LOOKUPS     2000000 //number of random lookups
+#define BENCH_APPEND_SIZE       200     //thousands of records of append benchmark
+#define BENCH_APPEND_THREADS    64      //max number of producer threads
+#define BENCH_APPEND_BIG        4999    //one of 4999 records is bigger than segment (written directly)
+
+char * usagestr =
+"\n"
+"-----------------------------------------------------\n"
+"NAME:\n"
+"  bench\n"
+"\n"
+"DESCRIPTION:\n"
+"  Benchmarks of LOZ-file library. Data is generated\n"
+"  (text lines of log), temporary archive is\n"
+"  \"" BENCH_FILENAME "\" in current directory.\n"
+"\n"
+"USAGE:\n"
+"  bench write [MB]\n"
+"    throughput of loz_write() by 1 byte, 100 bytes\n"
+"    and 1 MB calls (fastlz2, 16 KB segments)\n"
+"\n"
+"  bench open [MB] [KB]\n"
+"    time of loz_open() in \"r+\" mode of archive of MB\n"
+"    raw data (1024) with KB of zeros (1024) written\n"
+"    over its end (torn tail, index is lost)\n"
+"\n"
+"  bench lz [MB]\n"
+"    ratio and speed of LZ_Compress() and\n"
+"    LZ_CompressFast() on MB (1) of text, binary,\n"
+"    zeros and base64 data by 64 KB blocks\n"
+"\n"
+"  bench extract [MB]\n"
+"    loz_read() speed of MB (64) of text archived by\n"
+"    every codec with crc32c and crc8 checksums:\n"
+"    verified and with LOZ_FLAG_NOVERIFY (best of 3)\n"
+"\n"
+"  bench index [M]\n"
+"    memory and lookup time of in-memory section index\n"
+"    of M (10) millions of sections of 200..400 bytes:\n"
+"    loz_index_find() vs binary search of flat array\n"
+"\n"
+"  bench append [K] [ring]\n"
+"    K (200) thousands of records of 24..183 bytes\n"
+"    (and a few of 20 KB) by\n"
+"    1..64 threads: loz_append() of LOZ_FLAG_ASYNC\n"
+"    handle (ring of given size, bytes) vs mutex and\n"
+"    loz_write() of plain and LOZ_FLAG_ASYNC handle:\n"
+"    records/s and latency of calls,\n"
+"    records are checked (contiguous, in order of\n"
+"    every thread)\n"
+"\n"
+"  bench --help\n"
+"    show this page\n"
+"-----------------------------------------------------\n"
+"\n";
+
+//------------------------------------------------------------------------------
+void usage( void )
+{
+    printf("%s", usagestr);
+}
+
+//------------------------------------------------------------------------------
+//Get current time
+//returns: time, seconds
+double bench_time( void )
+{
+    struct timeval t;
+
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+//------------------------------------------------------------------------------
+//Get size in MB from argument
+//returns: size, MB (defsize if argument is not given)
+//         -1 = invalid argument
+int bench_size( int argc, char *argv[], int i, int defsize )
+{
+    int size;
+
+    if(i >= argc)
+        return defsize;
+    size = atoi(argv[i]);
+    if(size <= 0) {
+        printf("Error: invalid size \"%s\".\n", argv[i]);
+        return -1;
+    }
+    return size;
+}
+
+//------------------------------------------------------------------------------
+//Generate text lines of log (deterministic)
+//inputs:  size = size of data, bytes
+//returns: pointer to data (must be freed by caller)
+//         NULL = error
+uint8_t * bench_data( long int size )
+{
+    static const char * levels[] = { "INFO", "DEBUG", "WARNING", "ERROR" };
+    static const char * events[] = { "request done", "cache miss", "connection closed",
+                                     "retry scheduled", "queue is full" };
+    uint8_t  * data;
+    char       line[256];
+    uint32_t   seed = 12345;
+    long int   pos  = 0;
+    long int   t    = 0;
+    int        n;
+
+    data = malloc(size);
+    if(data==NULL) {
+        printf("Error: could not allocate %ld bytes for data.\n", size);
+        return NULL;
+    }
+    while(pos < size) {
+        seed = seed * 1103515245 + 12345;
+        t   += (seed >> 16) % 1000;
+        n = snprintf(line, sizeof(line), "%02ld:%02ld:%02ld.%03ld %-7s worker-%u: %s id=%u took %u us\n",
+                     (t / 3600000) % 24, (t / 60000) % 60, (t / 1000) % 60, t % 1000,
+                     levels[(seed >> 8) % 4], (seed >> 4) % 16, events[(seed >> 12) % 5],
+                     seed % 100000, (seed >> 20) % 5000);
+        if(n > size - pos)
+            n = size - pos;
+        memcpy(data + pos, line, n);
+        pos += n;
+    }
+    return data;
+}
+
+//------------------------------------------------------------------------------
+//Print result of benchmark
+void bench_print( const char * name, long int size, double sec )
+{
+    if(sec <= 0)
+        sec = 0.000001;
+    printf("  %-24s %8.1f MB in %7.3f sec: %8.1f MB/s\n",
+           name, size / 1048576.0, sec, size / 1048576.0 / sec);
+}
+
+/*** BENCHMARKS ************************************/
+
+//------------------------------------------------------------------------------
+//Throughput of loz_write() by 1 byte, 100 bytes and 1 MB calls
+//returns: 0 = ok, -1 = error
+int bench_write( int argc, char *argv[] )
+{
+    static const int chunks[] = { 1, 100, 1024*1024 };
+    static const char * names[] = { "loz_write() by 1 B", "loz_write() by 100 B", "loz_write() by 1 MB" };
+    lozfile_t * lozfile;
+    uint8_t   * data;
+    long int    size;
+    long int    pos;
+    double      t0;
+    int         chunk;
+    int         n;
+    int         i;
+
+    n = bench_size(argc, argv, 2, BENCH_DATASIZE);
+    if(n < 0)
+        return -1;
+    size = (long int)n * 1048576;
+    data = bench_data(size);
+    if(data==NULL)
+        return -1;
+
+    printf("write %ld MB (fastlz2, %d byte segments):\n", size / 1048576, BENCH_SEGMENTSIZE);
+    for(i=0; i<3; i++) {
+        chunk = chunks[i];
+        t0 = bench_time();
+        lozfile = loz_open( BENCH_FILENAME, "w+", BENCH_SEGMENTSIZE, LOZ_COMPRESSION_FASTLZ2 );
+        if(lozfile==NULL) {
+            printf("Error: could not open LOZ-archive \"%s\".\n", BENCH_FILENAME);
+            free(data);
+            return -1;
+        }
+        for(pos=0; pos<size; pos+=n) {
+            n = (size - pos < chunk) ? size - pos : chunk;
+            if(loz_write(lozfile, (char*)data + pos, n) != n) {
+                printf("Error: could not write to LOZ-archive \"%s\".\n", BENCH_FILENAME);
+                loz_close(lozfile);
+                free(data);
+                return -1;
+            }
+        }
+        loz_close(lozfile);
+        bench_print(names[i], size, bench_time() - t0);
+    }
+    unlink(BENCH_FILENAME);
+    free(data);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//Time of loz_open() in "r+" mode of archive with torn tail: position of the
+//last valid section is found by backward scan over torn data
+//returns: 0 = ok, -1 = error
+int bench_open( int argc, char *argv[] )
+{
+    lozfile_t * lozfile;
+    uint8_t   * data;
+    uint8_t   * save;
+    off_t       filesize;
+    off_t       savepos;
+    long int    torn;
+    double      t0;
+    double      sec;
+    int         mb;
+    int         fid;
+    int         err = -1;
+    int         i;
+
+    mb = bench_size(argc, argv, 2, BENCH_OPEN_SIZE);
+    if(mb < 0)
+        return -1;
+    torn = bench_size(argc, argv, 3, BENCH_OPEN_TORN);
+    if(torn < 0)
+        return -1;
+    torn *= 1024;
+    data = bench_data(1048576);
+    save = malloc(BENCH_OPEN_SAVE + torn);
+    if( (data==NULL) || (save==NULL) ) {
+        printf("Error: could not allocate memory for buffers.\n");
+        goto exit;
+    }
+
+    //write archive
+    lozfile = loz_open( BENCH_FILENAME, "w+", BENCH_SEGMENTSIZE, LOZ_COMPRESSION_FASTLZ2 );
+    if(lozfile==NULL) {
+        printf("Error: could not open LOZ-archive \"%s\".\n", BENCH_FILENAME);
+        goto exit;
+    }
+    for(i=0; i<mb; i++) {
+        if(loz_write(lozfile, (char*)data, 1048576) != 1048576) {
+            printf("Error: could not write to LOZ-archive \"%s\".\n", BENCH_FILENAME);
+            loz_close(lozfile);
+            goto exit;
+        }
+    }
+    loz_close(lozfile);
+
+    //tear its tail: zeros over the last torn bytes (index and the last sections)
+    fid = open( BENCH_FILENAME, O_RDWR );
+    if(fid < 0) {
+        printf("Error: could not open file \"%s\".\n", BENCH_FILENAME);
+        goto exit;
+    }
+    filesize = lseek( fid, 0, SEEK_END );
+    if(filesize < BENCH_OPEN_SAVE + torn) {
+        printf("Error: archive is too small (%lld bytes).\n", (long long)filesize);
+        close(fid);
+        goto exit;
+    }
+    savepos = filesize - BENCH_OPEN_SAVE - torn;
+    memset(save + BENCH_OPEN_SAVE, 0, torn);
+    if( (pwrite(fid, save + BENCH_OPEN_SAVE, torn, filesize - torn) != torn) ||
+        (pread(fid, save, BENCH_OPEN_SAVE + torn, savepos) != BENCH_OPEN_SAVE + torn) )
+    {
+        printf("Error: could not tear file \"%s\".\n", BENCH_FILENAME);
+        close(fid);
+        goto exit;
+    }
+
+    printf("open of %d MB archive (%lld bytes) with %ld KB torn tail:\n",
+           mb, (long long)filesize, torn / 1024);
+    for(i=0; i<BENCH_RUNS; i++) {
+        t0 = bench_time();
+        lozfile = loz_open( BENCH_FILENAME, "r+", BENCH_SEGMENTSIZE, LOZ_COMPRESSION_FASTLZ2 );
+        sec = bench_time() - t0;
+        if(lozfile==NULL) {
+            printf("Error: could not open LOZ-archive \"%s\".\n", BENCH_FILENAME);
+            close(fid);
+            goto exit;
+        }
+        printf("  loz_open(\"r+\") #%d %13.1f ms\n", i + 1, sec * 1000);
+        //loz_close() writes index after the last valid section: undo it
+        loz_close(lozfile);
+        if( (ftruncate(fid, filesize) != 0) ||
+            (pwrite(fid, save, BENCH_OPEN_SAVE + torn, savepos) != BENCH_OPEN_SAVE + torn) )
+        {
+            printf("Error: could not restore file \"%s\".\n", BENCH_FILENAME);
+            close(fid);
+            goto exit;
+        }
+    }
+    close(fid);
+    unlink(BENCH_FILENAME);
+    err = 0;
+
+exit:
+    free(data);
+    free(save);
+    return err;
+}
+
+//------------------------------------------------------------------------------
+//Generate data set of LZ benchmark
+//inputs:  set  = 0: text lines of log, 1: binary records, 2: zeros, 3: base64
+//         size = size of data, bytes
+//returns: pointer to data (must be freed by caller)
+//         NULL = error
+uint8_t * bench_lz_data( int set, long int size )
+{
+    static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint8_t  * data;
+    uint32_t   seed = 54321;
+    long int   i;
+
+    if(set == 0)
+        return bench_data(size);
+    data = malloc(size);
+    if(data==NULL) {
+        printf("Error: could not allocate %ld bytes for data.\n", size);
+        return NULL;
+    }
+    for(i=0; i<size; i++) {
+        seed = seed * 1103515245 + 12345;
+        switch(set) {
+        case 1:
+            //16-byte records: counter, small values, random word
+            switch(i % 16) {
+            case 0:  data[i] = (i / 16) & 0xFF;        break;
+            case 1:  data[i] = (i / 4096) & 0xFF;      break;
+            case 4:  data[i] = (seed >> 24) & 0x0F;    break;
+            case 5:  data[i] = (seed >> 28) & 0x01;    break;
+            case 8:
+            case 9:
+            case 10:
+            case 11: data[i] = (seed >> 16) & 0xFF;    break;
+            default: data[i] = 0;                      break;
+            }
+            break;
+        case 2:
+            data[i] = 0;
+            break;
+        default:
+            data[i] = (i % 77 == 76) ? '\n' : b64[(seed >> 16) & 0x3F];
+            break;
+        }
+    }
+    return data;
+}
+
+//------------------------------------------------------------------------------
+//Ratio and speed of LZ_Compress() (search of all offsets) and
+//LZ_CompressFast() (hash chains, used by LOZ_COMPRESSION_LZ)
+//returns: 0 = ok, -1 = error
+int bench_lz( int argc, char *argv[] )
+{
+    static const char * sets[] = { "text log", "binary", "zeros", "base64" };
+    uint8_t  * data = NULL;
+    uint8_t  * comp = NULL;
+    uint8_t  * dec  = NULL;
+    uint32_t * work = NULL;
+    long int   size;
+    long int   pos;
+    long int   compsize[2];
+    double     sec[2];
+    double     t0;
+    int        block;
+    int        n;
+    int        m;
+    int        set;
+    int        err = -1;
+
+    n = bench_size(argc, argv, 2, BENCH_LZ_SIZE);
+    if(n < 0)
+        return -1;
+    size = (long int)n * 1048576;
+    comp = malloc(BENCH_LZ_BLOCK + BENCH_LZ_BLOCK / 128 + 1); //0.4% larger plus one byte
+    dec  = malloc(BENCH_LZ_BLOCK);
+    work = malloc((BENCH_LZ_BLOCK + 65536) * sizeof(uint32_t));
+    if( (comp==NULL) || (dec==NULL) || (work==NULL) ) {
+        printf("Error: could not allocate memory for buffers.\n");
+        goto exit;
+    }
+
+    printf("lz %ld MB by %d byte blocks: ratio / MB/s\n", size / 1048576, BENCH_LZ_BLOCK);
+    printf("  %-10s %20s %20s\n", "data", "LZ_Compress", "LZ_CompressFast");
+    for(set=0; set<4; set++) {
+        data = bench_lz_data(set, size);
+        if(data==NULL)
+            goto exit;
+        for(m=0; m<2; m++) {
+            compsize[m] = 0;
+            t0 = bench_time();
+            for(pos=0; pos<size; pos+=block) {
+                block = (size - pos < BENCH_LZ_BLOCK) ? size - pos : BENCH_LZ_BLOCK;
+                if(m == 0)
+                    n = LZ_Compress( data + pos, comp, block );
+                else
+                    n = LZ_CompressFast( data + pos, comp, block, work );
+                compsize[m] += n;
+                //both must be decoded by LZ_Uncompress() (not timed)
+                sec[m] = bench_time();
+                if( (LZ_Uncompress( comp, dec, n, block ) != block) ||
+                    (memcmp( dec, data + pos, block ) != 0) )
+                {
+                    printf("Error: %s block at %ld is not decoded back.\n", sets[set], pos);
+                    goto exit;
+                }
+                t0 += bench_time() - sec[m];
+            }
+            sec[m] = bench_time() - t0;
+            if(sec[m] <= 0)
+                sec[m] = 0.000001;
+        }
+        printf("  %-10s %11.3f / %6.2f %11.3f / %6.2f\n", sets[set],
+               (double)compsize[0] / size, size / 1048576.0 / sec[0],
+               (double)compsize[1] / size, size / 1048576.0 / sec[1]);
+        free(data);
+        data = NULL;
+    }
+    err = 0;
+
+exit:
+    free(data);
+    free(comp);
+    free(dec);
+    free(work);
+    return err;
+}
+
+//------------------------------------------------------------------------------
+//Read archive by loz_read()
+//inputs:  flags = LOZ_FLAG_xxx of loz_open_ex()
+//         out   = buffer for data
+//         size  = size of data (and buffer)
+//returns: time of reading, seconds
+//         -1 = error
+double bench_read( int flags, uint8_t * out, long int size )
+{
+    lozfile_t    * lozfile;
+    lozfile_opts_t opts;
+    long int       pos;
+    double         t0;
+    int            n;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.flags = flags;
+    t0 = bench_time();
+    lozfile = loz_open_ex( BENCH_FILENAME, "r", BENCH_SEGMENTSIZE, LOZ_COMPRESSION_NONE, &opts );
+    if(lozfile==NULL) {
+        printf("Error: could not open LOZ-archive \"%s\".\n", BENCH_FILENAME);
+        return -1;
+    }
+    for(pos=0; pos<size; pos+=n) {
+        n = (size - pos < BENCH_READSIZE) ? size - pos : BENCH_READSIZE;
+        n = loz_read(lozfile, out + pos, n);
+        if(n <= 0) {
+            printf("Error: could not read from LOZ-archive \"%s\".\n", BENCH_FILENAME);
+            loz_close(lozfile);
+            return -1;
+        }
+    }
+    loz_close(lozfile);
+    return bench_time() - t0;
+}
+
+//------------------------------------------------------------------------------
+//Speed of loz_read() of every codec: verified (CRC of compressed data is
+//calculated) and trusted (LOZ_FLAG_NOVERIFY) reads
+//returns: 0 = ok, -1 = error
+int bench_extract( int argc, char *argv[] )
+{
+    static const char * methods[] = { "none", "rle", "rle2", "lz", "fastlz1", "fastlz2" };
+    static const int    checksums[] = { LOZ_CHECKSUM_CRC32C, LOZ_CHECKSUM_CRC8 };
+    static const char * csnames[]   = { "crc32c", "crc8" };
+    lozfile_t    * lozfile;
+    lozfile_opts_t opts;
+    uint8_t      * data;
+    uint8_t      * out;
+    long int       size;
+    double         best[2];
+    double         sec;
+    int            codec;
+    int            c;
+    int            v;
+    int            n;
+    int            i;
+    int            err = -1;
+
+    n = bench_size(argc, argv, 2, BENCH_DATASIZE);
+    if(n < 0)
+        return -1;
+    size = (long int)n * 1048576;
+    data = bench_data(size);
+    out  = malloc(size);
+    if( (data==NULL) || (out==NULL) ) {
+        printf("Error: could not allocate memory for buffers.\n");
+        goto exit;
+    }
+
+    printf("extract %ld MB (%d byte segments), MB/s:\n", size / 1048576, BENCH_SEGMENTSIZE);
+    printf("  %-8s %-8s %10s %10s %8s\n", "method", "checksum", "verify", "noverify", "speedup");
+    for(codec=LOZ_COMPRESSION_MIN; codec<=LOZ_COMPRESSION_MAX; codec++) {
+        for(c=0; c<2; c++) {
+            //write archive
+            memset(&opts, 0, sizeof(opts));
+            opts.checksum = checksums[c];
+            lozfile = loz_open_ex( BENCH_FILENAME, "w+", BENCH_SEGMENTSIZE, codec, &opts );
+            if(lozfile==NULL) {
+                printf("Error: could not open LOZ-archive \"%s\".\n", BENCH_FILENAME);
+                goto exit;
+            }
+            if(loz_write(lozfile, (char*)data, size) != size) {
+                printf("Error: could not write to LOZ-archive \"%s\".\n", BENCH_FILENAME);
+                loz_close(lozfile);
+                goto exit;
+            }
+            loz_close(lozfile);
+
+            //read it
+            for(v=0; v<2; v++) {
+                best[v] = 0;
+                for(i=0; i<BENCH_RUNS; i++) {
+                    sec = bench_read( v ? LOZ_FLAG_NOVERIFY : 0, out, size );
+                    if(sec < 0)
+                        goto exit;
+                    if( (best[v] == 0) || (sec < best[v]) )
+                        best[v] = sec;
+                }
+                if(memcmp(out, data, size) != 0) {
+                    printf("Error: %s archive is not read back.\n", methods[codec]);
+                    goto exit;
+                }
+                if(best[v] <= 0)
+                    best[v] = 0.000001;
+            }
+            printf("  %-8s %-8s %10.1f %10.1f %7.2fx\n", methods[codec], csnames[c],
+                   size / 1048576.0 / best[0], size / 1048576.0 / best[1], best[0] / best[1]);
+        }
+    }
+    unlink(BENCH_FILENAME);
+    err = 0;
+
+exit:
+    free(data);
+    free(out);
+    return err;
+}
+
+//------------------------------------------------------------------------------
+//Memory and lookup time of section index: delta-encoded blocks with Eytzinger
+//search (loz_index_find) vs binary search of flat array of entries. Index of
+//small archive is extended by loz_index_add() with sections of 200..400 raw
+//bytes (compressed to 50..100 %), as after loz_open() of archive with them.
+//returns: 0 = ok, -1 = error
+int bench_index( int argc, char *argv[] )
+{
+    lozfile_t         * lozfile = NULL;
+    lozfile_index_t   * flat    = NULL;
+    lozfile_index_t     entry;
+    lozfile_section_t   section;
+    uint8_t             data[256];
+    off_t             * keys    = NULL;
+    off_t             * found   = NULL;
+    int               * pos     = NULL;
+    uint32_t            seed = 777;
+    uint64_t            rawsize;
+    long int            mem;
+    double              t0;
+    double              sec[2];
+    int                 nblocks;
+    int                 hsize;
+    int                 n;
+    int                 lo;
+    int                 hi;
+    int                 mid;
+    int                 i;
+    int                 err = -1;
+
+    n = bench_size(argc, argv, 2, BENCH_INDEX_SIZE);
+    if(n < 0)
+        return -1;
+    n *= 1000000;
+
+    //small archive: 2 blocks of index of stored sections
+    memset(data, 0, sizeof(data));
+    lozfile = loz_open( BENCH_FILENAME, "w+", sizeof(data), LOZ_COMPRESSION_NONE );
+    if(lozfile==NULL) {
+        printf("Error: could not open LOZ-archive \"%s\".\n", BENCH_FILENAME);
+        goto exit;
+    }
+    for(i=0; i<2*LOZ_INDEX_BLOCK; i++) {
+        if(loz_write(lozfile, (char*)data, sizeof(data)) != sizeof(data)) {
+            printf("Error: could not write to LOZ-archive \"%s\".\n", BENCH_FILENAME);
+            goto exit;
+        }
+    }
+    loz_close(lozfile);
+    lozfile = loz_open( BENCH_FILENAME, "r", sizeof(data), LOZ_COMPRESSION_NONE );
+    if( (lozfile==NULL) || (loz_index_ready(lozfile) != LOZ_OK) ||
+        (lozfile->index_n != 2*LOZ_INDEX_BLOCK) )
+    {
+        printf("Error: could not read index of LOZ-archive \"%s\".\n", BENCH_FILENAME);
+        goto exit;
+    }
+    //size of section header and data crc: sections follow each other
+    hsize = (lozfile->index_blocks[1].fpos - lozfile->index_blocks[0].fpos) / LOZ_INDEX_BLOCK - sizeof(data);
+
+    flat  = malloc((long int)n * sizeof(lozfile_index_t));
+    keys  = malloc(BENCH_INDEX_LOOKUPS * sizeof(off_t));
+    found = malloc(BENCH_INDEX_LOOKUPS * sizeof(off_t));
+    pos   = malloc(BENCH_INDEX_LOOKUPS * sizeof(int));
+    if( (flat==NULL) || (keys==NULL) || (found==NULL) || (pos==NULL) ) {
+        printf("Error: could not allocate memory for buffers.\n");
+        goto exit;
+    }
+
+    //sections of index
+    for(i=0; i<n; i++) {
+        if(i < lozfile->index_n) {
+            loz_index_find( lozfile, i * sizeof(data), &flat[i] );
+            continue;
+        }
+        seed = seed * 1103515245 + 12345;
+        section.fpos     = flat[i-1].fpos + hsize + flat[i-1].compsize;
+        section.rawpos   = flat[i-1].rawpos + flat[i-1].rawsize;
+        section.rawsize  = 200 + (seed >> 16) % 201;
+        section.compsize = section.rawsize / 2 + (seed >> 8) % (section.rawsize / 2 + 1);
+        if(loz_index_add( lozfile, &section ) != LOZ_OK) {
+            printf("Error: could not add section %d to index.\n", i);
+            goto exit;
+        }
+        flat[i].fpos     = section.fpos;
+        flat[i].rawpos   = section.rawpos;
+        flat[i].rawsize  = section.rawsize;
+        flat[i].compsize = section.compsize;
+    }
+    rawsize = flat[n-1].rawpos + flat[n-1].rawsize;
+    for(i=0; i<BENCH_INDEX_LOOKUPS; i++) {
+        seed = seed * 1103515245 + 12345;
+        keys[i] = ((uint64_t)seed << 16 ^ (seed >> 8)) % rawsize;
+    }
+
+    //1st call builds Eytzinger layout of blocks
+    if(loz_index_find( lozfile, 0, &entry ) != LOZ_OK) {
+        printf("Error: loz_index_find() failed.\n");
+        goto exit;
+    }
+    t0 = bench_time();
+    for(i=0; i<BENCH_INDEX_LOOKUPS; i++) {
+        loz_index_find( lozfile, keys[i], &entry );
+        found[i] = entry.fpos;
+    }
+    sec[0] = bench_time() - t0;
+
+    t0 = bench_time();
+    for(i=0; i<BENCH_INDEX_LOOKUPS; i++) {
+        //last entry with rawpos <= key
+        lo = 0;
+        hi = n - 1;
+        while(lo < hi) {
+            mid = lo + (hi - lo + 1) / 2;
+            if((off_t)flat[mid].rawpos <= keys[i])
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        pos[i] = lo;
+    }
+    sec[1] = bench_time() - t0;
+
+    for(i=0; i<BENCH_INDEX_LOOKUPS; i++) {
+        if(found[i] != flat[pos[i]].fpos) {
+            printf("Error: loz_index_find(%lld) found fpos=%lld, expected %lld.\n",
+                   (long long)keys[i], (long long)found[i], (long long)flat[pos[i]].fpos);
+            goto exit;
+        }
+    }
+
+    nblocks = (n + LOZ_INDEX_BLOCK - 1) / LOZ_INDEX_BLOCK;
+    mem     = lozfile->index_data_n + 2L * nblocks * sizeof(lozfile_index_block_t); //blocks + Eytzinger copy
+    printf("index of %d sections, %d random lookups:\n", n, BENCH_INDEX_LOOKUPS);
+    printf("  %-24s %6.2f bytes/section %7.1f ns/lookup\n", "loz_index_find()",
+           (double)mem / n, sec[0] * 1e9 / BENCH_INDEX_LOOKUPS);
+    printf("  %-24s %6.2f bytes/section %7.1f ns/lookup\n", "flat array",
+           (double)sizeof(lozfile_index_t), sec[1] * 1e9 / BENCH_INDEX_LOOKUPS);
+    err = 0;
+
+exit:
+    if(lozfile)
+        loz_close(lozfile);
+    unlink(BENCH_FILENAME);
+    free(flat);
+    free(keys);
+    free(found);
+    free(pos);
+    return err;
+}
+
+//Producer thread of append benchmark
+typedef struct bench_producer_t bench_producer_t;
+struct bench_producer_t
+{
+        pthread_t         thread;
+        lozfile_t       * lozfile;
+        pthread_mutex_t * mutex;   //NULL=loz_append(), else loz_write() under mutex
+        int               id;
+        int               records;
+        uint32_t        * lat;     //latency of calls, ns
+        int               err;
+};
+
+//------------------------------------------------------------------------------
+//Size of record of append benchmark
+int bench_record_size( int id, int seq )
+{
+    if((id * 7919 + seq) % BENCH_APPEND_BIG == BENCH_APPEND_BIG - 1)
+        return BENCH_SEGMENTSIZE + 4000;
+    return 24 + (id * 7919 + seq * 31) % 160;
+}
+
+//------------------------------------------------------------------------------
+//Make record of append benchmark: "T<id> S<seq> " header, letters, '\n'
+//returns: size of record
+int bench_record( char * buf, int id, int seq )
+{
+    int size;
+    int n;
+
+    size = bench_record_size( id, seq );
+    n = sprintf(buf, "T%02d S%08d ", id, seq);
+    memset(buf + n, 'a' + seq % 26, size - n - 1);
+    buf[size - 1] = '\n';
+    return size;
+}
+
+//------------------------------------------------------------------------------
+//Producer thread of append benchmark
+void * bench_producer( void * arg )
+{
+    bench_producer_t * prod = (bench_producer_t *)arg;
+    char               buf[BENCH_SEGMENTSIZE + 4096];
+    struct timespec    t0;
+    struct timespec    t1;
+    int64_t            ns;
+    int                size;
+    int                n;
+    int                i;
+
+    for(i=0; i<prod->records; i++) {
+        size = bench_record( buf, prod->id, i );
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if(prod->mutex) {
+            pthread_mutex_lock( prod->mutex );
+            n = loz_write( prod->lozfile, buf, size );
+            pthread_mutex_unlock( prod->mutex );
+        }
+        else {
+            n = loz_append( prod->lozfile, buf, size );
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ns = (t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec);
+        prod->lat[i] = (ns > 0xFFFFFFFFLL) ? 0xFFFFFFFF : (uint32_t)ns;
+        if(n != size) {
+            prod->err = -1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+//Check records of append benchmark in archive: every record is contiguous,
+//records of every thread are complete and in order
+//returns: 0 = ok, -1 = error
+int bench_append_check( uint8_t * out, long int size, int nthreads, int records )
+{
+    lozfile_t * lozfile;
+    long int    pos;
+    int         next[BENCH_APPEND_THREADS];
+    char        expected[BENCH_SEGMENTSIZE + 4096];
+    int         id;
+    int         seq;
+    int         n;
+
+    lozfile = loz_open( BENCH_FILENAME, "r", BENCH_SEGMENTSIZE, LOZ_COMPRESSION_NONE );
+    if(lozfile==NULL) {
+        printf("Error: could not open LOZ-archive \"%s\".\n", BENCH_FILENAME);
+        return -1;
+    }
+    for(pos=0; pos<size; pos+=n) {
+        n = (size - pos < BENCH_READSIZE) ? size - pos : BENCH_READSIZE;
+        n = loz_read(lozfile, out + pos, n);
+        if(n <= 0)
+            break;
+    }
+    loz_close(lozfile);
+    if(pos != size) {
+        printf("Error: archive has %ld bytes, appended %ld bytes.\n", pos, size);
+        return -1;
+    }
+
+    memset(next, 0, sizeof(next));
+    for(pos=0; pos<size; pos+=n) {
+        //header is parsed from copy: out[] is not 0-terminated
+        n = (size - pos < 16) ? size - pos : 16;
+        memcpy(expected, out + pos, n);
+        expected[n] = 0;
+        if( (sscanf(expected, "T%2d S%8d ", &id, &seq) != 2) ||
+            (id < 0) || (id >= nthreads) )
+        {
+            printf("Error: no record at %ld.\n", pos);
+            return -1;
+        }
+        if(seq != next[id]) {
+            printf("Error: record %d of thread %d at %ld, expected %d.\n", seq, id, pos, next[id]);
+            return -1;
+        }
+        n = bench_record( expected, id, seq );
+        if( (pos + n > size) || (memcmp(out + pos, expected, n) != 0) ) {
+            printf("Error: record %d of thread %d at %ld is broken.\n", seq, id, pos);
+            return -1;
+        }
+        next[id]++;
+    }
+    for(id=0; id<nthreads; id++) {
+        if(next[id] != records) {
+            printf("Error: %d records of thread %d, expected %d.\n", next[id], id, records);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//Compare latencies for qsort()
+int bench_lat_cmp( const void * a, const void * b )
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+//------------------------------------------------------------------------------
+//Contention of 1..64 threads which write records to one handle: loz_append()
+//of LOZ_FLAG_ASYNC handle vs loz_write() under mutex (handle is not thread-safe)
+//returns: 0 = ok, -1 = error
+int bench_append( int argc, char *argv[] )
+{
+    static const char * modes[] = { "mutex+loz_write()", "mutex+loz_write() async", "loz_append()" };
+    bench_producer_t * prods = NULL;
+    pthread_mutex_t    mutex;
+    lozfile_t        * lozfile;
+    lozfile_opts_t     opts;
+    uint8_t          * out = NULL;
+    uint32_t         * lat = NULL;
+    long int           size;
+    double             t0;
+    double             sec;
+    int                total;
+    int                ring;
+    int                records;
+    int                nthreads;
+    int                mode;
+    int                i;
+    int                k;
+    int                err = -1;
+
+    total = bench_size(argc, argv, 2, BENCH_APPEND_SIZE);
+    if(total < 0)
+        return -1;
+    total *= 1000;
+    ring = bench_size(argc, argv, 3, LOZ_APPEND_SIZE_DEFAULT);
+    if(ring < 0)
+        return -1;
+    prods = calloc(BENCH_APPEND_THREADS, sizeof(bench_producer_t));
+    lat   = malloc(total * sizeof(uint32_t));
+    if( (prods==NULL) || (lat==NULL) ) {
+        printf("Error: could not allocate memory for threads.\n");
+        free(prods);
+        free(lat);
+        return -1;
+    }
+    pthread_mutex_init(&mutex, NULL);
+
+    printf("append %d records by threads (fastlz2, %d byte segments, %d byte ring):\n",
+           total, BENCH_SEGMENTSIZE, ring);
+    printf("  %-8s %-24s %8s %8s %8s %8s %10s\n", "threads", "mode", "Mrec/s", "MB/s",
+           "p50 ns", "p99 ns", "p99.9 ns");
+    for(nthreads=1; nthreads<=BENCH_APPEND_THREADS; nthreads*=2) {
+        records = total / nthreads;
+        size = 0;
+        for(k=0; k<records; k++)
+            for(i=0; i<nthreads; i++)
+                size += bench_record_size( i, k );
+        free(out);
+        out = malloc(size);
+        if(out==NULL) {
+            printf("Error: could not allocate %ld bytes for data.\n", size);
+            goto exit;
+        }
+        for(mode=0; mode<3; mode++) {
+            memset(&opts, 0, sizeof(opts));
+            opts.flags       = mode ? LOZ_FLAG_ASYNC : 0;
+            opts.append_size = ring;
+            lozfile = loz_open_ex( BENCH_FILENAME, "w+", BENCH_SEGMENTSIZE, LOZ_COMPRESSION_FASTLZ2, &opts );
+            if(lozfile==NULL) {
+                printf("Error: could not open LOZ-archive \"%s\".\n", BENCH_FILENAME);
+                goto exit;
+            }
+            t0 = bench_time();
+            for(i=0; i<nthreads; i++) {
+                prods[i].lozfile = lozfile;
+                prods[i].mutex   = (mode < 2) ? &mutex : NULL;
+                prods[i].id      = i;
+                prods[i].records = records;
+                prods[i].lat     = lat + (long int)i * records;
+                prods[i].err     = 0;
+                if(pthread_create(&prods[i].thread, NULL, bench_producer, &prods[i]) != 0) {
+                    printf("Error: could not create thread %d.\n", i);
+                    for(k=0; k<i; k++)
+                        pthread_join(prods[k].thread, NULL);
+                    loz_close(lozfile);
+                    goto exit;
+                }
+            }
+            for(i=0; i<nthreads; i++)
+                pthread_join(prods[i].thread, NULL);
+            loz_flush(lozfile);
+            sec = bench_time() - t0;
+            loz_close(lozfile);
+            for(i=0; i<nthreads; i++) {
+                if(prods[i].err) {
+                    printf("Error: thread %d could not write record.\n", i);
+                    goto exit;
+                }
+            }
+            if(bench_append_check( out, size, nthreads, records ))
+                goto exit;
+            if(sec <= 0)
+                sec = 0.000001;
+            k = records * nthreads;
+            qsort(lat, k, sizeof(uint32_t), bench_lat_cmp);
+            printf("  %-8d %-24s %8.2f %8.1f %8u %8u %10u\n", nthreads, modes[mode],
+                   (double)k / 1000000.0 / sec, size / 1048576.0 / sec,
+                   lat[k / 2], lat[(long int)k * 99 / 100], lat[(long int)k * 999 / 1000]);
+        }
+    }
+    unlink(BENCH_FILENAME);
+    err = 0;
+
+exit:
+    pthread_mutex_destroy(&mutex);
+    free(prods);
+    free(lat);
+    free(out);
+    return err;
+}
+
+/*** MAIN FUNCTION *********************************/
+
+//---------------------------------------------------
+int main(int argc, char *argv[])
+{
+    int err;
+
+    MYLOG_INIT( 0
+      //| MYLOG_ENABLED_ALL
+      | MYLOG_ENABLED_ERROR
+      | MYLOG_ENABLED_USER
+    );
+
+    if(argc < 2) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+    if( (0==strcmp(argv[1],"--help")) || (0==strcmp(argv[1],"-h")) ) {
+        usage();
+        exit(EXIT_SUCCESS);
+    }
+    else if(0==strcmp(argv[1],"write")) {
+        err = bench_write(argc, argv);
+    }
+    else if(0==strcmp(argv[1],"open")) {
+        err = bench_open(argc, argv);
+    }
+    else if(0==strcmp(argv[1],"lz")) {
+        err = bench_lz(argc, argv);
+    }
+    else if(0==strcmp(argv[1],"extract")) {
+        err = bench_extract(argc, argv);
+    }
+    else if(0==strcmp(argv[1],"index")) {
+        err = bench_index(argc, argv);
+    }
+    else if(0==strcmp(argv[1],"append")) {
+        err = bench_append(argc, argv);
+    }
+    else {
+        printf("error: unknown benchmark \"%s\"!\n"
+               "Use bench --help to show usage page.\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    exit(err ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -33,6 +33,12 @@
 * The upside is that decompression is very fast, and the compression ratio
 * is often very good.
 *
+* NOTE: this is an altered version of the original lz.c. LZ_CompressFast()
+* bounds the jump table walk to LZ_MAX_CHAIN candidates, stops searching
+* once a match of LZ_NICE_LENGTH bytes is found and tries the run of equal
+* bytes ending at the current position before walking the chain. The
+* coded format is unchanged.
+*
 * The reference to a string is coded as a (length,offset) pair, where the
 * length indicates the length of the string, and the offset gives the
 * offset from the current data position. To distinguish between string
@@ -88,6 +94,15 @@
    you. */
 #define LZ_MAX_OFFSET 100000
 
+/* Maximum number of jump table candidates examined per input position in
+   LZ_CompressFast(). Without a bound, long runs and very repetitive data
+   make the search quadratic. */
+#define LZ_MAX_CHAIN 32
+
+/* Match length considered good enough to stop searching for a longer one
+   in LZ_CompressFast(). */
+#define LZ_NICE_LENGTH 256
+
 
 
 /*************************************************************************
@@ -147,10 +162,12 @@ static int _LZ_WriteVarSize( unsigned int x, unsigned char * buf )
 
 /*************************************************************************
 * _LZ_ReadVarSize() - Read unsigned integer with variable number of
-* bytes depending on value.
+* bytes depending on value. Returns 0 if value does not end within
+* bufsize bytes.
 *************************************************************************/
 
-static int _LZ_ReadVarSize( unsigned int * x, unsigned char * buf )
+static int _LZ_ReadVarSize( unsigned int * x, unsigned char * buf,
+    unsigned int bufsize )
 {
     unsigned int y, b, num_bytes;
 
@@ -159,6 +176,10 @@ static int _LZ_ReadVarSize( unsigned int * x, unsigned char * buf )
     num_bytes = 0;
     do
     {
+        if( num_bytes >= bufsize )
+        {
+            return 0;
+        }
         b = (unsigned int) (*buf ++);
         y = (y << 7) | (b & 0x0000007f);
         ++ num_bytes;
@@ -332,7 +353,7 @@ int LZ_CompressFast( unsigned char *in, unsigned char *out,
     unsigned char marker, symbol;
     unsigned int  inpos, outpos, bytesleft, i, index, symbols;
     unsigned int  offset, bestoffset;
-    unsigned int  maxlength, length, bestlength;
+    unsigned int  maxlength, length, bestlength, chain;
     unsigned int  histogram[ 256 ], *lastindex, *jumptable;
     unsigned char *ptr1, *ptr2;
 
@@ -404,8 +425,27 @@ int LZ_CompressFast( unsigned char *in, unsigned char *out,
         /* Search history window for maximum length string match */
         bestlength = 3;
         bestoffset = 0;
+
+        /* Inside a run of equal bytes the run itself is usually the best
+           match, and the jump table is dense with useless candidates */
+        if( (inpos > 0) && (in[ inpos-1 ] == ptr1[ 0 ]) )
+        {
+            for( offset = 1; (offset < inpos) &&
+                             (offset < LZ_MAX_OFFSET-1) &&
+                             (in[ inpos-offset-1 ] == ptr1[ 0 ]); ++ offset );
+            maxlength = (bytesleft < offset ? bytesleft : offset);
+            length = _LZ_StringCompare( ptr1, ptr1 - offset, 0, maxlength );
+            if( length > bestlength )
+            {
+                bestlength = length;
+                bestoffset = offset;
+            }
+        }
+
         index = jumptable[ inpos ];
-        while( (index != 0xffffffff) && ((inpos - index) < LZ_MAX_OFFSET) )
+        chain = LZ_MAX_CHAIN;
+        while( (index != 0xffffffff) && ((inpos - index) < LZ_MAX_OFFSET) &&
+               (chain -- > 0) && (bestlength < LZ_NICE_LENGTH) )
         {
             /* Get pointer to candidate string */
             ptr2 = &in[ index ];
@@ -425,6 +465,10 @@ int LZ_CompressFast( unsigned char *in, unsigned char *out,
                 {
                     bestlength = length;
                     bestoffset = offset;
+                    if( length == bytesleft )
+                    {
+                        break;
+                    }
                 }
             }
 
@@ -494,7 +538,7 @@ int LZ_Uncompress( unsigned char *in, unsigned char *out,
     unsigned int insize, unsigned int outsizemax )
 {
     unsigned char marker, symbol;
-    unsigned int  i, inpos, outpos, length, offset;
+    unsigned int  i, inpos, outpos, length, offset, n;
 
     /* Do we have anything to uncompress? */
     if( insize < 1 )
@@ -506,50 +550,70 @@ int LZ_Uncompress( unsigned char *in, unsigned char *out,
     marker = in[ 0 ];
     inpos = 1;
 
-    /* Main decompression loop */
+    /* Main decompression loop: corrupted input must not read or write
+       outside of buffers (every position is checked before access) */
     outpos = 0;
-    do
+    while( inpos < insize )
     {
         symbol = in[ inpos ++ ];
         if( symbol == marker )
         {
             /* We had a marker byte */
+            if( inpos >= insize )
+            {
+                return -1;
+            }
             if( in[ inpos ] == 0 )
             {
                 /* It was a single occurrence of the marker byte */
+                if( outpos >= outsizemax )
+                {
+                    return -1;
+                }
                 out[ outpos ++ ] = marker;
                 ++ inpos;
-                /* SergMa: check we are still inside of output buffer */
-                if(outpos > outsizemax)
-                    return -1;
             }
             else
             {
                 /* Extract true length and offset */
-                inpos += _LZ_ReadVarSize( &length, &in[ inpos ] );
-                inpos += _LZ_ReadVarSize( &offset, &in[ inpos ] );
+                n = _LZ_ReadVarSize( &length, &in[ inpos ], insize - inpos );
+                if( n == 0 )
+                {
+                    return -1;
+                }
+                inpos += n;
+                n = _LZ_ReadVarSize( &offset, &in[ inpos ], insize - inpos );
+                if( n == 0 )
+                {
+                    return -1;
+                }
+                inpos += n;
+
+                /* Match must be inside of decoded data and output buffer */
+                if( (offset == 0) || (offset > outpos) ||
+                    (length > outsizemax - outpos) )
+                {
+                    return -1;
+                }
 
                 /* Copy corresponding data from history window */
                 for( i = 0; i < length; ++ i )
                 {
                     out[ outpos ] = out[ outpos - offset ];
                     ++ outpos;
-                    /* SergMa: check we are still inside of output buffer */
-                    if(outpos > outsizemax)
-                        return -1;
                 }
             }
         }
         else
         {
             /* No marker, plain copy */
-            out[ outpos ++ ] = symbol;
-            /* SergMa: check we are still inside of output buffer */
-            if(outpos > outsizemax)
+            if( outpos >= outsizemax )
+            {
                 return -1;
+            }
+            out[ outpos ++ ] = symbol;
         }
     }
-    while( inpos < insize );
-    
+
     return outpos;
 }
@@ -286,53 +286,68 @@ int RLE_Uncompress( unsigned char *in, unsigned char *out,
     inpos = 0;
     marker = in[ inpos ++ ];
 
-    /* Main decompression loop */
+    /* Main decompression loop: corrupted input must not read or write
+       outside of buffers (every position is checked before access) */
     outpos = 0;
-    do
+    while( inpos < insize )
     {
         symbol = in[ inpos ++ ];
         if( symbol == marker )
         {
             /* We had a marker byte */
+            if( inpos >= insize )
+            {
+                return -1;
+            }
             count = in[ inpos ++ ];
             if( count <= 2 )
             {
                 /* Counts 0, 1 and 2 are used for marker byte repetition
                    only */
+                if( count >= outsizemax - outpos )
+                {
+                    return -1;
+                }
                 for( i = 0; i <= count; ++ i )
                 {
                     out[ outpos ++ ] = marker;
-                    /* SergMa: check we are still inside of output buffer */
-                    if(outpos > outsizemax)
-                        return -1;
                 }
             }
             else
             {
                 if( count & 0x80 )
                 {
+                    if( inpos >= insize )
+                    {
+                        return -1;
+                    }
                     count = ((count & 0x7f) << 8) + in[ inpos ++ ];
                 }
+                if( inpos >= insize )
+                {
+                    return -1;
+                }
                 symbol = in[ inpos ++ ];
+                if( count >= outsizemax - outpos )
+                {
+                    return -1;
+                }
                 for( i = 0; i <= count; ++ i )
                 {
                     out[ outpos ++ ] = symbol;
-                    /* SergMa: check we are still inside of output buffer */
-                    if(outpos > outsizemax)
-                        return -1;
                 }
             }
         }
         else
         {
             /* No marker, plain copy */
-            out[ outpos ++ ] = symbol;
-            /* SergMa: check we are still inside of output buffer */
-            if(outpos > outsizemax)
+            if( outpos >= outsizemax )
+            {
                 return -1;
+            }
+            out[ outpos ++ ] = symbol;
         }
     }
-    while( inpos < insize );
 
     return outpos;
 }
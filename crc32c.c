@@ -0,0 +1,276 @@
+/******************************************************************************/
+/* crc32c.c                                                                   */
+/* CRC32C (CASTAGNOLI) UTILITES (IMPLEMENTATIONS)                             */
+/*                                                                            */
+/* Copyright (c) 2016 Sergey Mashkin                                          */
+/******************************************************************************/
+
+#include  <string.h>
+#include  <pthread.h>
+#include  "crc32c.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include  <nmmintrin.h>
+#define CRC32C_HW_SUPPORTED
+#endif
+
+#define POLY        0x82F63B78  /* reflected x^32 + x^28 + x^27 + ... + 1 */
+
+#define CRC32C_LONG  8192       /* hw: bytes per stream in 3-way long blocks  */
+#define CRC32C_SHORT 256        /* hw: bytes per stream in 3-way short blocks */
+
+static uint32_t       crc32c_table[8][256];   /* slicing-by-8 tables */
+static int            crc32c_hw_present = 0;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+#ifdef CRC32C_HW_SUPPORTED
+static uint32_t       crc32c_long[4][256];    /* shift crc by CRC32C_LONG zeros  */
+static uint32_t       crc32c_short[4][256];   /* shift crc by CRC32C_SHORT zeros */
+#endif
+
+/******************************************************************************/
+/* PRIVATE FUNCTIONS                                                          */
+/******************************************************************************/
+
+#ifdef CRC32C_HW_SUPPORTED
+//------------------------------------------------------------------------------
+//Multiply GF(2) 32x32 matrix by vector
+static uint32_t gf2_matrix_times( const uint32_t * mat, uint32_t vec )
+{
+        uint32_t sum = 0;
+
+        while(vec) {
+                if(vec & 1)
+                        sum ^= *mat;
+                vec >>= 1;
+                mat++;
+        }
+        return sum;
+}
+
+//------------------------------------------------------------------------------
+//square = mat * mat
+static void gf2_matrix_square( uint32_t * square, const uint32_t * mat )
+{
+        int n;
+
+        for(n = 0; n < 32; n++)
+                square[n] = gf2_matrix_times( mat, mat[n] );
+}
+
+//------------------------------------------------------------------------------
+//Build tables which advance crc over len zero bytes, so that independently
+//calculated crc of adjacent blocks can be combined: crc(A|B) = shift(crc(A)) ^ crc(B)
+static void crc32c_zeros( uint32_t zeros[][256], size_t len )
+{
+        uint32_t even[32]; //even-power-of-two zeros operator
+        uint32_t odd[32];  //odd-power-of-two zeros operator
+        uint32_t row = 1;
+        uint32_t * op;
+        int      n;
+
+        odd[0] = POLY; //operator for one zero bit
+        for(n = 1; n < 32; n++) {
+                odd[n] = row;
+                row  <<= 1;
+        }
+        gf2_matrix_square( even, odd ); //two zero bits
+        gf2_matrix_square( odd, even ); //four zero bits
+
+        //len is a power of two: square until one zero byte becomes len zero bytes
+        op = odd;
+        while(1) {
+                gf2_matrix_square( even, odd );
+                op = even;
+                len >>= 1;
+                if(len == 0)
+                        break;
+                gf2_matrix_square( odd, even );
+                op = odd;
+                len >>= 1;
+                if(len == 0)
+                        break;
+        }
+
+        for(n = 0; n < 256; n++) {
+                zeros[0][n] = gf2_matrix_times( op, n );
+                zeros[1][n] = gf2_matrix_times( op, n << 8 );
+                zeros[2][n] = gf2_matrix_times( op, n << 16 );
+                zeros[3][n] = gf2_matrix_times( op, (uint32_t)n << 24 );
+        }
+}
+
+//------------------------------------------------------------------------------
+//Apply zeros operator table to crc
+static inline uint32_t crc32c_shift( uint32_t zeros[][256], uint32_t crc )
+{
+        return zeros[0][crc & 0xFF] ^ zeros[1][(crc >> 8) & 0xFF] ^
+               zeros[2][(crc >> 16) & 0xFF] ^ zeros[3][crc >> 24];
+}
+
+//------------------------------------------------------------------------------
+//Calculate CRC32C with SSE4.2 crc32 instruction: three independent streams
+//hide the 3-cycle latency of the instruction
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42( uint32_t crc, const uint8_t * next, size_t len )
+{
+        uint64_t crc0, crc1, crc2;
+        uint64_t w0, w1, w2;
+        const uint8_t * end;
+
+        crc0 = crc ^ 0xFFFFFFFF;
+
+        while(len && ((uintptr_t)next & 7)) {
+                crc0 = _mm_crc32_u8( crc0, *next++ );
+                len--;
+        }
+
+        while(len >= CRC32C_LONG * 3) {
+                crc1 = 0;
+                crc2 = 0;
+                end  = next + CRC32C_LONG;
+                do {
+                        memcpy( &w0, next, 8 );
+                        memcpy( &w1, next + CRC32C_LONG, 8 );
+                        memcpy( &w2, next + CRC32C_LONG * 2, 8 );
+                        crc0 = _mm_crc32_u64( crc0, w0 );
+                        crc1 = _mm_crc32_u64( crc1, w1 );
+                        crc2 = _mm_crc32_u64( crc2, w2 );
+                        next += 8;
+                } while(next < end);
+                crc0  = crc32c_shift( crc32c_long, crc0 ) ^ crc1;
+                crc0  = crc32c_shift( crc32c_long, crc0 ) ^ crc2;
+                next += CRC32C_LONG * 2;
+                len  -= CRC32C_LONG * 3;
+        }
+
+        while(len >= CRC32C_SHORT * 3) {
+                crc1 = 0;
+                crc2 = 0;
+                end  = next + CRC32C_SHORT;
+                do {
+                        memcpy( &w0, next, 8 );
+                        memcpy( &w1, next + CRC32C_SHORT, 8 );
+                        memcpy( &w2, next + CRC32C_SHORT * 2, 8 );
+                        crc0 = _mm_crc32_u64( crc0, w0 );
+                        crc1 = _mm_crc32_u64( crc1, w1 );
+                        crc2 = _mm_crc32_u64( crc2, w2 );
+                        next += 8;
+                } while(next < end);
+                crc0  = crc32c_shift( crc32c_short, crc0 ) ^ crc1;
+                crc0  = crc32c_shift( crc32c_short, crc0 ) ^ crc2;
+                next += CRC32C_SHORT * 2;
+                len  -= CRC32C_SHORT * 3;
+        }
+
+        while(len >= 8) {
+                memcpy( &w0, next, 8 );
+                crc0  = _mm_crc32_u64( crc0, w0 );
+                next += 8;
+                len  -= 8;
+        }
+
+        while(len) {
+                crc0 = _mm_crc32_u8( crc0, *next++ );
+                len--;
+        }
+
+        return (uint32_t)crc0 ^ 0xFFFFFFFF;
+}
+#endif //CRC32C_HW_SUPPORTED
+
+//------------------------------------------------------------------------------
+//Calculate CRC32C with slicing-by-8 tables
+static uint32_t crc32c_sw( uint32_t crc, const uint8_t * next, size_t len )
+{
+        crc ^= 0xFFFFFFFF;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+        while(len >= 8) {
+                uint64_t w;
+
+                memcpy( &w, next, 8 );
+                w ^= crc;
+                crc = crc32c_table[7][ w        & 0xFF] ^
+                      crc32c_table[6][(w >>  8) & 0xFF] ^
+                      crc32c_table[5][(w >> 16) & 0xFF] ^
+                      crc32c_table[4][(w >> 24) & 0xFF] ^
+                      crc32c_table[3][(w >> 32) & 0xFF] ^
+                      crc32c_table[2][(w >> 40) & 0xFF] ^
+                      crc32c_table[1][(w >> 48) & 0xFF] ^
+                      crc32c_table[0][ w >> 56        ];
+                next += 8;
+                len  -= 8;
+        }
+#endif
+
+        while(len) {
+                crc = crc32c_table[0][(crc ^ *next++) & 0xFF] ^ (crc >> 8);
+                len--;
+        }
+
+        return crc ^ 0xFFFFFFFF;
+}
+
+//------------------------------------------------------------------------------
+//Initialize tables and detect SSE4.2 (called once)
+static void init_crc32c( void )
+{
+        uint32_t crc;
+        int      i, j;
+
+        for(i = 0; i < 256; i++) {
+                crc = i;
+                for(j = 0; j < 8; j++)
+                        crc = (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+                crc32c_table[0][i] = crc;
+        }
+        for(i = 0; i < 256; i++) {
+                crc = crc32c_table[0][i];
+                for(j = 1; j < 8; j++) {
+                        crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+                        crc32c_table[j][i] = crc;
+                }
+        }
+
+#ifdef CRC32C_HW_SUPPORTED
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("sse4.2")) {
+                crc32c_zeros( crc32c_long,  CRC32C_LONG );
+                crc32c_zeros( crc32c_short, CRC32C_SHORT );
+                crc32c_hw_present = 1;
+        }
+#endif
+}
+
+/******************************************************************************/
+/* FUNCTIONS                                                                  */
+/******************************************************************************/
+
+//------------------------------------------------------------------------------
+//Calculate CRC32C for array of bytes (SSE4.2 crc32 instruction if present,
+//slicing-by-8 otherwise)
+//Inputs:  crc   = previous crc32c value (if not defined, use CRC32C_INIT)
+//         data  = array of bytes
+//         bytes = number of bytes in data[] array
+//Returns: crc32c = calculated CRC32C
+uint32_t crc32c( uint32_t crc, const void * data, size_t bytes )
+{
+        pthread_once( &crc32c_once, init_crc32c );
+
+#ifdef CRC32C_HW_SUPPORTED
+        if(crc32c_hw_present)
+                return crc32c_sse42( crc, data, bytes );
+#endif
+        return crc32c_sw( crc, data, bytes );
+}
+
+//------------------------------------------------------------------------------
+//Check if crc32c() uses hardware instruction
+//Returns: 1 = SSE4.2 crc32, 0 = slicing-by-8 tables
+int crc32c_hw( void )
+{
+        pthread_once( &crc32c_once, init_crc32c );
+
+        return crc32c_hw_present;
+}
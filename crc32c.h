@@ -0,0 +1,23 @@
+/******************************************************************************/
+/* crc32c.h                                                                   */
+/* CRC32C (CASTAGNOLI) UTILITES (DEFINITIONS)                                 */
+/*                                                                            */
+/* Copyright (c) 2016 Sergey Mashkin                                          */
+/******************************************************************************/
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CRC32C_INIT  0x00000000
+
+/******************************************************************************/
+/* FUNCTIONS                                                                  */
+/******************************************************************************/
+
+uint32_t crc32c        ( uint32_t crc, const void * data, size_t bytes );
+int      crc32c_hw     ( void );
+
+#endif //CRC32C_H
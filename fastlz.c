@@ -439,6 +439,11 @@ static FASTLZ_INLINE int FASTLZ_DECOMPRESSOR(const void* input, int length, void
 #endif
       len--;
       ref -= ofs;
+#ifdef FASTLZ_SAFE
+      /* length and distance bytes must be inside of input */
+      if (FASTLZ_UNEXPECT_CONDITIONAL(ip + (len == 7-1) >= ip_limit))
+        return 0;
+#endif
       if (len == 7-1)
 #if FASTLZ_LEVEL==1
         len += *ip++;
@@ -446,9 +451,17 @@ static FASTLZ_INLINE int FASTLZ_DECOMPRESSOR(const void* input, int length, void
 #else
         do
         {
+#ifdef FASTLZ_SAFE
+          if (FASTLZ_UNEXPECT_CONDITIONAL(ip >= ip_limit))
+            return 0;
+#endif
           code = *ip++;
           len += code;
         } while (code==255);
+#ifdef FASTLZ_SAFE
+      if (FASTLZ_UNEXPECT_CONDITIONAL(ip >= ip_limit))
+        return 0;
+#endif
       code = *ip++;
       ref -= code;
 
@@ -456,6 +469,10 @@ static FASTLZ_INLINE int FASTLZ_DECOMPRESSOR(const void* input, int length, void
       if(FASTLZ_UNEXPECT_CONDITIONAL(code==255))
       if(FASTLZ_EXPECT_CONDITIONAL(ofs==(31 << 8)))
       {
+#ifdef FASTLZ_SAFE
+        if (FASTLZ_UNEXPECT_CONDITIONAL(ip + 2 > ip_limit))
+          return 0;
+#endif
         ofs = (*ip++) << 8;
         ofs += *ip++;
         ref = op - ofs - MAX_DISTANCE;
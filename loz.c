@@ -15,6 +15,9 @@
 #include  <sys/sysinfo.h>
 #include  <sys/time.h>
 #include  <sys/resource.h>
+#include  <sys/types.h>
+#include  <sys/stat.h>
+#include  <fcntl.h>
 
 #include  "lozfile.h"
 
@@ -27,6 +30,10 @@
 
 #define DEFAULT_SEGMENTSIZE     16384
 #define DEFAULT_METHOD          "fastlz2"
+#define DEFAULT_JOBS            1
+#define DEFAULT_RATIO           LOZ_AUTO_RATIO_DEFAULT
+#define EXTRACT_BUFFSIZE        (1024*1024)
+#define CREATE_BUFFSIZE         (1024*1024)
 
 #define ACTION_NULL             0
 #define ACTION_HELP             1
@@ -40,6 +47,9 @@ static char  filename1[256];
 static char  filename2[256];
 static char  method[16];
 static int   segmentsize;
+static int   jobs;
+static int   ratio;
+static int   noverify;
 
 char * usagestr =
 "\n"
@@ -52,28 +62,42 @@ char * usagestr =
 "  files in LOZ-format.\n"
 "\n"
 "USAGE:\n"
-"  loz -c <file> [<archive.loz>] [-m <method>] [-s <segmentsize>]\n"
+"  loz -c <file> [<archive.loz>] [-m <method>] [-r <ratio>] [-s <segmentsize>] [-j <jobs>]\n"
 "    Compress <file> with LOZ compressor. If name of output\n"
 "    file not defined, original name of <file> will be used with\n"
 "    .loz extension.\n"
 "    -m <method> - set compression method if needed. Supported\n"
-"    values are: none, rle, rle2, lz, fastlz1, fastlz2\n"
+"    values are: none, rle, rle2, lz, fastlz1, fastlz2, auto\n"
+"    (auto - method is chosen for every segment)\n"
+"    -r <ratio> - target ratio of auto method, % of original size:\n"
+"    the fastest method which achieves it is used. Supported\n"
+"    values are: 1...100 (100 - fastest, 1 - smallest)\n"
 "    -s <segmentsize> - set segment size. Supported values\n"
-"    are: 128...65536\n"
+"    are: 32...16777216 (suffixes K and M are allowed: 64K, 16M)\n"
+"    -j <jobs> - number of threads to compress segments in\n"
+"    parallel. Supported values are: 1...64\n"
 "\n"
-"  loz -a <file> <archive.loz> [-s <segmentsize>]\n"
+"  loz -a <file> <archive.loz> [-m <method>] [-r <ratio>] [-s <segmentsize>] [-j <jobs>]\n"
 "    Compress <file> with LOZ compressor and add it to existing\n"
 "    LOZ archive <archive.loz>. If LOZ archive does not exist,\n"
 "    it will be created.\n"
+"    -m <method> - set compression method of added data. Archives\n"
+"    of old format (version 0,1) keep their own method.\n"
 "    -s <segmentsize> - set segment size. Supported values\n"
-"    are: 128...65536\n"
+"    are: 32...16777216 (suffixes K and M are allowed: 64K, 16M)\n"
+"    -j <jobs> - number of threads to compress segments in\n"
+"    parallel. Supported values are: 1...64\n"
 "\n"
-"  loz -x <archive.loz> [<file>]\n"
+"  loz -x <archive.loz> [<file>] [-j <jobs>] [--no-verify]\n"
 "    Decompress <archive.loz> with LOZ decompressor and write uncompressed\n"
 "    data to <file>. If <file> exists it will be overwritten.\n"
 "    If name of <file> is not defined and <archive.loz> filename has\n"
 "    .loz extension, <archive.loz> filename without .loz will be\n"
 "    used as name of output <file>.\n"
+"    -j <jobs> - number of threads to decompress sections in\n"
+"    parallel. Supported values are: 1...64\n"
+"    --no-verify - do not check CRC of compressed data (for verified\n"
+"    archives), headers of sections are checked\n"
 "\n"
 "  loz -h\n"
 "      Show help information (this page).\n"
@@ -84,6 +108,8 @@ char * usagestr =
 "    --extract     instead of -x\n"
 "    --method      instead of -m\n"
 "    --segmentsize instead of -s\n"
+"    --jobs        instead of -j\n"
+"    --ratio       instead of -r\n"
 "    --help        instead of -h\n"
 "-----------------------------------------------------\n";
 
@@ -137,17 +163,46 @@ int method_from_str( char * method )
     else if(0==strcmp(method,"fastlz2")) {
         return LOZ_COMPRESSION_FASTLZ2;
     }
+    else if(0==strcmp(method,"auto")) {
+        return LOZ_COMPRESSION_AUTO;
+    }
     else {
         printf("method=%s is unsupported\n", method);
         return -1;
     }
 }
 
+//------------------------------------------------------------------------------
+//Convert segmentsize string (bytes, with optional suffix K or M) to number
+//returns: segmentsize, 0=invalid string
+int segmentsize_from_str( char * str )
+{
+    char * end;
+    long   size;
+    long   multiplier = 1;
+
+    size = strtol( str, &end, 10 );
+    if( (*end=='k') || (*end=='K') ) {
+        multiplier = 1024;
+        end++;
+    }
+    else if( (*end=='m') || (*end=='M') ) {
+        multiplier = 1024 * 1024;
+        end++;
+    }
+    //check range before multiplication (it must not overflow)
+    if( (end==str) || (*end!='\0') || (size <= 0) || (size > LOZ_BLOCKSIZE_MAX / multiplier) ) {
+        printf("segmentsize=%s is unsupported\n", str);
+        return 0;
+    }
+    return size * multiplier;
+}
+
 //------------------------------------------------------------------------------
 //Check if segmentsize is valid
 int segmentsize_valid( int segmentsize )
 {
-    if( (segmentsize >= LOZ_BLOCKSIZE_MIN) ||
+    if( (segmentsize >= LOZ_BLOCKSIZE_MIN) &&
         (segmentsize <= LOZ_BLOCKSIZE_MAX)   )
     {
         return 1;
@@ -158,6 +213,56 @@ int segmentsize_valid( int segmentsize )
     }
 }
 
+//------------------------------------------------------------------------------
+//Convert method code to string
+char * method_to_str( int method )
+{
+    static char str[32];
+    switch(method)
+    {
+    case LOZ_COMPRESSION_NONE:      return "none";
+    case LOZ_COMPRESSION_RLE:       return "rle";
+    case LOZ_COMPRESSION_RLE2:      return "rle2";
+    case LOZ_COMPRESSION_LZ:        return "lz";
+    case LOZ_COMPRESSION_FASTLZ1:   return "fastlz1";
+    case LOZ_COMPRESSION_FASTLZ2:   return "fastlz2";
+    case LOZ_COMPRESSION_AUTO:      return "auto";
+    default:
+        snprintf(str,sizeof(str),"?(%d)",method);
+        return str;
+    }
+}
+
+//------------------------------------------------------------------------------
+//Check if target ratio of auto method is valid
+int ratio_valid( int ratio )
+{
+    if( (ratio >= 1) &&
+        (ratio <= 100) )
+    {
+        return 1;
+    }
+    else {
+        printf("ratio=%d is unsupported\n", ratio);
+        return 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+//Check if number of jobs (threads) is valid
+int jobs_valid( int jobs )
+{
+    if( (jobs >= 1) &&
+        (jobs <= LOZ_THREADS_MAX) )
+    {
+        return 1;
+    }
+    else {
+        printf("jobs=%d is unsupported\n", jobs);
+        return 0;
+    }
+}
+
 //------------------------------------------------------------------------------
 //Parse arguments of command line: get action and parameters
 void parse_arguments( int argc, char *argv[] )
@@ -169,6 +274,9 @@ void parse_arguments( int argc, char *argv[] )
     filename2[0] = '\0';
     method[0]    = '\0';
     segmentsize  = -1;
+    jobs         = -1;
+    ratio        = -1;
+    noverify     = 0;
     
     //get action-code and parameters from command line arguments
     pos = 0;
@@ -264,12 +372,42 @@ void parse_arguments( int argc, char *argv[] )
             {
                     pos++;
                     if( (pos<argc) && (argv[pos][0]!='-') )
-                            segmentsize = atoi(argv[pos]);
+                            segmentsize = segmentsize_from_str(argv[pos]);
                             
                     if(segmentsize==-1)
                             goto exit_fail; //'segmentsize' does not exist after --segmentsize
                     continue;
             }
+            
+            if( (0==strcasecmp(argv[pos],"--jobs")) ||
+                (0==strcasecmp(argv[pos],"-j")) )
+            {
+                    pos++;
+                    if( (pos<argc) && (argv[pos][0]!='-') )
+                            jobs = atoi(argv[pos]);
+                            
+                    if(jobs==-1)
+                            goto exit_fail; //'jobs' does not exist after --jobs
+                    continue;
+            }
+
+            if( (0==strcasecmp(argv[pos],"--ratio")) ||
+                (0==strcasecmp(argv[pos],"-r")) )
+            {
+                    pos++;
+                    if( (pos<argc) && (argv[pos][0]!='-') )
+                            ratio = atoi(argv[pos]);
+                            
+                    if(ratio==-1)
+                            goto exit_fail; //'ratio' does not exist after --ratio
+                    continue;
+            }
+
+            if(0==strcasecmp(argv[pos],"--no-verify"))
+            {
+                    noverify = 1;
+                    continue;
+            }
 
             goto exit_fail; //unknown action, invalid arguments
     }
@@ -290,6 +428,16 @@ void parse_arguments( int argc, char *argv[] )
                     goto exit_fail;
             if(!segmentsize_valid(segmentsize))
                     goto exit_fail;
+            if(jobs==-1)
+                    jobs = DEFAULT_JOBS;
+            if(!jobs_valid(jobs))
+                    goto exit_fail;
+            if(ratio==-1)
+                    ratio = DEFAULT_RATIO;
+            if(!ratio_valid(ratio))
+                    goto exit_fail;
+            if(noverify)
+                    goto exit_fail;
             break;
     
     case ACTION_ADD:
@@ -297,12 +445,24 @@ void parse_arguments( int argc, char *argv[] )
                     goto exit_fail;
             if(filename2[0]=='\0')
                     goto exit_fail;
-            if(method[0]!='\0')
+            if(method[0]=='\0')
+                    snprintf(method,sizeof(method),DEFAULT_METHOD);
+            if(method_from_str(method)<0)
                     goto exit_fail;
             if(segmentsize==-1)
                     segmentsize = DEFAULT_SEGMENTSIZE;
             if(!segmentsize_valid(segmentsize))
                     goto exit_fail;
+            if(jobs==-1)
+                    jobs = DEFAULT_JOBS;
+            if(!jobs_valid(jobs))
+                    goto exit_fail;
+            if(ratio==-1)
+                    ratio = DEFAULT_RATIO;
+            if(!ratio_valid(ratio))
+                    goto exit_fail;
+            if(noverify)
+                    goto exit_fail;
             break;
 
     case ACTION_EXTRACT:
@@ -318,6 +478,12 @@ void parse_arguments( int argc, char *argv[] )
                     goto exit_fail;
             if(segmentsize!=-1)
                     goto exit_fail;
+            if(ratio!=-1)
+                    goto exit_fail;
+            if(jobs==-1)
+                    jobs = DEFAULT_JOBS;
+            if(!jobs_valid(jobs))
+                    goto exit_fail;
             break;
 
     case ACTION_HELP:
@@ -329,6 +495,12 @@ void parse_arguments( int argc, char *argv[] )
                     goto exit_fail;
             if(segmentsize!=-1)
                     goto exit_fail;
+            if(jobs!=-1)
+                    goto exit_fail;
+            if(ratio!=-1)
+                    goto exit_fail;
+            if(noverify)
+                    goto exit_fail;
             break;
     }
     
@@ -337,6 +509,9 @@ void parse_arguments( int argc, char *argv[] )
     MYLOG_DEBUG( "filename2       =%s", filename2             );
     MYLOG_DEBUG( "method          =%s", method                );
     MYLOG_DEBUG( "segmentsize     =%d", segmentsize           );
+    MYLOG_DEBUG( "jobs            =%d", jobs                  );
+    MYLOG_DEBUG( "ratio           =%d", ratio                 );
+    MYLOG_DEBUG( "noverify        =%d", noverify              );
     return;
     
 exit_fail:
@@ -345,6 +520,70 @@ exit_fail:
     return;
 }
 
+//------------------------------------------------------------------------------
+//Compress data of file into lozfile by CREATE_BUFFSIZE chunks
+//returns:  size = number of compressed (uncompressed raw) bytes
+//         -1    = error
+off_t compress_file( FILE * file, lozfile_t * lozfile, uint8_t * buff )
+{
+    off_t    size = 0;
+    int      n;
+
+    while(1) {
+        n = fread(buff,sizeof(uint8_t),CREATE_BUFFSIZE,file);
+        if(n > 0) {
+            if(loz_write(lozfile,(char*)buff,n) != n) {
+                printf("Error: could not write to LOZ-archive \"%s\".\n", filename2);
+                return -1;
+            }
+            size += n;
+        }
+        if(n < CREATE_BUFFSIZE) {
+            if(feof(file))
+                break;
+            printf("Error: could not read from file \"%s\".\n", filename1);
+            return -1;
+        }
+    }
+    return size;
+}
+
+//------------------------------------------------------------------------------
+//Print compression statistics
+void print_speed( off_t size, struct timeval * t0 )
+{
+    struct timeval t1;
+    struct stat    st;
+    double         sec;
+
+    gettimeofday(&t1, NULL);
+    sec = (t1.tv_sec - t0->tv_sec) + (t1.tv_usec - t0->tv_usec) / 1000000.0;
+    if(sec <= 0)
+        sec = 0.000001;
+    if(stat(filename2, &st))
+        st.st_size = 0;
+    printf("%lld bytes -> %lld bytes in %.2f sec: %.1f MB/s (%d jobs)\n",
+           (long long)size, (long long)st.st_size, sec, size / 1048576.0 / sec, jobs);
+}
+
+//------------------------------------------------------------------------------
+//Print number of segments and their size by compression method
+void print_stats( lozfile_t * lozfile )
+{
+    lozfile_stats_t stats;
+    int             i;
+
+    if(loz_stats(lozfile, &stats) != LOZ_OK)
+        return;
+    for(i=LOZ_COMPRESSION_MIN; i<=LOZ_COMPRESSION_MAX; i++) {
+        if(stats.sections[i]==0)
+            continue;
+        printf("  %-8s %8u segments: %12llu bytes -> %12llu bytes\n",
+               method_to_str(i), stats.sections[i],
+               (unsigned long long)stats.rawsize[i], (unsigned long long)stats.compsize[i]);
+    }
+}
+
 /*** MAIN FUNCTION *********************************/
 
 //---------------------------------------------------
@@ -352,8 +591,12 @@ int main(int argc, char *argv[])
 {
     int        err;
     FILE     * file = NULL;
+    int        fid = -1;
     lozfile_t * lozfile = NULL;
     uint8_t  * buff = NULL;
+    off_t      size;
+    struct timeval   t0;
+    lozfile_opts_t   opts;
 
     MYLOG_INIT( 0
       //| MYLOG_ENABLED_ALL
@@ -383,7 +626,8 @@ int main(int argc, char *argv[])
         {
             printf("create LOZ archive\n");
 
-            buff = malloc(segmentsize);
+            gettimeofday(&t0, NULL);
+            buff = malloc(CREATE_BUFFSIZE);
             if(buff==NULL) {
                 printf("Error: could not allocate memory for buffer.\n");
                 goto exit_fail;
@@ -393,31 +637,23 @@ int main(int argc, char *argv[])
                 printf("Error: could not open file \"%s\".\n", filename1);
                 goto exit_fail;
             }
-            lozfile = loz_open( filename2, "w+", segmentsize, method_from_str(method) );
+            memset(&opts, 0, sizeof(opts));
+            opts.nthreads   = jobs;
+            opts.auto_ratio = ratio;
+            lozfile = loz_open_ex( filename2, "w+", segmentsize, method_from_str(method), &opts );
             if(lozfile==NULL) {
                 printf("Error: could not create LOZ-archive \"%s\".\n", filename2);
                 goto exit_fail;
             }
-            while(1) {
-                err = fread(buff,sizeof(uint8_t),1,file);
-                if(err != 1) {
-                    if(feof(file)) {
-                        break;
-                    }
-                    else {
-                        printf("Error: could not read from file \"%s\".\n", filename1);
-                        goto exit_fail;
-                    }
-                }
-                err = loz_write(lozfile,(char*)buff,1);
-                if(err != 1) {
-                    printf("Error: could not write to LOZ-archive \"%s\".\n", filename2);
-                    goto exit_fail;
-                }
-            }
+            size = compress_file( file, lozfile, buff );
+            if(size < 0)
+                goto exit_fail;
             fclose(file);
+            loz_flush(lozfile);
+            print_stats(lozfile);
             loz_close(lozfile);
             free(buff);
+            print_speed( size, &t0 );
             printf("ok.\n");
             exit(EXIT_SUCCESS);
         }
@@ -426,7 +662,8 @@ int main(int argc, char *argv[])
         {
             printf("add new data to LOZ archive\n");
 
-            buff = malloc(1024);
+            gettimeofday(&t0, NULL);
+            buff = malloc(CREATE_BUFFSIZE);
             if(buff==NULL) {
                 printf("Error: could not allocate memory for buffer.\n");
                 goto exit_fail;
@@ -436,31 +673,23 @@ int main(int argc, char *argv[])
                 printf("Error: could not open file \"%s\".\n", filename1);
                 goto exit_fail;
             }
-            lozfile = loz_open( filename2, "r+", 1024, LOZ_COMPRESSION_NONE );
+            memset(&opts, 0, sizeof(opts));
+            opts.nthreads   = jobs;
+            opts.auto_ratio = ratio;
+            lozfile = loz_open_ex( filename2, "r+", segmentsize, method_from_str(method), &opts );
             if(lozfile==NULL) {
                 printf("Error: could not create LOZ-archive \"%s\".\n", filename2);
                 goto exit_fail;
             }
-            while(1) {
-                err = fread(buff,sizeof(uint8_t),1,file);
-                if(err != 1) {
-                    if(feof(file)) {
-                        break;
-                    }
-                    else {
-                        printf("Error: could not read from file \"%s\".\n", filename1);
-                        goto exit_fail;
-                    }
-                }
-                err = loz_write(lozfile,(char*)buff,1);
-                if(err != 1) {
-                    printf("Error: could not write to LOZ-archive \"%s\".\n", filename2);
-                    goto exit_fail;
-                }
-            }
+            size = compress_file( file, lozfile, buff );
+            if(size < 0)
+                goto exit_fail;
             fclose(file);
+            loz_flush(lozfile);
+            print_stats(lozfile);
             loz_close(lozfile);
             free(buff);
+            print_speed( size, &t0 );
             printf("ok.\n");
             exit(EXIT_SUCCESS);
         }
@@ -469,42 +698,64 @@ int main(int argc, char *argv[])
         {
             printf("extract LOZ archive\n");
 
-            buff = malloc(65535);
-            if(buff==NULL) {
-                printf("Error: could not allocate memory for buffer.\n");
-                goto exit_fail;
-            }
-            lozfile = loz_open( filename1, "r", 65535, LOZ_COMPRESSION_LZ );
+            memset(&opts, 0, sizeof(opts));
+            opts.flags = noverify ? LOZ_FLAG_NOVERIFY : 0;
+            lozfile = loz_open_ex( filename1, "r", 65535, LOZ_COMPRESSION_LZ, &opts );
             if(lozfile==NULL) {
                 printf("Error: could not open LOZ-archive \"%s\".\n", filename1);
                 goto exit_fail;
             }
+            
+            if(jobs > 1) {
+                //decompress sections in parallel, write them at their rawpos
+                fid = open( filename2, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+                if(fid < 0) {
+                    printf("Error: could not open file \"%s\".\n", filename2);
+                    goto exit_fail;
+                }
+                if(loz_extract(lozfile, fid, jobs) < 0) {
+                    printf("Error: could not extract LOZ-archive \"%s\".\n", filename1);
+                    goto exit_fail;
+                }
+                if(close(fid)) {
+                    fid = -1;
+                    printf("Error: could not write to file \"%s\".\n", filename2);
+                    goto exit_fail;
+                }
+                loz_close(lozfile);
+                printf("ok.\n");
+                exit(EXIT_SUCCESS);
+            }
+
+            buff = malloc(EXTRACT_BUFFSIZE);
+            if(buff==NULL) {
+                printf("Error: could not allocate memory for buffer.\n");
+                goto exit_fail;
+            }
             file = fopen( filename2, "w" );
             if(file==NULL) {
                 printf("Error: could not open file \"%s\".\n", filename2);
                 goto exit_fail;
             }
             while(1) {
-                err = loz_read(lozfile,(char*)buff,1);
+                err = loz_read(lozfile,(char*)buff,EXTRACT_BUFFSIZE);
                 if(err == 0) {
                     break;
                 }
-                else if(err != 1) {
+                else if(err < 0) {
                     printf("Error: could not read from LOZ-archive \"%s\".\n", filename1);
                     goto exit_fail;
                 }
-                err = fwrite(buff,sizeof(uint8_t),1,file);
-                if(err != 1) {
-                    if(feof(file)) {
-                        break;
-                    }
-                    else {
-                        printf("Error: could not write to file \"%s\".\n", filename2);
-                        goto exit_fail;
-                    }
+                if(fwrite(buff,sizeof(uint8_t),err,file) != err) {
+                    printf("Error: could not write to file \"%s\".\n", filename2);
+                    goto exit_fail;
                 }
             }
-            fclose(file);
+            if(fclose(file)) {
+                file = NULL;
+                printf("Error: could not write to file \"%s\".\n", filename2);
+                goto exit_fail;
+            }
             loz_close(lozfile);
             free(buff);
             printf("ok.\n");
@@ -521,6 +772,8 @@ int main(int argc, char *argv[])
 exit_fail:
         if(file)
             fclose(file);
+        if(fid >= 0)
+            close(fid);
         if(lozfile)
             loz_close(lozfile);
         if(buff)
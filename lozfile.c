@@ -6,8 +6,11 @@
 /* e-mail: mashkh@yandex.ru                                                   */
 /******************************************************************************/
 
+#define _GNU_SOURCE //memrchr()
+
 #include  "lozfile.h"
 #include  "crc8.h"
+#include  "crc32c.h"
 #include  "fastlz.h"
 #include  "compress_rle.h"
 #include  "compress_rle2.h"
@@ -26,16 +29,43 @@
 #include  <sys/types.h>
 #include  <sys/stat.h>
 #include  <unistd.h>
+#include  <sys/uio.h>
+#include  <sys/mman.h>
+#include  <pthread.h>
+#include  <sched.h>
+#include  <math.h>
+
+#if defined(__AVX2__)
+#include  <immintrin.h>
+#elif defined(__SSE2__)
+#include  <emmintrin.h>
+#endif
  
 
 /******************************************************************************/
 /* GLOBAL VARIABLES                                                           */
 /******************************************************************************/
 
-#define LOZ_FILEHEADER_SIZE      6
-#define LOZ_SECTIONHEADER_SIZE   15
-
-#define LOZ_CRC_SIZE             1
+#define LOZ_FILEHEADER_SIZE_V0   6 //file-header of LOZ_VERSION_0..LOZ_VERSION_2
+#define LOZ_FILEHEADER_SIZE_V3   7 //file-header of LOZ_VERSION_3 (+ checksum type)
+#define LOZ_FILEHEADER_SIZE_MAX  LOZ_FILEHEADER_SIZE_V3
+#define LOZ_FILEHEADER_SIZE(lozfile) ((lozfile)->version >= LOZ_VERSION_3 ? LOZ_FILEHEADER_SIZE_V3 \
+                                                                        : LOZ_FILEHEADER_SIZE_V0)
+#define LOZ_SECTIONHEADER_SIZE_V0 15 //section-header of LOZ_VERSION_0, LOZ_VERSION_1
+#define LOZ_SECTIONHEADER_SIZE_V2 16 //section-header of LOZ_VERSION_2, LOZ_VERSION_3 (+ codec id)
+#define LOZ_SECTIONHEADER_SIZE_V4 20 //section-header of LOZ_VERSION_4 (+ 64-bit rawpos)
+#define LOZ_SECTIONHEADER_SIZE_MAX LOZ_SECTIONHEADER_SIZE_V4
+#define LOZ_SECTIONHEADER_SIZE(lozfile) ((lozfile)->version >= LOZ_VERSION_4 ? LOZ_SECTIONHEADER_SIZE_V4 : \
+                                         (lozfile)->version >= LOZ_VERSION_2 ? LOZ_SECTIONHEADER_SIZE_V2 \
+                                                                              : LOZ_SECTIONHEADER_SIZE_V0)
+#define LOZ_RAWPOS_END_MAX(lozfile) ((lozfile)->version >= LOZ_VERSION_4 ? 0x7FFFFFFFFFFFFFFFULL \
+                                                                         : 0xFFFFFFFFULL) //max end of uncompressed data
+
+#define LOZ_CRC_SIZE             1 //CRC of headers, index-block and footer (crc8)
+#define LOZ_DATACRC_SIZE_MAX     4 //CRC of compressed data: crc8 or crc32c
+#define LOZ_DATACRC_SIZE(lozfile) ((lozfile)->checksum == LOZ_CHECKSUM_CRC32C ? 4 : 1)
+
+#define LOZ_SCANBUFF_SIZE        65536 //size of buffer for searching section-begin-marker
 
 static uint8_t LOZ_FMT[] = { 'L','O','Z' };
 #define LOZ_FMT_SIZE             sizeof(LOZ_FMT)
@@ -43,37 +73,274 @@ static uint8_t LOZ_FMT[] = { 'L','O','Z' };
 static uint8_t LOZ_BEGINMARKER[] = { 0xFA, 0xF5 };
 #define LOZ_BEGINMARKER_SIZE     sizeof(LOZ_BEGINMARKER)
 
+static uint8_t LOZ_INDEXMARKER[] = { 0xFA, 0xF6 };
+#define LOZ_INDEXMARKER_SIZE     sizeof(LOZ_INDEXMARKER)
+#define LOZ_INDEXENTRY_SIZE      24
+#define LOZ_INDEXBLOCK_MAX       0x7FFFFFFF //max size of index-block with footer (int size of loz_file_read/write)
+
+static uint8_t LOZ_FOOTER_FMT[] = { 'L','Z','I' };
+#define LOZ_FOOTER_FMT_SIZE      sizeof(LOZ_FOOTER_FMT)
+#define LOZ_FOOTER_SIZE          16
+
+#define LOZ_COMPBOUND(n)         ((n) + (n)/16 + 66) //worst case size of compressed data (fastlz: +5%, at least 66 bytes)
+//buffer for compressed data of n raw bytes: incompressible sections of version 2
+//are stored, so compressed data never exceeds worst case of codecs;
+//sections of older files could be up to 2x of raw data
+#define LOZ_LZBUFF_SIZE(lozfile,n) ((lozfile)->version >= LOZ_VERSION_2 ? LOZ_COMPBOUND(n) : 2 * (n))
+#define LOZ_MAX(a,b)             ((a) > (b) ? (a) : (b))
+#define LOZ_COMPSIZE_MAX(lozfile) LOZ_LZBUFF_SIZE( lozfile, LOZ_BLOCKSIZE_MAX ) //max compsize of section
+#define LOZ_NOSPACE              (-16) //compressed data does not fit output buffer (internal error code)
+#define LOZ_ENTROPY_MIN_SIZE     256   //blocks smaller than this are always compressed
+#define LOZ_ENTROPY_STORED       7.9   //bits per byte: block with higher entropy is stored without compression
+#define LOZ_AUTO_SAMPLE_SIZE     4096  //LOZ_COMPRESSION_AUTO: size of block sample to try codecs on
+
+#define LOZ_LZWORK_SIZE(n)       (((n) + 65536) * sizeof(uint32_t)) //LZ_CompressFast() work area for n bytes
+
+#define LOZ_INDEX_RAWGAP         0x01 //index entry: rawpos does not follow previous entry (varint of gap)
+#define LOZ_INDEX_FPOSGAP        0x02 //index entry: fpos does not follow previous entry (varint of gap)
+#define LOZ_INDEX_RAWSIZE        0x04 //index entry: rawsize differs from previous entry (varint)
+#define LOZ_INDEX_STORED         0x08 //index entry: compsize==rawsize (else varint of compsize)
+#define LOZ_INDEX_ENTRY_MAX      32   //max size of encoded index entry
+
+#define LOZ_JOB_FREE             0 //job slot is free
+#define LOZ_JOB_QUEUED           1 //raw data is waiting for compression
+#define LOZ_JOB_DONE             2 //section is encoded, waiting for commit to file
+
+#define LOZ_RING_HEADER_SIZE     8          //record of loz_append() ring: lap (32 bits), flags|size (32 bits)
+#define LOZ_RING_PAD             0x80000000 //record is padding up to the end of ring (no data)
+#define LOZ_RING_ALIGN(n)        (((n) + 7) & ~7)
+#define LOZ_RING_HEADER(pos,bits,size) ( ((uint64_t)(uint32_t)(((pos) >> (bits)) + 1) << 32) | (size) )
+#define LOZ_APPEND_LINE          512        //loz_appendf(): longer lines are formatted to heap
+
+//Position in in-memory section index (see loz_index_next())
+typedef struct lozfile_index_cursor_t lozfile_index_cursor_t;
+struct lozfile_index_cursor_t
+{
+        int                n;           //number of entry
+        uint32_t           pos;         //offset of next encoded entry in index_data[]
+        lozfile_index_t    entry;       //decoded entry n
+};
+
+//Section to be written to file (built by loz_encode_section(), written by loz_commit_section())
+typedef struct lozfile_job_t lozfile_job_t;
+struct lozfile_job_t
+{
+        int                state;       //LOZ_JOB_xxx (used by pool only)
+        int                error;       //result of loz_encode_section()
+        lozfile_section_t  section;
+        uint8_t            header[LOZ_SECTIONHEADER_SIZE_MAX]; //on-disk section-header
+        uint8_t            datacrc[LOZ_DATACRC_SIZE_MAX]; //on-disk compressed data CRC
+        uint8_t          * rawdata;     //raw data to be compressed (section.rawsize bytes)
+        uint8_t          * rawbuff;     //own raw data buffer (used by pool only)
+        uint8_t          * lzbuff;      //buffer for compressed data (LOZ_LZBUFF_SIZE of lozfile->buffsize bytes)
+        uint32_t         * lzwork;      //LZ match finder work area (LOZ_COMPRESSION_LZ only)
+};
+
+//Pool of compression threads: sections are compressed in parallel and
+//committed to file in the same order as they were submitted
+struct lozfile_pool_t
+{
+        pthread_t        * threads;
+        int                nthreads;
+        lozfile_job_t    * jobs;        //ring of jobs: job of sequence number seq is jobs[seq % njobs]
+        int                njobs;
+        long int           head;        //seq of next job to be submitted
+        long int           next;        //seq of next job to be compressed
+        long int           tail;        //seq of next job to be committed
+        int                stop;
+        pthread_mutex_t    mutex;
+        pthread_cond_t     cond_work;   //job is submitted / pool is stopped
+        pthread_cond_t     cond_done;   //job is compressed / committed (CLOCK_MONOTONIC)
+
+        //LOZ_FLAG_ASYNC: jobs are committed by writer thread, it also submits
+        //data which stays in wrbuff[] longer than flush_ms
+        int                flush_ms;    //max delay of data in wrbuff[], ms (0=synchronous commit)
+        pthread_t          writer;
+        int                writer_started;
+        int                error;       //writer thread could not write section (pool->mutex)
+        pthread_mutex_t    wr_mutex;    //wrbuff[] is shared by caller and writer thread
+        long int           wr_time;     //time of the oldest data in wrbuff[], ms (see loz_time_ms())
+
+        //LOZ_FLAG_ASYNC: ring of loz_append() records (many producers, one consumer
+        //with wr_mutex locked). Positions grow without wrapping, offset in ring
+        //is pos & (ring_size-1). Record is published by its header with lap of
+        //pos, so headers left from previous laps are not taken as ready.
+        uint8_t          * ring;        //allocated by the first loz_append()
+        uint32_t           ring_size;   //power of 2
+        uint32_t           ring_bits;   //log2(ring_size)
+        uint8_t            ring_pad0[64];
+        uint64_t           ring_reserve; //end of reserved records (producers, atomic)
+        uint8_t            ring_pad1[64];
+        uint64_t           ring_release; //end of consumed records (consumer, atomic)
+        uint8_t            ring_pad2[64];
+};
+
+//Parallel extraction of lozfile (see loz_extract())
+typedef struct lozfile_extract_t lozfile_extract_t;
+struct lozfile_extract_t
+{
+        lozfile_t        * lozfile;
+        int                fid;         //output file
+        lozfile_index_cursor_t cursor;  //next valid section to be extracted
+        int                more;        //cursor points to section (not extracted yet)
+        off_t              fpos;        //end of previous section in file
+        off_t              rawpos;      //end of previous section in raw data
+        int                error;
+        pthread_mutex_t    mutex;
+};
+
+#define LOZ_CACHE_BUCKETS_MIN    256 //initial size of hash table of lozfile_cache_t
+#define LOZ_CACHE_ENTRY_SIZE(n)  ((long int)sizeof(lozfile_cache_entry_t) + (n)) //memory of cached section of n bytes
+
+//Uncompressed section in cache (see lozfile_cache_t)
+typedef struct lozfile_cache_entry_t lozfile_cache_entry_t;
+struct lozfile_cache_entry_t
+{
+        lozfile_cache_entry_t * hnext;  //next entry of hash chain
+        lozfile_cache_entry_t * prev;   //LRU list: more recently used entry
+        lozfile_cache_entry_t * next;   //LRU list: less recently used entry
+        uint64_t           dev;         //file of section: device
+        uint64_t           ino;         //file of section: inode
+        off_t              fpos;        //begining of section in file
+        off_t              next_fpos;   //begining of next section in file
+        int                rawsize;     //uncompressed section data size
+        uint8_t            data[];      //uncompressed section data
+};
+
+//Cache of uncompressed sections: hash table by (dev,ino,fpos) and LRU list
+struct lozfile_cache_t
+{
+        lozfile_cache_entry_t ** buckets;
+        int                nbuckets;    //size of buckets[], power of 2
+        lozfile_cache_entry_t  * head;  //most recently used entry
+        lozfile_cache_entry_t  * tail;  //least recently used entry
+        lozfile_cache_stats_t    stats; //counters, stats.used is kept <= stats.size
+        pthread_mutex_t    mutex;
+};
+
+//Read buffers of thread: thread-local ones of loz_pread() (freed on exit of
+//thread) and ones of loz_extract() threads
+typedef struct lozfile_scratch_t lozfile_scratch_t;
+struct lozfile_scratch_t
+{
+        uint8_t          * lzbuff;      //compressed data
+        int                lzbuffsize;
+        uint8_t          * rawbuff;     //uncompressed data of partially readed section
+        int                rawbuffsize;
+};
+
+static pthread_key_t   loz_scratch_key;
+static pthread_once_t  loz_scratch_once = PTHREAD_ONCE_INIT;
+
 /******************************************************************************/
 /* PRIVATE FUNCTIONS PROTOTYPES                                               */
 /******************************************************************************/
 
 int      file_exists                    ( const char * filepath );
 char *   compression_to_str             ( uint8_t compression );
+char *   checksum_to_str                ( uint8_t checksum );
+void     put_uint32                     ( uint8_t * buf, uint32_t value );
+void     put_uint64                     ( uint8_t * buf, uint64_t value );
+uint32_t get_uint32                     ( uint8_t * buf );
+uint64_t get_uint64                     ( uint8_t * buf );
+int      loz_file_readv                 ( lozfile_t * lozfile, off_t fpos, struct iovec * iov, int iovcnt );
+int      loz_file_read                  ( lozfile_t * lozfile, off_t fpos, void * buf, int size );
+int      loz_file_writev                ( lozfile_t * lozfile, off_t fpos, struct iovec * iov, int iovcnt );
+int      loz_file_write                 ( lozfile_t * lozfile, off_t fpos, void * buf, int size );
+off_t    loz_file_size                  ( lozfile_t * lozfile );
+int      loz_map_open                   ( lozfile_t * lozfile );
+void     loz_map_advise                 ( lozfile_t * lozfile, off_t fpos, off_t size, int advice );
+int      loz_buff_reserve               ( uint8_t ** buff, int * size, int need );
 void     loz_section_copy               ( lozfile_section_t * dest, lozfile_section_t * src );
     
 int      loz_compress_data              ( int compression, uint8_t * rawdata, int rawsize,
-                                          uint8_t * compdata, int compsizemax, int * compsize );
+                                          uint8_t * compdata, int compsizemax, int * compsize,
+                                          uint32_t * work );
     
+double   loz_entropy                    ( uint8_t * data, int size );
+uint8_t  loz_auto_codec                 ( lozfile_t * lozfile, lozfile_job_t * job );
 int      loz_uncompress_data            ( int compression, uint8_t * compdata, int compsize,
                                           uint8_t * rawdata, int rawsizemax, int * rawsize );
     
-long int loz_find_seq2                  ( lozfile_t * lozfile, uint8_t * seq2, long int startpos );
-long int loz_find_seq2_reverse          ( lozfile_t * lozfile, uint8_t * seq2, long int startpos );
+int      loz_memfind2                   ( uint8_t * buf, int size, uint8_t * seq2 );
+int      loz_find_section               ( lozfile_t * lozfile, lozfile_section_t * header, off_t startpos );
+off_t    loz_find_seq2_reverse          ( lozfile_t * lozfile, uint8_t * seq2, off_t startpos );
     
 int      loz_read_fileheader            ( lozfile_t * lozfile );
 int      loz_write_fileheader           ( lozfile_t * lozfile );
     
-int      loz_read_section_header        ( lozfile_t * lozfile, lozfile_section_t * header, long int fpos );
-int      loz_write_section_header       ( lozfile_t * lozfile, lozfile_section_t * header );
-int      loz_write_section_header_crc   ( lozfile_t * lozfile, lozfile_section_t * header );
+int      loz_parse_section_header       ( lozfile_t * lozfile, lozfile_section_t * header, uint8_t * buf, off_t fpos );
+int      loz_read_section_header        ( lozfile_t * lozfile, lozfile_section_t * header, off_t fpos );
+void     loz_put_section_header         ( lozfile_t * lozfile, lozfile_section_t * header, uint8_t * buf );
     
-int      loz_write_compdata             ( lozfile_t * lozfile, long int fpos, uint8_t * compdata, int compsize );
-int      loz_read_compdata              ( lozfile_t * lozfile, long int fpos, uint8_t * compdata, int compsize );
+int      loz_encode_section             ( lozfile_t * lozfile, lozfile_job_t * job );
+int      loz_commit_section             ( lozfile_t * lozfile, lozfile_job_t * job );
+void     loz_put_datacrc                ( lozfile_t * lozfile, uint8_t * compdata, int compsize, uint8_t * buf );
+int      loz_read_compdata              ( lozfile_t * lozfile, off_t fpos, uint8_t ** compdata, int compsize );
     
 int      loz_section_first              ( lozfile_t * lozfile, lozfile_section_t * section );
 int      loz_section_next               ( lozfile_t * lozfile, lozfile_section_t * curr, lozfile_section_t * next );
 int      loz_section_last               ( lozfile_t * lozfile, lozfile_section_t * section );
-int      loz_section_raw_fpos           ( lozfile_t * lozfile, lozfile_section_t * section, long int fpos );
+int      loz_section_raw_fpos           ( lozfile_t * lozfile, lozfile_section_t * section, off_t fpos );
+
+int      put_varint                     ( uint8_t * buf, uint64_t value );
+int      get_varint                     ( uint8_t * buf, uint64_t * value );
+void     loz_index_reset                ( lozfile_t * lozfile );
+int      loz_index_add                  ( lozfile_t * lozfile, lozfile_section_t * section );
+int      loz_index_next                 ( lozfile_t * lozfile, lozfile_index_cursor_t * cursor );
+int      loz_index_seek                 ( lozfile_t * lozfile, int n, lozfile_index_cursor_t * cursor );
+int      loz_index_eytz_fill            ( lozfile_t * lozfile, int i, int k );
+int      loz_index_eytz_build           ( lozfile_t * lozfile );
+int      loz_index_build                ( lozfile_t * lozfile );
+int      loz_index_find                 ( lozfile_t * lozfile, off_t rawpos, lozfile_index_t * entry );
+int      loz_index_upper                ( lozfile_t * lozfile, off_t rawpos, lozfile_index_t * entry );
+int      loz_index_ready                ( lozfile_t * lozfile );
+int      loz_read_index                 ( lozfile_t * lozfile, off_t * indexpos );
+int      loz_write_index                ( lozfile_t * lozfile );
+
+void *   loz_pool_worker                ( void * arg );
+void *   loz_pool_writer                ( void * arg );
+int      loz_pool_start                 ( lozfile_t * lozfile, int nthreads, int flush_ms, int ring_size );
+void     loz_pool_stop                  ( lozfile_t * lozfile );
+int      loz_pool_submit                ( lozfile_t * lozfile, off_t rawpos, uint8_t * rawdata, int rawsize );
+int      loz_pool_commit                ( lozfile_t * lozfile, int wait );
+int      loz_pool_drain                 ( lozfile_t * lozfile );
+int      loz_ring_drain                 ( lozfile_t * lozfile, int writer );
+int      loz_ring_sync                  ( lozfile_t * lozfile );
+long int loz_time_ms                    ( void );
+
+int      loz_write_section              ( lozfile_t * lozfile, off_t rawpos, uint8_t * rawdata, int rawsize );
+int      loz_write_data                 ( lozfile_t * lozfile, uint8_t * data, int size );
+int      loz_write_aged                 ( lozfile_t * lozfile, uint8_t * data, int size, long int age );
+int      loz_write_format               ( lozfile_t * lozfile, const char * format, va_list arg );
+int      loz_alloc_wrbuff               ( lozfile_t * lozfile );
+int      loz_flush_wrbuff_to_file       ( lozfile_t * lozfile );
+int      loz_load_section               ( lozfile_t * lozfile, lozfile_section_t * section );
+int      loz_decode_section             ( lozfile_t * lozfile, lozfile_section_t * section, int loaded, uint8_t * outbuff, int outsize );
+int      loz_read_section               ( lozfile_t * lozfile, uint8_t * outbuff, int outsize );
+int      loz_fill_rdbuff                ( lozfile_t * lozfile );
+
+lozfile_cache_entry_t ** loz_cache_slot ( lozfile_cache_t * cache, uint64_t dev, uint64_t ino, off_t fpos );
+void     loz_cache_lru_unlink           ( lozfile_cache_t * cache, lozfile_cache_entry_t * entry );
+void     loz_cache_lru_push             ( lozfile_cache_t * cache, lozfile_cache_entry_t * entry );
+void     loz_cache_remove               ( lozfile_cache_t * cache, lozfile_cache_entry_t * entry );
+int      loz_cache_grow                 ( lozfile_cache_t * cache );
+int      loz_cache_get                  ( lozfile_t * lozfile, uint8_t * outbuff, int outsize );
+int      loz_cache_copy                 ( lozfile_t * lozfile, off_t fpos, int offset, uint8_t * buf, int size );
+void     loz_cache_put                  ( lozfile_t * lozfile, off_t fpos, off_t next_fpos, uint8_t * data, int rawsize );
+void     loz_cache_purge                ( lozfile_t * lozfile, off_t fpos );
+
+int      loz_uncompress_section         ( lozfile_t * lozfile, lozfile_index_t * section, uint8_t * lzbuff, int lzbuffsize,
+                                          uint8_t * rawbuff, int rawsizemax, int * valid );
+int      loz_extract_section            ( lozfile_t * lozfile, lozfile_index_t * section,
+                                          lozfile_scratch_t * scratch, int fid );
+int      loz_extract_next               ( lozfile_extract_t * ext, lozfile_index_t * section );
+void *   loz_extract_worker             ( void * arg );
+
+void     loz_scratch_free               ( void * arg );
+void     loz_scratch_init               ( void );
+lozfile_scratch_t * loz_scratch_get     ( lozfile_t * lozfile );
+int      loz_scratch_reserve            ( lozfile_t * lozfile, lozfile_scratch_t * scratch, lozfile_index_t * section );
 
 /******************************************************************************/
 /* PRIVATE FUNCTIONS                                                          */
@@ -121,12 +388,257 @@ char * compression_to_str( uint8_t compression )
         case LOZ_COMPRESSION_LZ:        return "lz";
         case LOZ_COMPRESSION_FASTLZ1:   return "fastlz1";
         case LOZ_COMPRESSION_FASTLZ2:   return "fastlz2";
+        case LOZ_COMPRESSION_AUTO:      return "auto";
         default:
                 snprintf(str,sizeof(str),"?(%d)",compression);
                 return str;
         }
 }
 
+//------------------------------------------------------------------------------
+//Convert checksum code to string
+char * checksum_to_str( uint8_t checksum )
+{
+        static char str[32];
+        switch(checksum)
+        {
+        case LOZ_CHECKSUM_CRC8:         return "crc8";
+        case LOZ_CHECKSUM_CRC32C:       return "crc32c";
+        default:
+                snprintf(str,sizeof(str),"?(%d)",checksum);
+                return str;
+        }
+}
+
+//------------------------------------------------------------------------------
+//Put little-endian uint32 value into buf[0..3]
+void put_uint32( uint8_t * buf, uint32_t value )
+{
+        buf[0] = (value >>  0) & 0xFF;
+        buf[1] = (value >>  8) & 0xFF;
+        buf[2] = (value >> 16) & 0xFF;
+        buf[3] = (value >> 24) & 0xFF;
+}
+
+//------------------------------------------------------------------------------
+//Put little-endian uint64 value into buf[0..7]
+void put_uint64( uint8_t * buf, uint64_t value )
+{
+        put_uint32( buf,     (uint32_t)(value & 0xFFFFFFFF) );
+        put_uint32( buf + 4, (uint32_t)(value >> 32) );
+}
+
+//------------------------------------------------------------------------------
+//Get little-endian uint32 value from buf[0..3]
+uint32_t get_uint32( uint8_t * buf )
+{
+        return ((uint32_t)buf[0]<< 0) +
+               ((uint32_t)buf[1]<< 8) +
+               ((uint32_t)buf[2]<<16) +
+               ((uint32_t)buf[3]<<24) ;
+}
+
+//------------------------------------------------------------------------------
+//Get little-endian uint64 value from buf[0..7]
+uint64_t get_uint64( uint8_t * buf )
+{
+        return ((uint64_t)get_uint32(buf + 4) << 32) + get_uint32(buf);
+}
+
+//------------------------------------------------------------------------------
+//Read data from file at fpos to iov[] (stdio buffer and file position are not used)
+//iov[] is modified while reading.
+//returns:  n         = number of readed bytes (less than size of iov[]: End Of File achieved)
+//          LOZ_ERROR = error
+int loz_file_readv( lozfile_t * lozfile, off_t fpos, struct iovec * iov, int iovcnt )
+{
+        ssize_t  n;
+        int      readed;
+
+        readed = 0;
+        if(lozfile->map)
+        {
+                //copy data from mapping of file
+                while( (iovcnt > 0) && (fpos + readed < lozfile->mapsize) ) {
+                        n = lozfile->mapsize - (fpos + readed);
+                        if((size_t)n > iov->iov_len)
+                                n = iov->iov_len;
+                        memcpy( iov->iov_base, lozfile->map + fpos + readed, n );
+                        readed += n;
+                        iov++;
+                        iovcnt--;
+                }
+                return readed;
+        }
+
+        while(iovcnt > 0)
+        {
+                n = preadv( lozfile->fid, iov, iovcnt, fpos + readed );
+                if(n < 0) {
+                        if(errno == EINTR)
+                                continue;
+                        MYLOG_ERROR("preadv(%lld) failed: err=%d: %s", (long long)(fpos + readed), errno, strerror(errno) );
+                        return LOZ_ERROR;
+                }
+                if(n == 0)
+                        break; //End Of File
+                readed += n;
+                
+                //skip readed part of iov[]
+                while( (iovcnt > 0) && ((size_t)n >= iov->iov_len) ) {
+                        n -= iov->iov_len;
+                        iov++;
+                        iovcnt--;
+                }
+                if(iovcnt > 0) {
+                        iov->iov_base  = (uint8_t*)iov->iov_base + n;
+                        iov->iov_len  -= n;
+                }
+        }
+        return readed;
+}
+
+//------------------------------------------------------------------------------
+//Read data from file at fpos to buf[] (stdio buffer and file position are not used)
+//returns:  n         = number of readed bytes (n < size: End Of File achieved)
+//          LOZ_ERROR = error
+int loz_file_read( lozfile_t * lozfile, off_t fpos, void * buf, int size )
+{
+        struct iovec iov;
+
+        iov.iov_base = buf;
+        iov.iov_len  = size;
+        return loz_file_readv( lozfile, fpos, &iov, 1 );
+}
+
+//------------------------------------------------------------------------------
+//Write iov[] to file at fpos by one pwritev() call (stdio buffer and file position are not used).
+//Partial writes are continued, iov[] is modified while writing.
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = error
+int loz_file_writev( lozfile_t * lozfile, off_t fpos, struct iovec * iov, int iovcnt )
+{
+        ssize_t  n;
+
+        while(iovcnt > 0)
+        {
+                n = pwritev( lozfile->fid, iov, iovcnt, fpos );
+                if(n < 0) {
+                        if(errno == EINTR)
+                                continue;
+                        MYLOG_ERROR("pwritev(%lld) failed: err=%d: %s", (long long)fpos, errno, strerror(errno) );
+                        return LOZ_ERROR;
+                }
+                fpos += n;
+                
+                //skip written part of iov[]
+                while( (iovcnt > 0) && ((size_t)n >= iov->iov_len) ) {
+                        n -= iov->iov_len;
+                        iov++;
+                        iovcnt--;
+                }
+                if(iovcnt > 0) {
+                        iov->iov_base  = (uint8_t*)iov->iov_base + n;
+                        iov->iov_len  -= n;
+                }
+        }
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Write buf[] to file at fpos (stdio buffer and file position are not used)
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = error
+int loz_file_write( lozfile_t * lozfile, off_t fpos, void * buf, int size )
+{
+        struct iovec iov;
+
+        iov.iov_base = buf;
+        iov.iov_len  = size;
+        return loz_file_writev( lozfile, fpos, &iov, 1 );
+}
+
+//------------------------------------------------------------------------------
+//Get size of opened file
+//returns:  filesize
+//          LOZ_ERROR = error
+off_t loz_file_size( lozfile_t * lozfile )
+{
+        struct stat st;
+
+        if( fstat( lozfile->fid, &st ) ) {
+                MYLOG_ERROR("fstat() failed: err=%d: %s", errno, strerror(errno) );
+                return LOZ_ERROR;
+        }
+        return (off_t)st.st_size;
+}
+
+//------------------------------------------------------------------------------
+//Map opened file to memory for reading (LOZ_FLAG_MMAP)
+//returns: LOZ_OK    = ok, file is mapped
+//         LOZ_ERROR = file could not be mapped (it is read by pread())
+int loz_map_open( lozfile_t * lozfile )
+{
+        struct stat  st;
+        void       * map;
+
+        if( fstat( lozfile->fid, &st ) ) {
+                MYLOG_ERROR("fstat() failed: err=%d: %s", errno, strerror(errno) );
+                return LOZ_ERROR;
+        }
+        if( (st.st_size <= 0) || ((size_t)st.st_size != st.st_size) ) {
+                MYLOG_WARNING("file of size %lld could not be mapped", (long long int)st.st_size );
+                return LOZ_ERROR;
+        }
+        map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, lozfile->fid, 0 );
+        if(map == MAP_FAILED) {
+                MYLOG_WARNING("mmap() failed: err=%d: %s", errno, strerror(errno) );
+                return LOZ_ERROR;
+        }
+        lozfile->map        = map;
+        lozfile->mapsize    = st.st_size;
+        lozfile->map_random = 0;
+        loz_map_advise( lozfile, 0, lozfile->mapsize, MADV_SEQUENTIAL );
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Advise kernel on access to part of mapping of file (result is not checked)
+//inputs:  fpos   = begining of part in file
+//         size   = size of part
+//         advice = MADV_xxx
+void loz_map_advise( lozfile_t * lozfile, off_t fpos, off_t size, int advice )
+{
+        long int pagesize = sysconf( _SC_PAGESIZE );
+        off_t    start    = fpos & ~(pagesize - 1);
+
+        madvise( lozfile->map + start, fpos + size - start, advice );
+}
+
+//------------------------------------------------------------------------------
+//Grow buffer to need bytes at least (buffers of handle are allocated on first
+//use and grow to the largest section, see LOZ_BLOCKSIZE_MAX)
+//inputs:  buff = pointer to buffer (NULL=not allocated yet)
+//         size = pointer to allocated size of buffer
+//         need = required size of buffer
+//returns: LOZ_OK    = ok
+//         LOZ_ERROR = could not allocate memory (buffer is not changed)
+int loz_buff_reserve( uint8_t ** buff, int * size, int need )
+{
+        uint8_t * p;
+
+        if(*size >= need)
+                return LOZ_OK;
+        p = realloc( *buff, need );
+        if(p==NULL) {
+                MYLOG_ERROR("could not allocate %d bytes for buffer", need);
+                return LOZ_ERROR;
+        }
+        *buff = p;
+        *size = need;
+        return LOZ_OK;
+}
+
 //------------------------------------------------------------------------------
 //Copy section to another one
 void loz_section_copy( lozfile_section_t * dest, lozfile_section_t * src )
@@ -145,13 +657,17 @@ void loz_section_copy( lozfile_section_t * dest, lozfile_section_t * src )
 
 //------------------------------------------------------------------------------
 //Compress data with defined compression
+//inputs:  compsizemax = size of compdata[], at least LOZ_COMPBOUND(rawsize)
+//         work        = LOZ_LZWORK_SIZE(rawsize) bytes work area, used by LOZ_COMPRESSION_LZ only
 //returns: LOZ_OK
+//         LOZ_NOSPACE = compressed data is bigger than compsizemax (RLE2 only)
 //         LOZ_ERROR
 int loz_compress_data ( int compression, uint8_t * rawdata, int rawsize,
-                       uint8_t * compdata, int compsizemax, int * compsize )
+                       uint8_t * compdata, int compsizemax, int * compsize,
+                       uint32_t * work )
 {
-        MYLOG_TRACE("@(compression=%s,rawdata=%p,rawsize=%d,compdata=%p,compsizemax=%d,compsize=%p)",
-                    compression_to_str(compression), rawdata, rawsize, compdata, compsizemax, compsize);
+        MYLOG_TRACE("@(compression=%s,rawdata=%p,rawsize=%d,compdata=%p,compsizemax=%d,compsize=%p,work=%p)",
+                    compression_to_str(compression), rawdata, rawsize, compdata, compsizemax, compsize, work);
         
         //Check input arguments
         if(rawdata==NULL) {
@@ -174,8 +690,8 @@ int loz_compress_data ( int compression, uint8_t * rawdata, int rawsize,
                 MYLOG_ERROR("Invalid argument: compsize=NULL");
                 return LOZ_ERROR;
         }
-        if(compsizemax < 2 * rawsize) {
-                MYLOG_ERROR("compdata buffer is too small: compsizemax=%d < rawsize=%d", compsizemax, rawsize);
+        if(compsizemax < LOZ_COMPBOUND(rawsize)) {
+                MYLOG_ERROR("compdata buffer is too small: compsizemax=%d < %d", compsizemax, LOZ_COMPBOUND(rawsize));
                 return LOZ_ERROR;
         }
         
@@ -194,13 +710,17 @@ int loz_compress_data ( int compression, uint8_t * rawdata, int rawsize,
         case LOZ_COMPRESSION_RLE2:
                 *compsize = rle_compress( rawdata, rawsize, compdata, compsizemax );
                 if(*compsize < 0) {
-                        MYLOG_ERROR("rle_compress() failed");
-                        return LOZ_ERROR;
+                        MYLOG_DEBUG("rle_compress() failed: compressed data does not fit compdata[%d]", compsizemax);
+                        return LOZ_NOSPACE;
                 }
                 return LOZ_OK;
 
         case LOZ_COMPRESSION_LZ:
-                *compsize = LZ_Compress( rawdata, compdata, rawsize );
+                if(work==NULL) {
+                        MYLOG_ERROR("Invalid argument: work=NULL");
+                        return LOZ_ERROR;
+                }
+                *compsize = LZ_CompressFast( rawdata, compdata, rawsize, work );
                 return LOZ_OK;
 
         case LOZ_COMPRESSION_FASTLZ1:
@@ -217,6 +737,90 @@ int loz_compress_data ( int compression, uint8_t * rawdata, int rawsize,
         }
 }
 
+//------------------------------------------------------------------------------
+//Estimate order-0 entropy of data by byte histogram (Miller-Madow corrected,
+//so random data gives ~8.0 for small blocks too). It is cheap compared to any
+//compression: data with entropy close to 8 bits/byte could not be compressed
+//by our codecs, such blocks are stored without compression attempt.
+//returns: entropy in bits per byte (0..8)
+double loz_entropy( uint8_t * data, int size )
+{
+        uint32_t  hist[4][256];
+        int       i;
+        int       nonzero = 0;
+        double    c;
+        double    h = 0.0;
+
+        //four histograms: sequential increments of one counter do not stall
+        memset( hist, 0, sizeof(hist) );
+        for(i=0; i + 4 <= size; i += 4) {
+                hist[0][data[i  ]]++;
+                hist[1][data[i+1]]++;
+                hist[2][data[i+2]]++;
+                hist[3][data[i+3]]++;
+        }
+        for( ; i < size; i++)
+                hist[0][data[i]]++;
+
+        for(i=0; i<256; i++) {
+                c = hist[0][i] + hist[1][i] + hist[2][i] + hist[3][i];
+                if(c > 0) {
+                        h -= c * log2( c / size );
+                        nonzero++;
+                }
+        }
+        return h / size + (nonzero - 1) / (2.0 * size * M_LN2);
+}
+
+//------------------------------------------------------------------------------
+//Choose codec of block for LOZ_COMPRESSION_AUTO: codecs are tried on sample
+//from the middle of block, from the fastest one, until one of them achieves
+//lozfile->auto_ratio. job->lzbuff[] is used as scratch buffer.
+//inputs:  lozfile = pointer to opened lozfile
+//         job     = job->rawdata, job->section.rawsize, job->lzbuff, job->lzwork
+//returns: codec   = codec with the best result on sample (LOZ_COMPRESSION_NONE if
+//                   no one could compress sample)
+uint8_t loz_auto_codec( lozfile_t * lozfile, lozfile_job_t * job )
+{
+        static const uint8_t codecs[] = { LOZ_COMPRESSION_RLE2,     //from the fastest codec
+                                          LOZ_COMPRESSION_FASTLZ1,
+                                          LOZ_COMPRESSION_FASTLZ2,
+                                          LOZ_COMPRESSION_LZ };     //to the best ratio
+        uint8_t  * sample;
+        int        samplesize;
+        int        runs;
+        int        i;
+        int        err;
+        int        size;
+        uint8_t    best     = LOZ_COMPRESSION_NONE;
+        int        bestsize;
+
+        samplesize = job->section.rawsize;
+        if(samplesize > LOZ_AUTO_SAMPLE_SIZE)
+                samplesize = LOZ_AUTO_SAMPLE_SIZE;
+        sample   = job->rawdata + (job->section.rawsize - samplesize) / 2;
+        bestsize = samplesize;
+
+        //RLE2 is tried if 1/8 of bytes at least repeat previous byte
+        runs = 0;
+        for(i=1; i<samplesize; i++)
+                runs += (sample[i] == sample[i-1]);
+
+        for(i=0; i<sizeof(codecs); i++) {
+                if( (codecs[i] == LOZ_COMPRESSION_RLE2) && (runs < samplesize / 8) )
+                        continue;
+                err = loz_compress_data( codecs[i], sample, samplesize,
+                                         job->lzbuff, LOZ_LZBUFF_SIZE( lozfile, lozfile->buffsize ), &size, job->lzwork );
+                if( (err == LOZ_OK) && (size < bestsize) ) {
+                        best     = codecs[i];
+                        bestsize = size;
+                }
+                if( (int64_t)bestsize * 100 <= (int64_t)samplesize * lozfile->auto_ratio )
+                        break;
+        }
+        return best;
+}
+
 //------------------------------------------------------------------------------
 //Uncompress data with defined compression
 //returns: LOZ_OK
@@ -253,12 +857,20 @@ int loz_uncompress_data ( int compression, uint8_t * compdata, int compsize,
         switch(compression)
         {
         case LOZ_COMPRESSION_NONE:
+                if(compsize > rawsizemax) {
+                        MYLOG_ERROR("stored data does not fit rawdata[]: compsize=%d > rawsizemax=%d", compsize, rawsizemax);
+                        return LOZ_ERROR;
+                }
                 memcpy(rawdata, compdata, compsize);
                 *rawsize = compsize;
                 return LOZ_OK;
                 
         case LOZ_COMPRESSION_RLE:
                 *rawsize = RLE_Uncompress( compdata, rawdata, compsize, rawsizemax );
+                if(*rawsize < 0) {
+                        MYLOG_ERROR("RLE_Uncompress() failed");
+                        return LOZ_ERROR;
+                }
                 return LOZ_OK;
 
         case LOZ_COMPRESSION_RLE2:
@@ -271,11 +883,20 @@ int loz_uncompress_data ( int compression, uint8_t * compdata, int compsize,
                 
         case LOZ_COMPRESSION_LZ:     
                 *rawsize = LZ_Uncompress( compdata, rawdata, compsize, rawsizemax );
+                if(*rawsize < 0) {
+                        MYLOG_ERROR("LZ_Uncompress() failed");
+                        return LOZ_ERROR;
+                }
                 return LOZ_OK;
                 
         case LOZ_COMPRESSION_FASTLZ1:
         case LOZ_COMPRESSION_FASTLZ2:
+                //fastlz_decompress() returns 0 on error (compsize > 0 never decodes to nothing)
                 *rawsize = fastlz_decompress( compdata, compsize, rawdata, rawsizemax );
+                if(*rawsize <= 0) {
+                        MYLOG_ERROR("fastlz_decompress() failed");
+                        return LOZ_ERROR;
+                }
                 return LOZ_OK;
         
         default:
@@ -285,18 +906,72 @@ int loz_uncompress_data ( int compression, uint8_t * compdata, int compsize,
 }
 
 //------------------------------------------------------------------------------
-//Find sequence of two bytes in file from startpos
-//returns:  fpos     = in-file position of seq2 (if found)
+//Find sequence of two bytes in memory (vectorized if SSE2/AVX2 is available)
+//returns:  pos = position of seq2 in buf[] (seq2 is fully inside buf[0..size-1])
+//          -1  = seq2 not found
+int loz_memfind2 ( uint8_t * buf, int size, uint8_t * seq2 )
+{
+        int       i = 0;
+        uint8_t * p;
+#if defined(__AVX2__)
+        __m256i   v0 = _mm256_set1_epi8( (char)seq2[0] );
+        __m256i   v1 = _mm256_set1_epi8( (char)seq2[1] );
+        uint32_t  mask;
+
+        //compare 32 pairs buf[i+k],buf[i+k+1] at once
+        for( ; i + 32 < size; i += 32) {
+                mask = _mm256_movemask_epi8( _mm256_and_si256(
+                        _mm256_cmpeq_epi8( _mm256_loadu_si256((__m256i*)(buf + i    )), v0 ),
+                        _mm256_cmpeq_epi8( _mm256_loadu_si256((__m256i*)(buf + i + 1)), v1 ) ) );
+                if(mask)
+                        return i + __builtin_ctz(mask);
+        }
+#elif defined(__SSE2__)
+        __m128i   v0 = _mm_set1_epi8( (char)seq2[0] );
+        __m128i   v1 = _mm_set1_epi8( (char)seq2[1] );
+        uint32_t  mask;
+
+        //compare 16 pairs buf[i+k],buf[i+k+1] at once
+        for( ; i + 16 < size; i += 16) {
+                mask = _mm_movemask_epi8( _mm_and_si128(
+                        _mm_cmpeq_epi8( _mm_loadu_si128((__m128i*)(buf + i    )), v0 ),
+                        _mm_cmpeq_epi8( _mm_loadu_si128((__m128i*)(buf + i + 1)), v1 ) ) );
+                if(mask)
+                        return i + __builtin_ctz(mask);
+        }
+#endif
+        //scalar search (tail of buffer / no SIMD)
+        while(i + 1 < size) {
+                p = memchr( buf + i, seq2[0], size - 1 - i );
+                if(p==NULL)
+                        return -1;
+                i = p - buf;
+                if(buf[i+1]==seq2[1])
+                        return i;
+                i++;
+        }
+        return -1;
+}
+
+//------------------------------------------------------------------------------
+//Find next valid section in file from startpos.
+//File is readed by LOZ_SCANBUFF_SIZE blocks, every block is searched for
+//section-begin-marker in memory, candidate headers are checked in place.
+//inputs:   lozfile  = pointer to opened lozfile
+//          header   = pointer to section-header structure (will be filled)
+//          startpos = in-file position to start search from
+//returns:  LOZ_OK    = valid section has been found
 //          LOZ_ERROR = error
-//          LOZ_EOF   = seq2 not found, End Of File achieved
-long int loz_find_seq2 ( lozfile_t * lozfile, uint8_t * seq2, long int startpos )
+//          LOZ_EOF   = no valid section found, End Of File achieved
+int loz_find_section ( lozfile_t * lozfile, lozfile_section_t * header, off_t startpos )
 {
         int       err;
-        long int  fpos;
-        int       readed;
-        uint8_t   buf[LOZ_BEGINMARKER_SIZE];
+        off_t     blk_start;
+        int       n;
+        int       i;
+        int       pos;
 
-        MYLOG_TRACE("@(lozfile=%p,seq2=%p,startpos=%ld)", lozfile, seq2, startpos);
+        MYLOG_TRACE("@(lozfile=%p,header=%p,startpos=%lld)", lozfile, header, (long long)startpos);
 
         //Check input arguments
         if(lozfile==NULL) {
@@ -307,73 +982,75 @@ long int loz_find_seq2 ( lozfile_t * lozfile, uint8_t * seq2, long int startpos
                 MYLOG_ERROR("lozfile is not opened yet");
                 return LOZ_ERROR;
         }
-        if(seq2==NULL) {
-                MYLOG_ERROR("Invalid argument seq2=NULL");
+        if(header==NULL) {
+                MYLOG_ERROR("Invalid argument header=NULL");
                 return LOZ_ERROR;
         }
         if(startpos < 0) {
-                MYLOG_ERROR("startpos=%ld", startpos);
+                MYLOG_ERROR("startpos=%lld", (long long)startpos);
                 return LOZ_ERROR;
         }
-
-        //Set startpos
-        fpos = startpos;
-        err = fseek( lozfile->fd, fpos, SEEK_SET );
-        if(err) {
-                MYLOG_ERROR("fseek(%ld) failed: err=%d: %s", startpos, errno, strerror(errno) );
-                return LOZ_ERROR;
+        if(lozfile->scanbuff==NULL) {
+                lozfile->scanbuff = malloc( LOZ_SCANBUFF_SIZE );
+                if(lozfile->scanbuff==NULL) {
+                        MYLOG_ERROR("could not allocate memory for scan buffer");
+                        return LOZ_ERROR;
+                }
         }
-        
-        readed = 0;
+
+        blk_start = startpos;
         while(1) {
-                //shift buffer
-                buf[0] = buf[1];
-                
-                //read byte
-                err = fread( &buf[1], sizeof(buf[1]), 1, lozfile->fd );
-                if(err != 1) {
-                        if( feof(lozfile->fd) ) {
-                                MYLOG_DEBUG("EOF of lozfile achieved");
-                                return LOZ_EOF;
-                        }
-                        else if( ferror(lozfile->fd) ) {
-                                MYLOG_ERROR("Could not read from file: err: %d: %s", errno, strerror(errno));
-                                return LOZ_ERROR;
-                        }
-                        else {
-                                MYLOG_ERROR("Could not read %d bytes from file", sizeof(buf[1]));
-                                return LOZ_ERROR;
+                //read block
+                n = loz_file_read( lozfile, blk_start, lozfile->scanbuff, LOZ_SCANBUFF_SIZE );
+                if(n < 0) {
+                        MYLOG_ERROR("Could not read from file at fpos=%lld", (long long)blk_start);
+                        return LOZ_ERROR;
+                }
+                if(n < LOZ_SECTIONHEADER_SIZE(lozfile)) {
+                        MYLOG_DEBUG("EOF of lozfile achieved");
+                        return LOZ_EOF;
+                }
+
+                //check candidates which have full header in block
+                i = 0;
+                while(1) {
+                        pos = loz_memfind2( lozfile->scanbuff + i, n - i, LOZ_BEGINMARKER );
+                        if( (pos < 0) || (i + pos > n - LOZ_SECTIONHEADER_SIZE(lozfile)) )
+                                break;
+                        i += pos;
+                        err = loz_parse_section_header( lozfile, header, lozfile->scanbuff + i, blk_start + i );
+                        if(err == LOZ_OK) {
+                                MYLOG_DEBUG("section has been found at fpos=%lld", (long long)header->fpos);
+                                return LOZ_OK;
                         }
+                        //this is not section begin or corrupted section: search again
+                        i++;
                 }
-                readed++;
-                
-                //compare bytes stream with seq2
-                if( (readed >= LOZ_BEGINMARKER_SIZE) &&
-                    (buf[0]==seq2[0]) &&
-                    (buf[1]==seq2[1]) )
-                {
-                        fpos = startpos + readed - LOZ_BEGINMARKER_SIZE;
-                        MYLOG_DEBUG("seq2 has been found at fpos=%ld", fpos);
-                        return fpos;
+
+                if(n < LOZ_SCANBUFF_SIZE) {
+                        MYLOG_DEBUG("EOF of lozfile achieved");
+                        return LOZ_EOF;
                 }
+                //next block overlaps this one, so headers on the border are checked too
+                blk_start += n - LOZ_SECTIONHEADER_SIZE(lozfile) + 1;
         }
 }
 
 //------------------------------------------------------------------------------
-//Find sequence of two bytes in file from startpos (reverse direction)
-//returns:  fpos     = in-file position of seq2 (if found)
+//Find sequence of two bytes in file from startpos (reverse direction).
+//File is readed backward by LOZ_SCANBUFF_SIZE blocks, every block is searched in memory.
+//returns:  fpos     = in-file position of seq2 (if found), seq2 ends at startpos or before
 //          LOZ_ERROR = error
 //          LOZ_EOF   = seq2 not found / End Of File achieved
-long int loz_find_seq2_reverse ( lozfile_t * lozfile, uint8_t * seq2, long int startpos )
+off_t loz_find_seq2_reverse ( lozfile_t * lozfile, uint8_t * seq2, off_t startpos )
 {
-        int      err;
-        long int fpos;
-        uint8_t  buf[LOZ_BEGINMARKER_SIZE] = {0,0};
-        char     b;
+        off_t blk_start;
+        off_t blk_end;
         int      n;
+        uint8_t *p;
         
-        MYLOG_TRACE("@(lozfile=%p,seq2[]=%02X %02X,startpos=%ld)",
-                    lozfile, seq2[0]&0xFF, seq2[1]&0xFF, startpos);
+        MYLOG_TRACE("@(lozfile=%p,seq2[]=%02X %02X,startpos=%lld)",
+                    lozfile, seq2[0]&0xFF, seq2[1]&0xFF, (long long)startpos);
         
         //Check input arguments
         if(lozfile==NULL) {
@@ -389,48 +1066,46 @@ long int loz_find_seq2_reverse ( lozfile_t * lozfile, uint8_t * seq2, long int s
                 return LOZ_ERROR;
         }
         if(startpos < 0) {
-                MYLOG_ERROR("startpos=%ld", startpos);
+                MYLOG_ERROR("startpos=%lld", (long long)startpos);
                 return LOZ_ERROR;
         }
+        if(lozfile->scanbuff==NULL) {
+                lozfile->scanbuff = malloc( LOZ_SCANBUFF_SIZE );
+                if(lozfile->scanbuff==NULL) {
+                        MYLOG_ERROR("could not allocate memory for scan buffer");
+                        return LOZ_ERROR;
+                }
+        }
 
-        //Scan file
-        n = 0;
-        for(fpos=startpos; fpos>=0; fpos--)
-        {
-                //read byte
-                err = fseek( lozfile->fd, fpos, SEEK_SET );
-                if(err) {
-                        MYLOG_ERROR("fseek(%ld) failed: err=%d: %s", fpos, errno, strerror(errno) );
+        //Scan file: blocks overlap by one byte, so seq2 on the border is found too
+        blk_end = startpos + 1;
+        do {
+                blk_start = blk_end - LOZ_SCANBUFF_SIZE;
+                if(blk_start < 0)
+                        blk_start = 0;
+
+                //read block
+                n = loz_file_read( lozfile, blk_start, lozfile->scanbuff, blk_end - blk_start );
+                if(n < 0) {
+                        MYLOG_ERROR("Could not read from file at fpos=%lld", (long long)blk_start);
                         return LOZ_ERROR;
                 }
-                err = fread( &b, sizeof(b), 1, lozfile->fd );
-                if(err != 1) {
-                        if( feof(lozfile->fd) ) {
-                                MYLOG_DEBUG("EOF of lozfile achieved");
-                                return LOZ_EOF;
-                        }
-                        else if( ferror(lozfile->fd) ) {
-                                MYLOG_ERROR("fread() failed: err: %d: %s", errno, strerror(errno));
-                                return LOZ_ERROR;
-                        }
-                        else {
-                                MYLOG_ERROR("could not read byte from file");
-                                return LOZ_ERROR;
+
+                //search block from its end: seq2[0] must have one more byte after it
+                n--;
+                while(n > 0) {
+                        p = memrchr( lozfile->scanbuff, seq2[0], n );
+                        if(p==NULL)
+                                break;
+                        if(p[1]==seq2[1]) {
+                                MYLOG_DEBUG("seq2 has been found at fpos=%lld", (long long)(blk_start + (p - lozfile->scanbuff)));
+                                return blk_start + (p - lozfile->scanbuff);
                         }
+                        n = p - lozfile->scanbuff;
                 }
-                n++;
-                //put byte into shift-buffer
-                buf[1] = buf[0];
-                buf[0] = b;
-                //compare buffer with seq2
-                if( (buf[0]==seq2[0]) &&
-                    (buf[1]==seq2[1]) &&
-                    (n >= LOZ_BEGINMARKER_SIZE) )
-                {
-                        MYLOG_DEBUG("seq2 has been found at fpos=%ld",fpos);
-                        return fpos;
-                }
-        }
+
+                blk_end = blk_start + 1;
+        } while(blk_start > 0);
 
         MYLOG_ERROR("seq2 has not been found in file");
         return LOZ_EOF; 
@@ -446,8 +1121,9 @@ long int loz_find_seq2_reverse ( lozfile_t * lozfile, uint8_t * seq2, long int s
 int loz_read_fileheader( lozfile_t * lozfile )
 {
         int     err;
-        uint8_t buf[LOZ_FILEHEADER_SIZE];
+        uint8_t buf[LOZ_FILEHEADER_SIZE_MAX];
         uint8_t crc_cc;
+        int     size;
 
         MYLOG_TRACE("@(lozfile=%p)", lozfile);
 
@@ -461,28 +1137,15 @@ int loz_read_fileheader( lozfile_t * lozfile )
                 return LOZ_ERROR;
         }
 
-        //set fpos to the begining of file
-        err = fseek( lozfile->fd, 0L, SEEK_SET );
-        if(err) {
-                MYLOG_ERROR("could not read file-header: fseek(0L) failed");
+        //read file-header from the begining of file (size depends on version)
+        err = loz_file_read( lozfile, 0L, buf, sizeof(buf) );
+        if(err < 0) {
+                MYLOG_ERROR("could not read file-header");
                 return LOZ_ERROR;
         }
-
-        //read file-header
-        err = fread( &buf, sizeof(buf), 1, lozfile->fd );
-        if(err != 1) {
-                if( feof(lozfile->fd) ) {
-                        MYLOG_DEBUG("EOF of lozfile achieved");
-                        return LOZ_EOF;
-                }
-                else if( ferror(lozfile->fd) ) {
-                        MYLOG_ERROR("fread() failed: err: %d: %s", errno, strerror(errno));
-                        return LOZ_ERROR;
-                }
-                else {
-                        MYLOG_ERROR("could not read %d bytes from file", 11);
-                        return LOZ_ERROR;
-                }
+        if(err < LOZ_FILEHEADER_SIZE_V0) {
+                MYLOG_DEBUG("EOF of lozfile achieved");
+                return LOZ_EOF;
         }
         
         if( buf[0] != LOZ_FMT[0] ||
@@ -492,17 +1155,28 @@ int loz_read_fileheader( lozfile_t * lozfile )
                 MYLOG_ERROR("file format is not LZF");
                 return LOZ_ERROR;
         }
-        lozfile->version        = buf[3];
-        lozfile->compression    = buf[4];
-        lozfile->fileheader_crc = buf[5];
+        lozfile->version = buf[3];
         
-        if( lozfile->version != LOZ_VERSION_0 ) {
+        if( lozfile->version > LOZ_VERSION_MAX ) {
                 MYLOG_ERROR("LZF version (%d) is not supported", lozfile->version );
                 return LOZ_UNSUPPORTED;
         }
+
+        size = LOZ_FILEHEADER_SIZE(lozfile);
+        if(err < size) {
+                MYLOG_DEBUG("EOF of lozfile achieved");
+                return LOZ_EOF;
+        }
+        lozfile->fileheader_crc = buf[size - LOZ_CRC_SIZE];
+        if(lozfile->version < LOZ_VERSION_2)
+                lozfile->compression = buf[4]; //all sections of file have the same codec
+        if(lozfile->version >= LOZ_VERSION_3)
+                lozfile->checksum = buf[5];
+        else
+                lozfile->checksum = LOZ_CHECKSUM_CRC8;
         
         crc_cc = crc8_array( buf + LOZ_FMT_SIZE,
-                             LOZ_FILEHEADER_SIZE - LOZ_FMT_SIZE - LOZ_CRC_SIZE,
+                             size - LOZ_FMT_SIZE - LOZ_CRC_SIZE,
                              CRC8_INIT );
         if(crc_cc==0x00)
                 crc_cc = 0x01; //CRC could not be 0x00, replace this with 0x01
@@ -512,9 +1186,14 @@ int loz_read_fileheader( lozfile_t * lozfile )
                             crc_cc&0xFF, lozfile->fileheader_crc&0xFF);
                 return LOZ_BAD_CRC;
         }
+        if( (lozfile->checksum != LOZ_CHECKSUM_CRC8) &&
+            (lozfile->checksum != LOZ_CHECKSUM_CRC32C) ) {
+                MYLOG_ERROR("LZF checksum (%d) is not supported", lozfile->checksum );
+                return LOZ_UNSUPPORTED;
+        }
         
-        MYLOG_DEBUG("LZF fileheader is valid: version=%d,compression=%s",
-                    lozfile->version, compression_to_str(lozfile->compression) );
+        MYLOG_DEBUG("LZF fileheader is valid: version=%d,compression=%s,checksum=%s",
+                    lozfile->version, compression_to_str(buf[4]), checksum_to_str(lozfile->checksum) );
         return LOZ_OK;
 }
 
@@ -525,7 +1204,8 @@ int loz_read_fileheader( lozfile_t * lozfile )
 int loz_write_fileheader( lozfile_t * lozfile )
 {
         int  err;
-        uint8_t buf[LOZ_FILEHEADER_SIZE];
+        uint8_t buf[LOZ_FILEHEADER_SIZE_MAX];
+        int  size;
 
         MYLOG_TRACE("@(lozfile=%p)", lozfile);
 
@@ -539,95 +1219,50 @@ int loz_write_fileheader( lozfile_t * lozfile )
                 return LOZ_ERROR;
         }
 
+        size = LOZ_FILEHEADER_SIZE(lozfile);
+
         buf[0] = LOZ_FMT[0];
         buf[1] = LOZ_FMT[1];
         buf[2] = LOZ_FMT[2];
         buf[3] = lozfile->version;
         buf[4] = lozfile->compression;
+        if(lozfile->version >= LOZ_VERSION_3)
+                buf[5] = lozfile->checksum;
         
         lozfile->fileheader_crc = crc8_array( buf + LOZ_FMT_SIZE,
-                                             LOZ_FILEHEADER_SIZE - LOZ_FMT_SIZE - LOZ_CRC_SIZE,
+                                             size - LOZ_FMT_SIZE - LOZ_CRC_SIZE,
                                              CRC8_INIT );
         if(lozfile->fileheader_crc==0x00)
                 lozfile->fileheader_crc = 0x01; //CRC could not be 0x00, replace this with 0x01
         
-        buf[5] = lozfile->fileheader_crc;
+        buf[size - LOZ_CRC_SIZE] = lozfile->fileheader_crc;
 
-        //set fpos to the begining of file
-        err = fseek( lozfile->fd, 0L, SEEK_SET );
+        //write file-header to the begining of file
+        err = loz_file_write( lozfile, 0L, buf, size );
         if(err) {
-                MYLOG_ERROR("could not write file-header: fseek(0L) failed");
-                return LOZ_ERROR;
-        }
-
-        //write file-header
-        err = fwrite( &buf, sizeof(buf), 1, lozfile->fd );
-        if(err != 1) {
                 MYLOG_ERROR("could not write file-header");
                 return LOZ_ERROR;
         }
 
-        MYLOG_DEBUG("LZF fileheader has been written: version=%d, compression=%s",
-                    lozfile->version, compression_to_str(lozfile->compression));
+        MYLOG_DEBUG("LZF fileheader has been written: version=%d, compression=%s, checksum=%s",
+                    lozfile->version, compression_to_str(lozfile->compression), checksum_to_str(lozfile->checksum));
         return LOZ_OK;
 }
 
 //------------------------------------------------------------------------------
-//Read Section-header from defined fpos
+//Parse Section-header from memory buffer
+//inputs:  lozfile = pointer to opened lozfile
+//         header  = pointer to section-header structure (will be filled)
+//         buf     = LOZ_SECTIONHEADER_SIZE(lozfile) bytes of section-header
+//         fpos    = in-file position of section-header
 //returns: LOZ_OK      = ok, section-header is valid
 //         LOZ_ERROR   = error
-//         LOZ_EOF     = End Of File achieved
+//         LOZ_EOF     = End Of File achieved (index-block found)
 //         LOZ_BAD_CRC = section is corrupted (or has invalid format)
-int loz_read_section_header( lozfile_t * lozfile, lozfile_section_t * header, long int fpos )
+int loz_parse_section_header( lozfile_t * lozfile, lozfile_section_t * header, uint8_t * buf, off_t fpos )
 {
-        int      err;
-        uint8_t  buf[LOZ_SECTIONHEADER_SIZE]; //size of section-header
         uint8_t  crc;
-        
-        MYLOG_TRACE("@(lozfile=%p,header=%p,fpos=%ld)", lozfile, header, fpos);
-        
-        //Check input arguments
-        if(lozfile==NULL) {
-                MYLOG_ERROR("invalid argument lozfile=NULL");
-                return LOZ_ERROR;
-        }
-        if(lozfile->fd==NULL) {
-                MYLOG_ERROR("lozfile is not opened yet");
-                return LOZ_ERROR;
-        }
-        if(header==NULL) {
-                MYLOG_ERROR("invalid argument header=NULL");
-                return LOZ_ERROR;
-        }
-        if(fpos < 0) {
-                MYLOG_ERROR("invalid argument fpos=%ld", fpos);
-                return LOZ_ERROR;
-        }
 
-        //set fpos to the defined value
-        err = fseek( lozfile->fd, fpos, SEEK_SET );
-        if(err) {
-                MYLOG_ERROR("could not write file-header: fseek(%ld) failed",fpos);
-                return LOZ_ERROR;
-        }
-        
-        //Read data from file to buf
-        err = fread( buf, LOZ_SECTIONHEADER_SIZE, 1, lozfile->fd );
-        if(err != 1) {
-                if( feof(lozfile->fd) ) {
-                        MYLOG_DEBUG("EOF of lozfile achieved");
-                        return LOZ_EOF;
-                }
-                else if( ferror(lozfile->fd) ) {
-                        MYLOG_ERROR("fread() failed: err: %d: %s", errno, strerror(errno));
-                        return LOZ_ERROR;
-                }
-                else {
-                        MYLOG_ERROR("could not read %d bytes from file", 11);
-                        return LOZ_ERROR;
-                }
-        }
-        
         //Fill section header structure
         header->header_is_valid = 0;
 
@@ -636,34 +1271,48 @@ int loz_read_section_header( lozfile_t * lozfile, lozfile_section_t * header, lo
         header->beginmarker[0] = buf[0];
         header->beginmarker[1] = buf[1];
         
-        header->rawpos   = ((uint32_t)buf[ 2]<< 0) +
-                           ((uint32_t)buf[ 3]<< 8) +
-                           ((uint32_t)buf[ 4]<<16) +
-                           ((uint32_t)buf[ 5]<<24) ;
-        header->rawsize  = ((uint32_t)buf[ 6]<< 0) +
-                           ((uint32_t)buf[ 7]<< 8) +
-                           ((uint32_t)buf[ 8]<<16) +
-                           ((uint32_t)buf[ 9]<<24) ;
-        header->compsize = ((uint32_t)buf[10]<< 0) +
-                           ((uint32_t)buf[11]<< 8) +
-                           ((uint32_t)buf[12]<<16) +
-                           ((uint32_t)buf[13]<<24) ;
-        header->crc = buf[14];
+        if(lozfile->version >= LOZ_VERSION_4) {
+                header->rawpos   = get_uint64( buf +  2 );
+                header->rawsize  = get_uint32( buf + 10 );
+                header->compsize = get_uint32( buf + 14 );
+                header->codec    = buf[18];
+                header->crc      = buf[19];
+        }
+        else {
+                header->rawpos   = get_uint32( buf +  2 );
+                header->rawsize  = get_uint32( buf +  6 );
+                header->compsize = get_uint32( buf + 10 );
+                if(lozfile->version >= LOZ_VERSION_2) {
+                        header->codec = buf[14];
+                        header->crc   = buf[15];
+                }
+                else {
+                        header->codec = lozfile->compression; //the same codec for all sections of file
+                        header->crc   = buf[14];
+                }
+        }
 
         //Calculate rawpos_end
         header->rawpos_end = header->rawpos + header->rawsize - 1;
 
         //Check header validity
+        if( (header->beginmarker[0] == LOZ_INDEXMARKER[0]) &&
+            (header->beginmarker[1] == LOZ_INDEXMARKER[1]) &&
+            (lozfile->version >= LOZ_VERSION_1) )
+        {
+                MYLOG_DEBUG("index-block achieved: there are no more sections");
+                return LOZ_EOF;
+        }
         if( (header->beginmarker[0] != LOZ_BEGINMARKER[0]) ||
             (header->beginmarker[1] != LOZ_BEGINMARKER[1])  )
         {
                 MYLOG_ERROR("invalid section begin marker: %02X,%02X", header->beginmarker[0], header->beginmarker[1]);
-                return LOZ_ERROR;
+                return LOZ_BAD_CRC; //corrupted section: it could be repaired by loz_section_next()
         }
 
         //Calculate CRC
         crc = crc8_array( buf + LOZ_BEGINMARKER_SIZE,
-                          LOZ_SECTIONHEADER_SIZE - LOZ_BEGINMARKER_SIZE - LOZ_CRC_SIZE,
+                          LOZ_SECTIONHEADER_SIZE(lozfile) - LOZ_BEGINMARKER_SIZE - LOZ_CRC_SIZE,
                           CRC8_INIT );
         if(crc==0x00)
                 crc = 0x01; //CRC could not be 0x00, replace this with 0x01
@@ -672,22 +1321,28 @@ int loz_read_section_header( lozfile_t * lozfile, lozfile_section_t * header, lo
                 MYLOG_ERROR("invalid section crc: %02X(readed), %02X(calculated)", header->crc, crc);
                 return LOZ_BAD_CRC;
         }
+        if(header->codec > LOZ_COMPRESSION_MAX) {
+                MYLOG_ERROR("unsupported section codec=%d", header->codec);
+                return LOZ_BAD_CRC;
+        }
         
         header->header_is_valid = 1;
         return LOZ_OK;
 }
 
 //------------------------------------------------------------------------------
-//Write Section-header from header->fpos
+//Read Section-header from defined fpos
 //returns: LOZ_OK      = ok, section-header is valid
 //         LOZ_ERROR   = error
-int loz_write_section_header( lozfile_t * lozfile, lozfile_section_t * header )
+//         LOZ_EOF     = End Of File achieved
+//         LOZ_BAD_CRC = section is corrupted (or has invalid format)
+int loz_read_section_header( lozfile_t * lozfile, lozfile_section_t * header, off_t fpos )
 {
-        int     err;
-        uint8_t crc;
-
-        MYLOG_TRACE("@(lozfile=%p,header=%p)", lozfile, header);
-
+        int      err;
+        uint8_t  buf[LOZ_SECTIONHEADER_SIZE_MAX]; //size of section-header
+        
+        MYLOG_TRACE("@(lozfile=%p,header=%p,fpos=%lld)", lozfile, header, (long long)fpos);
+        
         //Check input arguments
         if(lozfile==NULL) {
                 MYLOG_ERROR("invalid argument lozfile=NULL");
@@ -701,117 +1356,148 @@ int loz_write_section_header( lozfile_t * lozfile, lozfile_section_t * header )
                 MYLOG_ERROR("invalid argument header=NULL");
                 return LOZ_ERROR;
         }
-        if(header->fpos < LOZ_FILEHEADER_SIZE) {
-                MYLOG_ERROR("invalid argument header->fpos=%ld", header->fpos);
-                return LOZ_ERROR;
-        }
-
-        //set fpos to the defined value
-        err = fseek( lozfile->fd, header->fpos, SEEK_SET );
-        if(err) {
-                MYLOG_ERROR("could not write section-header: fseek(%ld) failed",header->fpos);
+        if(fpos < 0) {
+                MYLOG_ERROR("invalid argument fpos=%lld", (long long)fpos);
                 return LOZ_ERROR;
         }
 
-        //Write section header into file
-        //beginmarker
-        err = fwrite( header->beginmarker, sizeof(header->beginmarker), 1, lozfile->fd );
-        if(err != 1) {
-                MYLOG_ERROR("could not write section beginmarker: err=%d: %s", errno, strerror(errno) );
-                return LOZ_ERROR;
-        }
-        //rawpos
-        err = fwrite( &header->rawpos, sizeof(header->rawpos), 1, lozfile->fd );
-        if(err != 1) {
-                MYLOG_ERROR("could not write section rawpos: err=%d: %s", errno, strerror(errno) );
+        //Read data from file to buf
+        err = loz_file_read( lozfile, fpos, buf, LOZ_SECTIONHEADER_SIZE(lozfile) );
+        if(err < 0) {
+                MYLOG_ERROR("could not read section-header at fpos=%lld", (long long)fpos);
                 return LOZ_ERROR;
         }
-        //rawsize
-        err = fwrite( &header->rawsize, sizeof(header->rawsize), 1, lozfile->fd );
-        if(err != 1) {
-                MYLOG_ERROR("could not write section rawsize: err=%d: %s", errno, strerror(errno) );
-                return LOZ_ERROR;
+        if(err < LOZ_SECTIONHEADER_SIZE(lozfile)) {
+                MYLOG_DEBUG("EOF of lozfile achieved");
+                return LOZ_EOF;
         }
-        //compsize
-        err = fwrite( &header->compsize, sizeof(header->compsize), 1, lozfile->fd );
-        if(err != 1) {
-                MYLOG_ERROR("could not write section compsize: err=%d: %s", errno, strerror(errno) );
-                return LOZ_ERROR;
+        
+        return loz_parse_section_header( lozfile, header, buf, fpos );
+}
+
+
+//------------------------------------------------------------------------------
+//Put Section-header to buf[LOZ_SECTIONHEADER_SIZE(lozfile)] and calculate header->crc
+//inputs:  lozfile = pointer to opened lozfile (version defines format of header)
+//         header  = section-header (rawpos, rawsize, compsize, codec)
+//         buf     = destination buffer
+void loz_put_section_header( lozfile_t * lozfile, lozfile_section_t * header, uint8_t * buf )
+{
+        int  size = LOZ_SECTIONHEADER_SIZE(lozfile);
+
+        buf[0] = LOZ_BEGINMARKER[0];
+        buf[1] = LOZ_BEGINMARKER[1];
+        if(lozfile->version >= LOZ_VERSION_4) {
+                put_uint64( buf +  2, header->rawpos   );
+                put_uint32( buf + 10, header->rawsize  );
+                put_uint32( buf + 14, header->compsize );
+                buf[18] = header->codec;
         }
-        //crc = 0  - mark section as invalid - use loz_write_section_header_crc() to write actual CRC
-        crc = 0;
-        err = fwrite( &crc, sizeof(crc), 1, lozfile->fd );
-        if(err != 1) {
-                MYLOG_ERROR("could not write section crc=0: err=%d: %s", errno, strerror(errno) );
-                return LOZ_ERROR;
+        else {
+                put_uint32( buf +  2, (uint32_t)header->rawpos );
+                put_uint32( buf +  6, header->rawsize  );
+                put_uint32( buf + 10, header->compsize );
+                if(lozfile->version >= LOZ_VERSION_2)
+                        buf[14] = header->codec;
         }
 
-        //calculate true crc
-        header->crc = crc8_array( (uint8_t*)&header->rawpos,   sizeof(header->rawpos),   CRC8_INIT );
-        header->crc = crc8_array( (uint8_t*)&header->rawsize,  sizeof(header->rawsize),  header->crc );
-        header->crc = crc8_array( (uint8_t*)&header->compsize, sizeof(header->compsize), header->crc );
+        header->crc = crc8_array( buf + LOZ_BEGINMARKER_SIZE,
+                                  size - LOZ_BEGINMARKER_SIZE - LOZ_CRC_SIZE,
+                                  CRC8_INIT );
         if(header->crc==0x00)
-                header->crc = 0x01;
-        return LOZ_OK;
+                header->crc = 0x01; //CRC could not be 0x00, replace this with 0x01
+        buf[size - LOZ_CRC_SIZE] = header->crc;
 }
 
 //------------------------------------------------------------------------------
-//Write Section-header CRC of header
-//returns: LOZ_OK    = ok, section-header is valid
+//Compress job->rawdata[] into job->lzbuff[] and build on-disk image of section:
+//section-header and compressed data CRC. Position of section in file is not used,
+//so sections could be encoded in parallel (lozfile is not modified).
+//inputs:  lozfile = pointer to opened lozfile
+//         job     = job->rawdata, job->lzbuff, job->lzwork, job->section.rawpos, job->section.rawsize
+//returns: LOZ_OK    = ok
 //         LOZ_ERROR = error
-int loz_write_section_header_crc( lozfile_t * lozfile, lozfile_section_t * header )
+int loz_encode_section( lozfile_t * lozfile, lozfile_job_t * job )
 {
-        int     err;
+        int          err;
+        int          compsize;
+        uint8_t      codec;
+        int          stored;
 
-        MYLOG_TRACE("@(lozfile=%p,header=%p)", lozfile, header);
+        MYLOG_TRACE("@(lozfile=%p,job=%p)", lozfile, job);
 
-        //Check input arguments
-        if(lozfile==NULL) {
-                MYLOG_ERROR("invalid argument lozfile=NULL");
-                return LOZ_ERROR;
+        //section could be stored without compression if file has codec per section
+        codec  = lozfile->compression;
+        stored = (lozfile->version >= LOZ_VERSION_2) && (codec != LOZ_COMPRESSION_NONE);
+
+        //skip compression of data which looks random (already compressed)
+        if( stored &&
+            (job->section.rawsize >= LOZ_ENTROPY_MIN_SIZE) &&
+            (loz_entropy( job->rawdata, job->section.rawsize ) >= LOZ_ENTROPY_STORED) )
+        {
+                codec = LOZ_COMPRESSION_NONE;
         }
-        if(lozfile->fd==NULL) {
-                MYLOG_ERROR("lozfile is not opened yet");
-                return LOZ_ERROR;
+        else if(codec == LOZ_COMPRESSION_AUTO) {
+                codec = loz_auto_codec( lozfile, job );
         }
-        if(header==NULL) {
-                MYLOG_ERROR("invalid argument header=NULL");
+
+        //compress rawdata[] into lzbuff[]
+        err = loz_compress_data ( codec,
+                                 job->rawdata,
+                                 job->section.rawsize,
+                                 job->lzbuff,
+                                 LOZ_LZBUFF_SIZE( lozfile, lozfile->buffsize ),
+                                 &compsize,
+                                 job->lzwork );
+        if( (err == LOZ_NOSPACE) && stored ) {
+                compsize = job->section.rawsize; //does not fit lzbuff[]: store data
+        }
+        else if(err != LOZ_OK) {
+                MYLOG_ERROR("loz_compress_data() failed with error=%d", err);
                 return LOZ_ERROR;
         }
-
-        //Set fpos to the begining of section-header.crc
-        err = fseek( lozfile->fd, header->fpos + LOZ_SECTIONHEADER_SIZE - LOZ_CRC_SIZE, SEEK_SET );
-        if(err) {
-                MYLOG_ERROR("could not set startpos: fseek(%ld) failed: err=%d: %s", header->fpos, errno, strerror(errno) );
+        if(compsize <= 0) {
+                MYLOG_ERROR("invalid compsize=%d", compsize);
                 return LOZ_ERROR;
         }
 
-        //Write section header crc into file (actual value)
-        //crc
-        err = fwrite( &header->crc, sizeof(header->crc), 1, lozfile->fd );
-        if(err != 1) {
-                MYLOG_ERROR("could not write section crc: err=%d: %s", errno, strerror(errno) );
-                return LOZ_ERROR;
+        //compression does not help: store data
+        if( stored && (codec != LOZ_COMPRESSION_NONE) && (compsize >= job->section.rawsize) ) {
+                codec    = LOZ_COMPRESSION_NONE;
+                compsize = job->section.rawsize;
+                memcpy( job->lzbuff, job->rawdata, compsize );
         }
+        
+        job->section.beginmarker[0] = LOZ_BEGINMARKER[0];
+        job->section.beginmarker[1] = LOZ_BEGINMARKER[1];
+        job->section.rawpos_end     = job->section.rawpos + job->section.rawsize - 1;
+        job->section.compsize       = compsize;
+        job->section.codec          = codec;
 
+        loz_put_section_header( lozfile, &job->section, job->header );
+
+        //Calculate CRC for compressed data
+        loz_put_datacrc( lozfile, job->lzbuff, compsize, job->datacrc );
         return LOZ_OK;
 }
 
 //------------------------------------------------------------------------------
-//Write Section-data from defined fpos
-//inputs:  lozfile
-//         fpos
-//         compdata = pointer to compressed data
-//         compsize = size of compressed data
-//returns: LOZ_OK    = ok, section-header is valid
+//Write section encoded by loz_encode_section() at lozfile->wr_fpos.
+//Section (header, compressed data, data CRC) is written by one pwritev() call.
+//With LOZ_FLAG_ORDERED section-header CRC is written as 0 (invalid), then data
+//is synced to disk and actual header CRC is written: valid header never
+//precedes its data on disk.
+//inputs:  lozfile = pointer to opened lozfile
+//         job     = encoded section
+//returns: LOZ_OK    = ok
 //         LOZ_ERROR = error
-int loz_write_compdata( lozfile_t * lozfile, long int fpos, uint8_t * compdata, int compsize )
+int loz_commit_section( lozfile_t * lozfile, lozfile_job_t * job )
 {
-        int      err;
-        uint8_t  crc;
+        int                 err;
+        lozfile_section_t * header;
+        struct iovec        iov[3];
 
-        MYLOG_TRACE("@(lozfile=%p,fpos=%ld,compdata=%p,compsize=%d)",
-                    lozfile, fpos, compdata, compsize );
+        MYLOG_TRACE("@(lozfile=%p,job=%p)", lozfile, job);
 
         //Check input arguments
         if(lozfile==NULL) {
@@ -822,64 +1508,112 @@ int loz_write_compdata( lozfile_t * lozfile, long int fpos, uint8_t * compdata,
                 MYLOG_ERROR("lozfile is not opened yet");
                 return LOZ_ERROR;
         }
-        if(fpos < LOZ_FILEHEADER_SIZE + LOZ_SECTIONHEADER_SIZE) {
-                MYLOG_ERROR("invalid argument fpos=%ld < %d", fpos, LOZ_FILEHEADER_SIZE + LOZ_SECTIONHEADER_SIZE);
-                return LOZ_ERROR;
-        }
-        if(compdata==NULL) {
-                MYLOG_ERROR("invalid argument compdata=NULL");
+        if(job==NULL) {
+                MYLOG_ERROR("invalid argument job=NULL");
                 return LOZ_ERROR;
         }
-        if(compsize <= 0) {
-                MYLOG_ERROR("invalid argument compsize=%d", compsize);
+        if(lozfile->wr_fpos < LOZ_FILEHEADER_SIZE(lozfile)) {
+                MYLOG_ERROR("invalid lozfile->wr_fpos=%lld", (long long)lozfile->wr_fpos);
                 return LOZ_ERROR;
         }
 
-        //Set fpos to the begining of section-data
-        err = fseek( lozfile->fd, fpos, SEEK_SET );
+        header = &job->section;
+        header->fpos = lozfile->wr_fpos;
+
+        //crc = 0  - mark section as invalid until its data is synced
+        if(lozfile->flags & LOZ_FLAG_ORDERED)
+                job->header[LOZ_SECTIONHEADER_SIZE(lozfile) - LOZ_CRC_SIZE] = 0x00;
+
+        iov[0].iov_base = job->header;
+        iov[0].iov_len  = LOZ_SECTIONHEADER_SIZE(lozfile);
+        iov[1].iov_base = job->lzbuff;
+        iov[1].iov_len  = header->compsize;
+        iov[2].iov_base = job->datacrc;
+        iov[2].iov_len  = LOZ_DATACRC_SIZE(lozfile);
+        err = loz_file_writev( lozfile, header->fpos, iov, 3 );
         if(err) {
-                MYLOG_ERROR("could not set startpos: fseek(%ld) failed: err=%d: %s", fpos, errno, strerror(errno) );
+                MYLOG_ERROR("could not write section at fpos=%lld", (long long)header->fpos);
                 return LOZ_ERROR;
         }
 
-        //Write compressed data to file
-        err = fwrite( compdata, compsize, 1, lozfile->fd );
-        if(err != 1) {
-                MYLOG_ERROR("could not write %d bytes of compressed data: err=%d: %s", compsize, errno, strerror(errno) );
-                return LOZ_ERROR;
+        if(lozfile->flags & LOZ_FLAG_ORDERED)
+        {
+                err = fdatasync( lozfile->fid );
+                if(err) {
+                        MYLOG_ERROR("fdatasync() failed: err=%d: %s", errno, strerror(errno) );
+                        return LOZ_ERROR;
+                }
+                //Write section header crc into file (actual value)
+                err = loz_file_write( lozfile,
+                                      header->fpos + LOZ_SECTIONHEADER_SIZE(lozfile) - LOZ_CRC_SIZE,
+                                      &header->crc,
+                                      LOZ_CRC_SIZE );
+                if(err) {
+                        MYLOG_ERROR("could not write section crc at fpos=%lld", (long long)header->fpos);
+                        return LOZ_ERROR;
+                }
         }
-
-        //Calculate CRC for compressed data
-        crc = crc8_array( compdata, compsize, CRC8_INIT );
-        if(crc==0x00)
-                crc = 0x01;
         
-        //Write compressed data CRC
-        err = fwrite( &crc, sizeof(crc), 1, lozfile->fd );
-        if(err != 1) {
-                MYLOG_ERROR("could not write compressed data crc: err=%d: %s", errno, strerror(errno) );
-                return LOZ_ERROR;
+        lozfile->wr_fpos += LOZ_SECTIONHEADER_SIZE(lozfile) + header->compsize + LOZ_DATACRC_SIZE(lozfile);
+
+        lozfile->stats.sections[header->codec]++;
+        lozfile->stats.rawsize [header->codec] += header->rawsize;
+        lozfile->stats.compsize[header->codec] += header->compsize;
+
+        if(lozfile->index_valid) {
+                err = loz_index_add( lozfile, header );
+                if(err) {
+                        MYLOG_ERROR("loz_index_add() failed");
+                        return LOZ_ERROR;
+                }
         }
         return LOZ_OK;
 }
 
+//------------------------------------------------------------------------------
+//Calculate CRC of compressed data by checksum of file and put it to
+//buf[LOZ_DATACRC_SIZE(lozfile)] (0 result is replaced by 1: 0 means invalid data)
+//inputs:  lozfile  = pointer to opened lozfile
+//         compdata = compressed data
+//         compsize = size of compressed data
+//         buf      = destination buffer
+void loz_put_datacrc( lozfile_t * lozfile, uint8_t * compdata, int compsize, uint8_t * buf )
+{
+        uint32_t crc;
+
+        if(lozfile->checksum == LOZ_CHECKSUM_CRC32C) {
+                crc = crc32c( CRC32C_INIT, compdata, compsize );
+                if(crc==0x00000000)
+                        crc = 0x00000001;
+                put_uint32( buf, crc );
+        }
+        else {
+                buf[0] = crc8_array( compdata, compsize, CRC8_INIT );
+                if(buf[0]==0x00)
+                        buf[0] = 0x01;
+        }
+}
+
 //------------------------------------------------------------------------------
 //Read Section-data (compressed data) from current fpos
 //inputs:  lozfile   = pointer to structure of opened LZ-file
 //         fpos     = start in-file position of data to be readed from file
-//         compdata = pointer to compressed data buffer
+//         compdata = pointer to compressed data buffer (buffer is not used if file is mapped)
 //         compsize = size of data to be readed
+//outputs: compdata = pointer to compressed data (buffer or mapping of file)
 //returns: LOZ_OK      = ok, section-header is valid
 //         LOZ_ERROR   = error
 //         LOZ_EOF     = End Of File achieved
 //         LOZ_BAD_CRC = data is corrupted
-int loz_read_compdata( lozfile_t * lozfile, long int fpos, uint8_t * compdata, int compsize )
+int loz_read_compdata( lozfile_t * lozfile, off_t fpos, uint8_t ** compdata, int compsize )
 {
-        int      err;
-        uint8_t  crc_rd;
-        uint8_t  crc_cc;
+        int          err;
+        uint8_t      crc_rd[LOZ_DATACRC_SIZE_MAX];
+        uint8_t      crc_cc[LOZ_DATACRC_SIZE_MAX];
+        int          crcsize = LOZ_DATACRC_SIZE(lozfile);
+        struct iovec iov[2];
 
-        MYLOG_TRACE("@(lozfile=%p,fpos=%ld,compdata=%p,compsize=%d)", lozfile, fpos, compdata, compsize );
+        MYLOG_TRACE("@(lozfile=%p,fpos=%lld,compdata=%p,compsize=%d)", lozfile, (long long)fpos, compdata, compsize );
 
         //Check input arguments
         if(lozfile==NULL) {
@@ -890,11 +1624,11 @@ int loz_read_compdata( lozfile_t * lozfile, long int fpos, uint8_t * compdata, i
                 MYLOG_ERROR("lozfile is not opened yet");
                 return LOZ_ERROR;
         }
-        if(fpos < LOZ_FILEHEADER_SIZE) {
-                MYLOG_ERROR("invalid argument fpos=%ld (intersection with fileheader)", fpos);
+        if(fpos < LOZ_FILEHEADER_SIZE(lozfile)) {
+                MYLOG_ERROR("invalid argument fpos=%lld (intersection with fileheader)", (long long)fpos);
                 return LOZ_ERROR;
         }
-        if(compdata==NULL) {
+        if( (compdata==NULL) || ((*compdata==NULL) && (lozfile->map==NULL)) ) {
                 MYLOG_ERROR("invalid argument compdata=NULL");
                 return LOZ_ERROR;
         }
@@ -903,59 +1637,50 @@ int loz_read_compdata( lozfile_t * lozfile, long int fpos, uint8_t * compdata, i
                 return LOZ_ERROR;
         }
 
-        //Set fpos to the begining of section-data
-        err = fseek( lozfile->fd, fpos, SEEK_SET );
-        if(err) {
-                MYLOG_ERROR("could not set startpos: fseek(%ld) failed: err=%d: %s", fpos, errno, strerror(errno) );
-                return LOZ_ERROR;
-        }
-
-        //Read compressed data from file
-        err = fread( compdata, compsize, 1, lozfile->fd );
-        if(err != 1) {
-                MYLOG_ERROR("could not read %d bytes of compressed data: err=%d: %s", compsize, errno, strerror(errno) );
-                if( feof(lozfile->fd) ) {
+        if(lozfile->map)
+        {
+                //compressed data is used in place
+                if(fpos + compsize + crcsize > lozfile->mapsize) {
                         MYLOG_DEBUG("EOF of lozfile achieved");
                         return LOZ_EOF;
                 }
-                else if( ferror(lozfile->fd) ) {
-                        MYLOG_ERROR("fread() failed: err: %d: %s", errno, strerror(errno));
-                        return LOZ_ERROR;
-                }
-                else {
-                        MYLOG_ERROR("could not read %d bytes from file", compsize);
+                if( lozfile->map_random && (compsize + crcsize > 4096) )
+                        loz_map_advise( lozfile, fpos, compsize + crcsize, MADV_WILLNEED ); //one call instead of page faults
+                *compdata = lozfile->map + fpos;
+                memcpy( crc_rd, lozfile->map + fpos + compsize, crcsize );
+        }
+        else
+        {
+                //Read compressed data and its CRC from file
+                iov[0].iov_base = *compdata;
+                iov[0].iov_len  = compsize;
+                iov[1].iov_base = crc_rd;
+                iov[1].iov_len  = crcsize;
+                err = loz_file_readv( lozfile, fpos, iov, 2 );
+                if(err < 0) {
+                        MYLOG_ERROR("could not read %d bytes of compressed data", compsize);
                         return LOZ_ERROR;
                 }
-        }
-        
-        //Read compressed data CRC from file
-        err = fread( &crc_rd, sizeof(crc_rd), 1, lozfile->fd );
-        if(err != 1) {
-                if( feof(lozfile->fd) ) {
+                if(err < compsize + crcsize) {
                         MYLOG_DEBUG("EOF of lozfile achieved");
                         return LOZ_EOF;
                 }
-                else if( ferror(lozfile->fd) ) {
-                        MYLOG_ERROR("fread() failed: err: %d: %s", errno, strerror(errno));
-                        return LOZ_ERROR;
-                }
-                else {
-                        MYLOG_ERROR("could not read %d bytes from file", sizeof(crc_rd));
-                        return LOZ_ERROR;
-                }
         }
         //Check CRC
-        if(crc_rd==0x00) {
-                MYLOG_ERROR("compressed data status is invalid (crc=0x00)");
+        memset( crc_cc, 0, sizeof(crc_cc) );
+        if(memcmp(crc_rd, crc_cc, crcsize) == 0) {
+                MYLOG_ERROR("compressed data status is invalid (crc=0)");
                 return LOZ_BAD_CRC;
         }
 
+        //trusted read: data is not verified
+        if(lozfile->flags & LOZ_FLAG_NOVERIFY)
+                return LOZ_OK;
+
         //Calculate CRC for compressed data
-        crc_cc = crc8_array( compdata, compsize, CRC8_INIT );
-        if(crc_cc==0x00)
-                crc_cc = 0x01;
+        loz_put_datacrc( lozfile, *compdata, compsize, crc_cc );
 
-        if(crc_cc != crc_rd) {
+        if(memcmp(crc_cc, crc_rd, crcsize) != 0) {
                 MYLOG_ERROR("section data is corrupted");
                 return LOZ_BAD_CRC;
         }
@@ -989,7 +1714,7 @@ int loz_section_first ( lozfile_t * lozfile, lozfile_section_t * header )
         }
         
         //Get fpos of the 1st section, move rdpos to the begining of compressed data of section
-        err = loz_read_section_header( lozfile, header, LOZ_FILEHEADER_SIZE ); //skip file-header
+        err = loz_read_section_header( lozfile, header, LOZ_FILEHEADER_SIZE(lozfile) ); //skip file-header
         if(err != LOZ_OK) {
                 MYLOG_ERROR("could not get the valid 1st section: loz_read_section_header() failed with error or bad-crc");
                 return err;
@@ -1008,7 +1733,7 @@ int loz_section_first ( lozfile_t * lozfile, lozfile_section_t * header )
 int loz_section_next ( lozfile_t * lozfile, lozfile_section_t * curr, lozfile_section_t * next )
 {
         int      err;
-        long int fpos;
+        off_t fpos;
         
         MYLOG_TRACE("@(lozfile=%p,curr=%p,next=%p)", lozfile, curr, next );
         
@@ -1033,40 +1758,24 @@ int loz_section_next ( lozfile_t * lozfile, lozfile_section_t * curr, lozfile_se
         if(curr->header_is_valid) {
                 //curr section header is valid - use its info and
                 //get fpos of next section by curr->fpos and curr->compsize
-                fpos = curr->fpos + LOZ_SECTIONHEADER_SIZE + curr->compsize + LOZ_CRC_SIZE;
+                fpos = curr->fpos + LOZ_SECTIONHEADER_SIZE(lozfile) + curr->compsize + LOZ_DATACRC_SIZE(lozfile);
                 
                 err = loz_read_section_header( lozfile, next, fpos );
                 if(err == LOZ_OK) {
-                        MYLOG_DEBUG("next section (valid) has been found at fpos=%ld",next->fpos);
+                        MYLOG_DEBUG("next section (valid) has been found at fpos=%lld",(long long)next->fpos);
                         return LOZ_OK;
                 }
                 return err;
         }
         else {
                 //try to find next section by section-begin-marker
-                fpos = curr->fpos;
-                while(1) {
-                        //search for section-begin-marker bytes
-                        fpos = loz_find_seq2( lozfile, LOZ_BEGINMARKER, fpos+1 ); //skip begin-marker of curr section
-                        if(fpos < 0) {
-                                MYLOG_ERROR("could not find next section by begin-marker: loz_find_seq2() failed");
-                                return fpos;
-                        }
-                        //try to read section header
-                        err = loz_read_section_header( lozfile, next, fpos );
-                        if(err == LOZ_OK) {
-                                MYLOG_DEBUG("next section has been found at fpos=%ld",next->fpos);
-                                return LOZ_OK; //next section has been found
-                        }
-                        else if(err == LOZ_BAD_CRC) {
-                                //this is not section begin or corrupted section: skip begin-marker of curr section
-                                continue;
-                        }
-                        else {
-                                MYLOG_ERROR("could not read section: loz_read_section_header() failed");
-                                return err;
-                        }
+                err = loz_find_section( lozfile, next, curr->fpos + 1 ); //skip begin-marker of curr section
+                if(err != LOZ_OK) {
+                        MYLOG_ERROR("could not find next section by begin-marker: loz_find_section() failed");
+                        return err;
                 }
+                MYLOG_DEBUG("next section has been found at fpos=%lld",(long long)next->fpos);
+                return LOZ_OK; //next section has been found
         }
 }
 
@@ -1081,7 +1790,7 @@ int loz_section_next ( lozfile_t * lozfile, lozfile_section_t * curr, lozfile_se
 int loz_section_prev ( lozfile_t * lozfile, lozfile_section_t * curr, lozfile_section_t * prev )
 {
         int      err;
-        long int fpos;
+        off_t fpos;
         
         MYLOG_TRACE("@(lozfile=%p,curr=%p,prev=%p)",lozfile,curr,prev);
         
@@ -1118,7 +1827,7 @@ int loz_section_prev ( lozfile_t * lozfile, lozfile_section_t * curr, lozfile_se
                 //try to read section
                 err = loz_read_section_header( lozfile, prev, fpos );
                 if(err == LOZ_OK) {
-                        MYLOG_DEBUG("previous section has been found at fpos=%ld",prev->fpos);
+                        MYLOG_DEBUG("previous section has been found at fpos=%lld",(long long)prev->fpos);
                         return LOZ_OK;
                 }
 
@@ -1137,7 +1846,7 @@ int loz_section_prev ( lozfile_t * lozfile, lozfile_section_t * curr, lozfile_se
 int loz_section_last ( lozfile_t * lozfile, lozfile_section_t * header )
 {
         int      err;
-        long int fpos;
+        off_t fpos;
         
         MYLOG_TRACE("@(lozfile=%p,header=%p)",lozfile,header);
         
@@ -1156,14 +1865,9 @@ int loz_section_last ( lozfile_t * lozfile, lozfile_section_t * header )
         }
         
         //Get last section at fpos = filesize
-        err = fseek( lozfile->fd, 0L, SEEK_END );
-        if(err) {
-                MYLOG_ERROR("could not set fpos to the end of file: fseek() failed: err=%d: %s", errno, strerror(errno) );
-                return LOZ_ERROR;
-        }
-        fpos = ftell( lozfile->fd );
-        if(fpos == -1) {
-                MYLOG_ERROR("could not get fpos at the end of file: ftell() failed: err=%d: %s", errno, strerror(errno) );
+        fpos = loz_file_size( lozfile );
+        if(fpos < 0) {
+                MYLOG_ERROR("could not get size of file");
                 return LOZ_ERROR;
         }
         fpos--;
@@ -1179,7 +1883,7 @@ int loz_section_last ( lozfile_t * lozfile, lozfile_section_t * header )
                 //try to read section
                 err = loz_read_section_header( lozfile, header, fpos );
                 if(err == LOZ_OK) {
-                        MYLOG_DEBUG("last section has been found at fpos=%ld",header->fpos);
+                        MYLOG_DEBUG("last section has been found at fpos=%lld",(long long)header->fpos);
                         return LOZ_OK;
                 }
 
@@ -1189,277 +1893,2338 @@ int loz_section_last ( lozfile_t * lozfile, lozfile_section_t * header )
 }
 
 //------------------------------------------------------------------------------
-//Write available data from lozfile->wrbuff[] to file
-//inputs:   lozfile = pointer to opened lozfile
-//returns:  written = number of bytes successfully written to file
-//          LOZ_ERROR = error
-int loz_flush_wrbuff_to_file( lozfile_t * lozfile )
+//Put unsigned value to buf[] as varint (7 bits per byte, low bits first)
+//returns: n = number of bytes written
+int put_varint( uint8_t * buf, uint64_t value )
 {
-        int              compsize;
-        int              err;
-        lozfile_section_t section;
+        int n = 0;
 
-        MYLOG_TRACE("@(lozfile=%p)", lozfile);
+        while(value >= 0x80) {
+                buf[n++] = (uint8_t)(value | 0x80);
+                value >>= 7;
+        }
+        buf[n++] = (uint8_t)value;
+        return n;
+}
+
+//------------------------------------------------------------------------------
+//Get varint value from buf[]
+//returns: n = number of bytes readed
+int get_varint( uint8_t * buf, uint64_t * value )
+{
+        int      n     = 0;
+        int      shift = 0;
+        uint64_t v     = 0;
+
+        do {
+                v |= (uint64_t)(buf[n] & 0x7F) << shift;
+                shift += 7;
+        } while(buf[n++] & 0x80);
+        *value = v;
+        return n;
+}
+
+//------------------------------------------------------------------------------
+//Clear in-memory section index (memory is kept for reuse)
+void loz_index_reset( lozfile_t * lozfile )
+{
+        lozfile->index_n      = 0;
+        lozfile->index_data_n = 0;
+        lozfile->index_eytz_n = 0;
+        lozfile->index_valid  = 0;
+        memset( &lozfile->index_last, 0, sizeof(lozfile->index_last) );
+}
+
+//------------------------------------------------------------------------------
+//Add valid section to the end of in-memory section index. Entry is encoded
+//after the last one: flags byte, then varints of gaps (if section does not
+//follow the last one in file/raw data), rawsize (if it differs from rawsize
+//of the last one) and compsize (if section is not stored).
+//returns: LOZ_OK    = ok
+//         LOZ_ERROR = error
+int loz_index_add( lozfile_t * lozfile, lozfile_section_t * section )
+{
+        lozfile_index_block_t * blocks;
+        lozfile_index_t       * last;
+        lozfile_index_block_t * blk;
+        uint8_t               * data;
+        uint8_t               * p;
+        uint8_t                 flags = 0;
+        int                     first;
+        int                     size;
+        off_t                   fpos_end = 0;
 
         //Check input arguments
         if(lozfile==NULL) {
                 MYLOG_ERROR("invalid argument lozfile=NULL");
                 return LOZ_ERROR;
         }
-        if(lozfile->fd==NULL) {
-                MYLOG_ERROR("lozfile is not opened yet");
+        if(section==NULL) {
+                MYLOG_ERROR("invalid argument section=NULL");
                 return LOZ_ERROR;
         }
-        if(lozfile->wrbuff==NULL) {
-                MYLOG_ERROR("invalid argument wrbuff=NULL");
-                return LOZ_ERROR;
+
+        //index must stay sorted by rawpos and fpos: skip sections overlapping the
+        //last one (false begin-marker with good CRC inside corrupted data)
+        last = &lozfile->index_last;
+        if(lozfile->index_n > 0) {
+                fpos_end = last->fpos + LOZ_SECTIONHEADER_SIZE(lozfile) + last->compsize + LOZ_DATACRC_SIZE(lozfile);
+                if( (section->rawpos < last->rawpos + last->rawsize) ||
+                    (section->fpos < fpos_end) ) {
+                        MYLOG_WARNING("section at fpos=%lld overlaps previous one, skipped", (long long)section->fpos);
+                        return LOZ_OK;
+                }
         }
-        if(lozfile->lzbuff==NULL) {
-                MYLOG_ERROR("invalid argument lzbuff=NULL");
-                return LOZ_ERROR;
+        first = (lozfile->index_n % LOZ_INDEX_BLOCK == 0);
+
+        //grow index_blocks[] if needed
+        if( first && (lozfile->index_n / LOZ_INDEX_BLOCK >= lozfile->index_blocks_size) ) {
+                size = (lozfile->index_blocks_size > 0) ? 2 * lozfile->index_blocks_size : 64;
+                blocks = realloc( lozfile->index_blocks, size * sizeof(lozfile_index_block_t) );
+                if(blocks==NULL) {
+                        MYLOG_ERROR("could not allocate memory for %d index blocks", size);
+                        return LOZ_ERROR;
+                }
+                lozfile->index_blocks      = blocks;
+                lozfile->index_blocks_size = size;
         }
+        //grow index_data[] if needed
+        if(lozfile->index_data_n + LOZ_INDEX_ENTRY_MAX > lozfile->index_data_size) {
+                if(lozfile->index_data_size > 0x3FFFFFFF) {
+                        MYLOG_ERROR("section index is too big: %d sections", lozfile->index_n);
+                        return LOZ_ERROR;
+                }
+                size = (lozfile->index_data_size > 0) ? 2 * lozfile->index_data_size : 4096;
+                data = realloc( lozfile->index_data, size );
+                if(data==NULL) {
+                        MYLOG_ERROR("could not allocate %d bytes for index data", size);
+                        return LOZ_ERROR;
+                }
+                lozfile->index_data      = data;
+                lozfile->index_data_size = size;
+        }
+
+        //1st entry of block: block keeps its position
+        if(first) {
+                blk = &lozfile->index_blocks[ lozfile->index_n / LOZ_INDEX_BLOCK ];
+                blk->fpos   = section->fpos;
+                blk->rawpos = section->rawpos;
+                blk->offset = lozfile->index_data_n;
+        }
+
+        //encode entry
+        p = lozfile->index_data + lozfile->index_data_n + 1; //flags are put after varints
+        if(!first && (section->rawpos != last->rawpos + last->rawsize)) {
+                flags |= LOZ_INDEX_RAWGAP;
+                p += put_varint( p, section->rawpos - (last->rawpos + last->rawsize) );
+        }
+        if(!first && (section->fpos != fpos_end)) {
+                flags |= LOZ_INDEX_FPOSGAP;
+                p += put_varint( p, section->fpos - fpos_end );
+        }
+        if(first || (section->rawsize != last->rawsize)) {
+                flags |= LOZ_INDEX_RAWSIZE;
+                p += put_varint( p, section->rawsize );
+        }
+        if(section->compsize == section->rawsize)
+                flags |= LOZ_INDEX_STORED;
+        else
+                p += put_varint( p, section->compsize );
+        lozfile->index_data[ lozfile->index_data_n ] = flags;
+        lozfile->index_data_n = p - lozfile->index_data;
+
+        last->fpos     = section->fpos;
+        last->rawpos   = section->rawpos;
+        last->rawsize  = section->rawsize;
+        last->compsize = section->compsize;
+        lozfile->index_n++;
+        return LOZ_OK;
+}
 
-        if(lozfile->wrbuff_pos == 0) {
-                MYLOG_DEBUG("There is no data in lozfile->wrbuff[] - nothing written to file");
-                return 0;
+//------------------------------------------------------------------------------
+//Decode entry of section index from p[] after previous entry *e
+//inputs:  p     = encoded entry
+//         e     = previous entry (1st entry of block: fpos/rawpos of block)
+//         first = entry is the 1st one of block
+//         hsize = size of section header + data crc
+//outputs: e     = decoded entry
+//returns: pointer to the next encoded entry
+static inline uint8_t * loz_index_decode( uint8_t * p, lozfile_index_t * e, int first, int hsize )
+{
+        uint8_t   flags;
+        uint64_t  v;
+
+        if(!first) {
+                e->fpos   += hsize + e->compsize;
+                e->rawpos += e->rawsize;
         }
-        
-        //compress wrbuff[] into lzbuff[]
-        err = loz_compress_data ( lozfile->compression,
-                                 lozfile->wrbuff,
-                                 lozfile->wrbuff_pos,
-                                 lozfile->lzbuff,
-                                 lozfile->lzbuffsize,
-                                 &compsize );
-        if(err != LOZ_OK) {
-                MYLOG_ERROR("loz_compress_data() failed with error=%d", err);
-                return LOZ_ERROR;
+        flags = *p++;
+        if(flags & LOZ_INDEX_RAWGAP) {
+                p += get_varint( p, &v );
+                e->rawpos += v;
         }
-        
-        section.beginmarker[0] = LOZ_BEGINMARKER[0];
-        section.beginmarker[1] = LOZ_BEGINMARKER[1];
-        section.fpos           = lozfile->wr_fpos;
-        section.rawpos         = lozfile->wr_rawpos - lozfile->wrbuff_pos;
-        section.rawpos_end     = lozfile->wr_rawpos;
-        section.rawsize        = lozfile->wrbuff_pos;
-        section.compsize       = compsize;
-
-        err = loz_write_section_header( lozfile, &section );
-        if(err) {
-                MYLOG_ERROR("loz_write_section_header() failed");
-                return LOZ_ERROR;
+        if(flags & LOZ_INDEX_FPOSGAP) {
+                p += get_varint( p, &v );
+                e->fpos += v;
         }
-
-        err = loz_write_compdata( lozfile,
-                                 section.fpos + LOZ_SECTIONHEADER_SIZE,
-                                 lozfile->lzbuff,
-                                 compsize );
-        if(err) {
-                MYLOG_ERROR("loz_write_compdata() failed");
-                return LOZ_ERROR;
+        if(flags & LOZ_INDEX_RAWSIZE) {
+                p += get_varint( p, &v );
+                e->rawsize = v;
         }
-
-        err = loz_write_section_header_crc( lozfile, &section );
-        if(err) {
-                MYLOG_ERROR("loz_write_section_header_crc() failed");
-                return LOZ_ERROR;
+        if(flags & LOZ_INDEX_STORED) {
+                e->compsize = e->rawsize;
         }
-        
-        lozfile->wr_fpos += LOZ_SECTIONHEADER_SIZE + compsize + LOZ_CRC_SIZE;
+        else {
+                p += get_varint( p, &v );
+                e->compsize = v;
+        }
+        return p;
+}
 
-        lozfile->wrbuff_pos = 0;
-    
-        return section.rawsize;
+//------------------------------------------------------------------------------
+//Move cursor to the next entry of section index
+//returns: LOZ_OK  = ok, cursor->entry is entry cursor->n
+//         LOZ_EOF = there are no more entries
+int loz_index_next( lozfile_t * lozfile, lozfile_index_cursor_t * cursor )
+{
+        lozfile_index_block_t * blk;
+        uint8_t               * p;
+        int                     n = cursor->n + 1;
+
+        if(n >= lozfile->index_n)
+                return LOZ_EOF;
+
+        if(n % LOZ_INDEX_BLOCK == 0) {
+                blk = &lozfile->index_blocks[ n / LOZ_INDEX_BLOCK ];
+                cursor->entry.fpos   = blk->fpos;
+                cursor->entry.rawpos = blk->rawpos;
+                cursor->pos          = blk->offset;
+        }
+        p = loz_index_decode( lozfile->index_data + cursor->pos, &cursor->entry,
+                              n % LOZ_INDEX_BLOCK == 0,
+                              LOZ_SECTIONHEADER_SIZE(lozfile) + LOZ_DATACRC_SIZE(lozfile) );
+        cursor->pos = p - lozfile->index_data;
+        cursor->n   = n;
+        return LOZ_OK;
 }
 
-/******************************************************************************/
-/* FUNCTIONS                                                                  */
-/******************************************************************************/
+//------------------------------------------------------------------------------
+//Move cursor to entry n of section index (entries of its block are decoded)
+//returns: LOZ_OK  = ok, cursor->entry is entry n
+//         LOZ_EOF = there is no entry n
+int loz_index_seek( lozfile_t * lozfile, int n, lozfile_index_cursor_t * cursor )
+{
+        int err;
+
+        if( (n < 0) || (n >= lozfile->index_n) )
+                return LOZ_EOF;
+
+        cursor->n = n - n % LOZ_INDEX_BLOCK - 1;
+        do {
+                err = loz_index_next( lozfile, cursor );
+        } while( (err == LOZ_OK) && (cursor->n < n) );
+        return err;
+}
 
 //------------------------------------------------------------------------------
-//Open lozfile. If file does not exist, it will be created.
-//
-//inputs:   filename    = name of logfile
-//          rwmode      = read/write mode:
-//                        "r"-read only
-//                        "r+"-read/write-update (create/update file, if file does not exist it will be created)
-//                        "w+"-read/write-clear (clear existing file, if file does not exist it will be created)
-//          buffsize    = size of read-write buffers (LOZ_BLOCKSIZE_MIN .. LOZ_BLOCKSIZE_MAX), -1=use default value
-//          compression = type of compression for new data to be written
-//
-//returns:  lozfile   = pointer to opened lz-file
-//          NULL     = error
-lozfile_t * loz_open ( const char * filename, char * rwmode, int buffsize, int compression )
+//Copy blocks i.. to index_eytz[k..] (in-order walk of implicit tree)
+//returns: i = number of next block
+int loz_index_eytz_fill( lozfile_t * lozfile, int i, int k )
 {
-        lozfile_t         * lozfile = NULL;
-        int                err;
-        int                exists;
-        lozfile_section_t   section;
+        if(k <= lozfile->index_eytz_n) {
+                i = loz_index_eytz_fill( lozfile, i, 2 * k );
+                lozfile->index_eytz[k] = lozfile->index_blocks[i];
+                i = loz_index_eytz_fill( lozfile, i + 1, 2 * k + 1 );
+        }
+        return i;
+}
+
+//------------------------------------------------------------------------------
+//Build Eytzinger layout of blocks of section index: search path of binary
+//search goes through neighbour cells (first levels of tree share cache lines)
+//returns: LOZ_OK    = ok
+//         LOZ_ERROR = error
+int loz_index_eytz_build( lozfile_t * lozfile )
+{
+        int                     nblocks;
+        lozfile_index_block_t * eytz;
 
-        MYLOG_TRACE("@(filename=%s,rwmode=%s,buffsize=%d,compression=%s)",
-                    filename, rwmode, buffsize, compression_to_str(compression) );
+        nblocks = (lozfile->index_n + LOZ_INDEX_BLOCK - 1) / LOZ_INDEX_BLOCK;
 
-        //Check input arguments
-        if(filename==NULL) {
-                MYLOG_ERROR("invalid argument: filename=NULL");
-                return NULL;
+        eytz = realloc( lozfile->index_eytz, (nblocks + 1) * sizeof(lozfile_index_block_t) );
+        if(eytz==NULL) {
+                MYLOG_ERROR("could not allocate memory for %d index blocks", nblocks);
+                return LOZ_ERROR;
         }
-        if(filename[0]=='\0') {
-                MYLOG_ERROR("invalid argument: filename=\"\"");
-                return NULL;
+        lozfile->index_eytz   = eytz;
+        lozfile->index_eytz_n = nblocks;
+        loz_index_eytz_fill( lozfile, 0, 1 );
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Find section containing rawpos in section index: block is found by
+//Eytzinger search (last block with rawpos <= rawpos is the last node where
+//search goes right), then entries of block are decoded
+//outputs: entry = found entry
+//returns: LOZ_OK    = ok, entry is the last section with entry.rawpos <= rawpos
+//         LOZ_EOF   = rawpos is before the 1st indexed section (or index is empty)
+//         LOZ_ERROR = error
+int loz_index_find( lozfile_t * lozfile, off_t rawpos, lozfile_index_t * entry )
+{
+        int                     nblocks;
+        int                     k;
+        int                     best;
+        int                     right;
+        int                     i;
+        int                     hsize;
+        lozfile_index_block_t * blk;
+        lozfile_index_t         next;
+        uint8_t               * p;
+        uint8_t               * end;
+
+        if(lozfile->index_n == 0)
+                return LOZ_EOF;
+
+        nblocks = (lozfile->index_n + LOZ_INDEX_BLOCK - 1) / LOZ_INDEX_BLOCK;
+        if(lozfile->index_eytz_n != nblocks) {
+                if( loz_index_eytz_build( lozfile ) )
+                        return LOZ_ERROR;
         }
-        if(rwmode==NULL) {
-                MYLOG_ERROR("invalid argument: rwmode=NULL");
-                return NULL;
+
+        k    = 1;
+        best = 0;
+        while(k <= nblocks) {
+                //grandchildren of node: 4 nodes 2 levels ahead, they span 2 cache lines
+                __builtin_prefetch( lozfile->index_eytz + 4 * k );
+                __builtin_prefetch( lozfile->index_eytz + 4 * k + 3 );
+                right = ((off_t)lozfile->index_eytz[k].rawpos <= rawpos);
+                best  = right ? k : best;
+                k     = 2 * k + right;
+        }
+        if(best == 0)
+                return LOZ_EOF;
+
+        //decode entries of block till rawpos
+        blk          = &lozfile->index_eytz[best];
+        entry->fpos   = blk->fpos;
+        entry->rawpos = blk->rawpos;
+        hsize = LOZ_SECTIONHEADER_SIZE(lozfile) + LOZ_DATACRC_SIZE(lozfile);
+        p     = loz_index_decode( lozfile->index_data + blk->offset, entry, 1, hsize );
+        end   = lozfile->index_data + lozfile->index_data_n;
+        for(i=1; (i < LOZ_INDEX_BLOCK) && (p < end); i++) {
+                next = *entry;
+                p = loz_index_decode( p, &next, 0, hsize );
+                if(next.rawpos > rawpos)
+                        break;
+                *entry = next;
         }
-        if( (buffsize < LOZ_BLOCKSIZE_MIN) ||
-            (buffsize > LOZ_BLOCKSIZE_MAX)  ) {
-                MYLOG_ERROR("invalid argument: buffsize=%d, must be %d..%d", buffsize, LOZ_BLOCKSIZE_MIN, LOZ_BLOCKSIZE_MAX );
-                return NULL;
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Find the first section of section index after rawpos (end of corrupted
+//sections which are not indexed, see loz_pread())
+//outputs: entry = found entry
+//returns: LOZ_OK  = ok, entry is the first section with entry.rawpos > rawpos
+//         LOZ_EOF = there are no sections after rawpos
+int loz_index_upper( lozfile_t * lozfile, off_t rawpos, lozfile_index_t * entry )
+{
+        int                     lo;
+        int                     hi;
+        int                     mid;
+        int                     err;
+        lozfile_index_cursor_t  cursor;
+
+        //last block with rawpos of its 1st entry <= rawpos
+        lo = 0;
+        hi = (lozfile->index_n + LOZ_INDEX_BLOCK - 1) / LOZ_INDEX_BLOCK - 1;
+        while(lo <= hi) {
+                mid = lo + (hi - lo) / 2;
+                if((off_t)lozfile->index_blocks[mid].rawpos <= rawpos)
+                        lo = mid + 1;
+                else
+                        hi = mid - 1;
+        }
+
+        err = loz_index_seek( lozfile, (hi < 0) ? 0 : hi * LOZ_INDEX_BLOCK, &cursor );
+        while( (err == LOZ_OK) && ((off_t)cursor.entry.rawpos <= rawpos) )
+                err = loz_index_next( lozfile, &cursor );
+        if(err == LOZ_OK)
+                *entry = cursor.entry;
+        return err;
+}
+
+//------------------------------------------------------------------------------
+//Build section index and its Eytzinger layout if they are not built yet
+//(and switch mapping of file to random access). After that loz_index_find()
+//does not change lozfile and could be called by many threads (until new
+//sections are written).
+//returns: LOZ_OK    = ok
+//         LOZ_ERROR = error
+int loz_index_ready( lozfile_t * lozfile )
+{
+        int err = LOZ_OK;
+        int nblocks;
+
+        pthread_mutex_lock( &lozfile->index_mutex );
+        if(!lozfile->index_valid) {
+                err = loz_index_build( lozfile );
+                if(err != LOZ_OK)
+                        MYLOG_ERROR("loz_index_build() failed");
+        }
+        nblocks = (lozfile->index_n + LOZ_INDEX_BLOCK - 1) / LOZ_INDEX_BLOCK;
+        if( (err == LOZ_OK) && (nblocks > 0) && (lozfile->index_eytz_n != nblocks) ) {
+                err = loz_index_eytz_build( lozfile );
+                if(err != LOZ_OK)
+                        MYLOG_ERROR("loz_index_eytz_build() failed");
+        }
+        //file is accessed randomly from now: no readahead of mapping
+        if( lozfile->map && !lozfile->map_random ) {
+                loz_map_advise( lozfile, 0, lozfile->mapsize, MADV_RANDOM );
+                lozfile->map_random = 1;
+        }
+        pthread_mutex_unlock( &lozfile->index_mutex );
+        return err;
+}
+
+//------------------------------------------------------------------------------
+//Build in-memory section index: walk all section headers of file
+//(compressed data is not readed/uncompressed)
+//returns: LOZ_OK    = ok
+//         LOZ_ERROR = error
+int loz_index_build( lozfile_t * lozfile )
+{
+        int               err;
+        lozfile_section_t curr;
+        lozfile_section_t next;
+
+        MYLOG_TRACE("@(lozfile=%p)", lozfile);
+
+        //Check input arguments
+        if(lozfile==NULL) {
+                MYLOG_ERROR("invalid argument lozfile=NULL");
+                return LOZ_ERROR;
+        }
+        if(lozfile->fd==NULL) {
+                MYLOG_ERROR("lozfile is not opened yet");
+                return LOZ_ERROR;
         }
 
-        switch(compression)
+        loz_index_reset( lozfile );
+
+        err = loz_read_section_header( lozfile, &curr, LOZ_FILEHEADER_SIZE(lozfile) ); //skip file-header
+        while( (err == LOZ_OK) || (err == LOZ_BAD_CRC) )
         {
-        case LOZ_COMPRESSION_NONE:   
-        case LOZ_COMPRESSION_RLE:    
-        case LOZ_COMPRESSION_RLE2:    
-        case LOZ_COMPRESSION_LZ:     
-        case LOZ_COMPRESSION_FASTLZ1:
-        case LOZ_COMPRESSION_FASTLZ2:
-                break;
-        default:
-                MYLOG_ERROR("unsupported compression=%d",compression);
-                return NULL;
+                if(err == LOZ_OK) {
+                        err = loz_index_add( lozfile, &curr );
+                        if(err != LOZ_OK) {
+                                MYLOG_ERROR("loz_index_add() failed");
+                                return LOZ_ERROR;
+                        }
+                }
+                //corrupted sections are not indexed: loz_section_next() skips them
+                err = loz_section_next( lozfile, &curr, &next );
+                loz_section_copy( &curr, &next );
+        }
+        if(err != LOZ_EOF) {
+                MYLOG_ERROR("could not walk section headers: error=%d", err);
+                return LOZ_ERROR;
         }
 
-        //allocate memory
-        lozfile = malloc(sizeof(lozfile_t));
-        if(lozfile==NULL)
-                return NULL;
+        lozfile->index_valid = 1;
+        MYLOG_DEBUG("section index has been built: %d sections", lozfile->index_n);
+        return LOZ_OK;
+}
 
-        lozfile->version        = LOZ_VERSION_0;
-        lozfile->compression    = compression;
-        lozfile->filesize       = 0L;
-        lozfile->rwmode         = LOZ_READWRITE;
-        lozfile->fd             = NULL;
-        lozfile->fid            = -1;
-        lozfile->rd_fpos        = 0;
-        lozfile->wr_fpos        = 0;
-        lozfile->rd_rawpos      = 0;
-        lozfile->wr_rawpos      = 0;
-                           
-        lozfile->buffsize       = 0;
-        lozfile->lzbuffsize     = 0;
-        lozfile->strbuffsize    = 0;
-        lozfile->wrbuff         = NULL;
-        lozfile->rdbuff         = NULL;
-        lozfile->lzbuff         = NULL;
-        lozfile->strbuff        = NULL;
-        lozfile->wrbuff_pos     = 0;
-        lozfile->rdbuff_pos     = 0;
-        lozfile->rdbuff_n       = 0;
+//------------------------------------------------------------------------------
+//Read section index from the end of file (LOZ_VERSION_1): footer and
+//index-block are readed with one pread() each, data-sections are not touched
+//inputs:  lozfile  = pointer to opened lozfile
+//         indexpos = begining of index-block in file (will be filled)
+//returns: LOZ_OK    = ok, index is loaded
+//         LOZ_EOF   = there is no valid index at the end of file (it must be scanned)
+//         LOZ_ERROR = error
+int loz_read_index( lozfile_t * lozfile, off_t * indexpos )
+{
+        int               err;
+        off_t             filesize;
+        uint8_t           footer[LOZ_FOOTER_SIZE];
+        uint8_t         * buf = NULL;
+        uint8_t         * p;
+        uint8_t           crc;
+        uint64_t          pos;
+        uint64_t          rawpos;
+        uint64_t          fpos;
+        uint64_t          fpos_end;
+        uint64_t          rawpos_end;
+        int               entries;
+        int64_t           size64;
+        int               size;
+        int               i;
+        lozfile_section_t section;
 
-        //check if file already exists
-        exists = file_exists(filename);
-        if(exists < 0) {
-                MYLOG_ERROR("file_exists() failed");
-                goto exit_fail;
+        MYLOG_TRACE("@(lozfile=%p,indexpos=%p)", lozfile, indexpos);
+
+        //Check input arguments
+        if(lozfile==NULL) {
+                MYLOG_ERROR("invalid argument lozfile=NULL");
+                return LOZ_ERROR;
+        }
+        if(lozfile->fd==NULL) {
+                MYLOG_ERROR("lozfile is not opened yet");
+                return LOZ_ERROR;
+        }
+        if(indexpos==NULL) {
+                MYLOG_ERROR("invalid argument indexpos=NULL");
+                return LOZ_ERROR;
         }
 
-        //open file in defined rwmode
-        if(0==strcmp(rwmode,"r")) {
-                lozfile->rwmode = LOZ_READONLY;
-                if(!exists) {
-                        MYLOG_ERROR("file \"%s\" does not exist", filename);
-                        return NULL;
-                }
-                lozfile->fd = fopen( filename, "rb" ); //read only
+        //Get filesize
+        filesize = loz_file_size( lozfile );
+        if(filesize < 0) {
+                MYLOG_ERROR("could not get size of file");
+                return LOZ_ERROR;
         }
-        else if(0==strcmp(rwmode,"r+")) {
-                lozfile->rwmode = LOZ_READWRITE;
-                lozfile->fd = fopen( filename, "r+b" ); //read/write/update
+        if(filesize < LOZ_FILEHEADER_SIZE(lozfile) + LOZ_INDEXMARKER_SIZE + LOZ_CRC_SIZE + LOZ_FOOTER_SIZE) {
+                MYLOG_DEBUG("file is too small to have index");
+                return LOZ_EOF;
         }
-        else if(0==strcmp(rwmode,"w+")) {
-                lozfile->rwmode = LOZ_READWRITE_CLEAR;
-                lozfile->fd = fopen( filename, "w+b" ); //read/write/clear
+
+        //Read and check footer
+        err = loz_file_read( lozfile, filesize - LOZ_FOOTER_SIZE, footer, sizeof(footer) );
+        if(err != sizeof(footer)) {
+                MYLOG_ERROR("could not read footer");
+                return LOZ_ERROR;
         }
-        else {
-                MYLOG_ERROR("unsupported rwmode=\"%s\"", rwmode);
-                goto exit_fail;
+        if( memcmp(footer + 12, LOZ_FOOTER_FMT, LOZ_FOOTER_FMT_SIZE) != 0 ) {
+                MYLOG_DEBUG("there is no footer at the end of file");
+                return LOZ_EOF;
         }
-        
-        if(lozfile->fd==NULL)
-                goto exit_fail;
+        crc = crc8_array( footer, LOZ_FOOTER_SIZE - LOZ_CRC_SIZE, CRC8_INIT );
+        if(crc==0x00)
+                crc = 0x01; //CRC could not be 0x00, replace this with 0x01
+        if(crc != footer[LOZ_FOOTER_SIZE - LOZ_CRC_SIZE]) {
+                MYLOG_WARNING("invalid footer crc: %02X(readed), %02X(calculated)", footer[LOZ_FOOTER_SIZE - LOZ_CRC_SIZE], crc);
+                return LOZ_EOF;
+        }
+        pos     = get_uint64( footer );
+        entries = get_uint32( footer + 8 );
+        size64  = LOZ_INDEXMARKER_SIZE + (int64_t)entries * LOZ_INDEXENTRY_SIZE + LOZ_CRC_SIZE;
+        if( (entries < 0) ||
+            (size64 + LOZ_FOOTER_SIZE > LOZ_INDEXBLOCK_MAX) ||
+            (size64 + LOZ_FOOTER_SIZE > filesize) ||
+            (pos < LOZ_FILEHEADER_SIZE(lozfile)) ||
+            (pos + size64 + LOZ_FOOTER_SIZE != (uint64_t)filesize) )
+        {
+                MYLOG_WARNING("footer does not match filesize: indexpos=%llu, entries=%d, filesize=%lld",
+                              (unsigned long long)pos, entries, (long long)filesize);
+                return LOZ_EOF;
+        }
+        size = (int)size64;
 
-        lozfile->fid = fileno( lozfile->fd );
-        if(lozfile->fid == -1)
+        //Read and check index-block
+        buf = malloc( size );
+        if(buf==NULL) {
+                MYLOG_ERROR("could not allocate %d bytes for index-block", size);
+                return LOZ_ERROR;
+        }
+        err = loz_file_read( lozfile, (off_t)pos, buf, size );
+        if(err != size) {
+                MYLOG_ERROR("could not read index-block");
                 goto exit_fail;
+        }
+        if( memcmp(buf, LOZ_INDEXMARKER, LOZ_INDEXMARKER_SIZE) != 0 ) {
+                MYLOG_WARNING("invalid index-block marker: %02X,%02X", buf[0], buf[1]);
+                free(buf);
+                return LOZ_EOF;
+        }
+        crc = crc8_array( buf + LOZ_INDEXMARKER_SIZE, size - LOZ_INDEXMARKER_SIZE - LOZ_CRC_SIZE, CRC8_INIT );
+        if(crc==0x00)
+                crc = 0x01; //CRC could not be 0x00, replace this with 0x01
+        if(crc != buf[size - LOZ_CRC_SIZE]) {
+                MYLOG_WARNING("invalid index-block crc: %02X(readed), %02X(calculated)", buf[size - LOZ_CRC_SIZE], crc);
+                free(buf);
+                return LOZ_EOF;
+        }
+
+        //Fill index: entries must be sorted and must end at index-block
+        loz_index_reset( lozfile );
+
+        fpos_end   = LOZ_FILEHEADER_SIZE(lozfile);
+        rawpos_end = 0;
+        p = buf + LOZ_INDEXMARKER_SIZE;
+        for(i=0; i<entries; i++) {
+                rawpos           = get_uint64( p +  0 );
+                fpos             = get_uint64( p +  8 );
+                section.rawsize  = get_uint32( p + 16 );
+                section.compsize = get_uint32( p + 20 );
+                p += LOZ_INDEXENTRY_SIZE;
+
+                if( (rawpos < rawpos_end) ||
+                    (rawpos + section.rawsize > LOZ_RAWPOS_END_MAX(lozfile)) ||
+                    (fpos < fpos_end) )
+                {
+                        MYLOG_WARNING("index entry %d is invalid", i);
+                        loz_index_reset( lozfile );
+                        free(buf);
+                        return LOZ_EOF;
+                }
+                section.rawpos = rawpos;
+                section.fpos   = (off_t)fpos;
+                err = loz_index_add( lozfile, &section );
+                if(err) {
+                        MYLOG_ERROR("loz_index_add() failed");
+                        loz_index_reset( lozfile );
+                        goto exit_fail;
+                }
 
-        //allocate read/write buffers
-        lozfile->buffsize = buffsize;
-        lozfile->lzbuffsize = 2 * buffsize;
-        lozfile->strbuffsize = LOZ_STRLEN_MAX;
+                fpos_end   = fpos + LOZ_SECTIONHEADER_SIZE(lozfile) + section.compsize + LOZ_DATACRC_SIZE(lozfile);
+                rawpos_end = rawpos + section.rawsize;
+        }
+        if(fpos_end != pos) {
+                MYLOG_WARNING("index does not match data-sections: last section ends at %llu, index-block at %llu",
+                              (unsigned long long)fpos_end, (unsigned long long)pos);
+                loz_index_reset( lozfile );
+                free(buf);
+                return LOZ_EOF;
+        }
 
-        lozfile->rdbuff = malloc( lozfile->buffsize );
-        if(lozfile->rdbuff==NULL)
-                goto exit_fail;
-        
-        lozfile->wrbuff = malloc( lozfile->buffsize );
-        if(lozfile->wrbuff==NULL)
-                goto exit_fail;
+        lozfile->index_valid = 1;
+        *indexpos = (off_t)pos;
+        free(buf);
+        MYLOG_DEBUG("section index has been readed: %d sections (%u bytes)", entries, lozfile->index_data_n);
+        return LOZ_OK;
 
-        lozfile->lzbuff = malloc( lozfile->lzbuffsize );
-        if(lozfile->lzbuff==NULL)
-                goto exit_fail;
+exit_fail:
+        free(buf);
+        return LOZ_ERROR;
+}
 
-        lozfile->strbuff = malloc( lozfile->strbuffsize );
-        if(lozfile->strbuff==NULL)
-                goto exit_fail;
+//------------------------------------------------------------------------------
+//Write section index to the end of file (LOZ_VERSION_1): index-block and
+//footer are written at lozfile->wr_fpos, file is truncated after footer
+//returns: LOZ_OK    = ok
+//         LOZ_ERROR = error
+int loz_write_index( lozfile_t * lozfile )
+{
+        int               err;
+        uint8_t         * buf;
+        uint8_t         * p;
+        uint8_t           crc;
+        int64_t           size64;
+        int               size;
+        lozfile_index_cursor_t cursor;
 
-        //Check/create opened file
-        
-        //read & check LZ-file header
-        if( lozfile->rwmode != LOZ_READWRITE_CLEAR )
+        MYLOG_TRACE("@(lozfile=%p)", lozfile);
+
+        //Check input arguments
+        if(lozfile==NULL) {
+                MYLOG_ERROR("invalid argument lozfile=NULL");
+                return LOZ_ERROR;
+        }
+        if(lozfile->fd==NULL) {
+                MYLOG_ERROR("lozfile is not opened yet");
+                return LOZ_ERROR;
+        }
+        if(!lozfile->index_valid) {
+                MYLOG_ERROR("section index is not valid");
+                return LOZ_ERROR;
+        }
+
+        size64 = LOZ_INDEXMARKER_SIZE + (int64_t)lozfile->index_n * LOZ_INDEXENTRY_SIZE + LOZ_CRC_SIZE + LOZ_FOOTER_SIZE;
+        if(size64 > LOZ_INDEXBLOCK_MAX) {
+                MYLOG_ERROR("index-block is too big: %d sections", lozfile->index_n);
+                return LOZ_ERROR;
+        }
+        size = (int)size64;
+        buf = malloc( size );
+        if(buf==NULL) {
+                MYLOG_ERROR("could not allocate %d bytes for index-block", size);
+                return LOZ_ERROR;
+        }
+
+        //index-block
+        p = buf;
+        memcpy( p, LOZ_INDEXMARKER, LOZ_INDEXMARKER_SIZE );
+        p += LOZ_INDEXMARKER_SIZE;
+        err = loz_index_seek( lozfile, 0, &cursor );
+        while(err == LOZ_OK) {
+                put_uint64( p +  0, cursor.entry.rawpos   );
+                put_uint64( p +  8, cursor.entry.fpos     );
+                put_uint32( p + 16, cursor.entry.rawsize  );
+                put_uint32( p + 20, cursor.entry.compsize );
+                p += LOZ_INDEXENTRY_SIZE;
+                err = loz_index_next( lozfile, &cursor );
+        }
+        crc = crc8_array( buf + LOZ_INDEXMARKER_SIZE, p - buf - LOZ_INDEXMARKER_SIZE, CRC8_INIT );
+        if(crc==0x00)
+                crc = 0x01; //CRC could not be 0x00, replace this with 0x01
+        *p++ = crc;
+
+        //footer
+        put_uint64( p + 0, lozfile->wr_fpos );
+        put_uint32( p + 8, lozfile->index_n );
+        memcpy( p + 12, LOZ_FOOTER_FMT, LOZ_FOOTER_FMT_SIZE );
+        crc = crc8_array( p, LOZ_FOOTER_SIZE - LOZ_CRC_SIZE, CRC8_INIT );
+        if(crc==0x00)
+                crc = 0x01; //CRC could not be 0x00, replace this with 0x01
+        p[LOZ_FOOTER_SIZE - LOZ_CRC_SIZE] = crc;
+
+        //write index-block and footer after the last data-section
+        err = loz_file_write( lozfile, lozfile->wr_fpos, buf, size );
+        free(buf);
+        if(err) {
+                MYLOG_ERROR("could not write index-block");
+                return LOZ_ERROR;
+        }
+        err = ftruncate( lozfile->fid, lozfile->wr_fpos + size );
+        if(err) {
+                MYLOG_ERROR("ftruncate(%lld) failed: err=%d: %s", (long long)(lozfile->wr_fpos + size), errno, strerror(errno) );
+                return LOZ_ERROR;
+        }
+
+        MYLOG_DEBUG("section index has been written: %d sections", lozfile->index_n);
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Get time for delays of LOZ_FLAG_ASYNC (CLOCK_MONOTONIC)
+//returns:  time, ms
+long int loz_time_ms( void )
+{
+        struct timespec ts;
+
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+//------------------------------------------------------------------------------
+//Compression thread: compress queued jobs in order of submission
+//inputs:   arg = pointer to lozfile
+void * loz_pool_worker( void * arg )
+{
+        lozfile_t      * lozfile = arg;
+        lozfile_pool_t * pool    = lozfile->pool;
+        lozfile_job_t  * job;
+        int              err;
+
+        pthread_mutex_lock( &pool->mutex );
+        while(1)
         {
-                err = loz_read_fileheader(lozfile);
-                switch(err)
-                {
-                case LOZ_ERROR:
-                        MYLOG_ERROR("Could not read file-header: loz_read_fileheader() failed with LOZ_ERROR");
-                        goto exit_fail;
-                
-                case LOZ_UNSUPPORTED:
-                        MYLOG_ERROR("Unsupported LZF version: loz_read_fileheader() failed with LOZ_UNSUPPORTED");
-                        goto exit_fail;
+                while( (pool->next == pool->head) && !pool->stop )
+                        pthread_cond_wait( &pool->cond_work, &pool->mutex );
+                if(pool->next == pool->head)
+                        break; //stopped, nothing to do
                 
-                case LOZ_EOF:
-                        MYLOG_ERROR("LZF file \"%s\" is empty", filename);
+                job = &pool->jobs[ pool->next % pool->njobs ];
+                pool->next++;
+                pthread_mutex_unlock( &pool->mutex );
+
+                err = loz_encode_section( lozfile, job );
+
+                pthread_mutex_lock( &pool->mutex );
+                job->error = err;
+                job->state = LOZ_JOB_DONE;
+                pthread_cond_broadcast( &pool->cond_done );
+        }
+        pthread_mutex_unlock( &pool->mutex );
+        return NULL;
+}
+
+//------------------------------------------------------------------------------
+//Writer thread of LOZ_FLAG_ASYNC: commit compressed jobs to file in order of
+//submission, submit data of wrbuff[] which is older than pool->flush_ms
+//inputs:   arg = pointer to lozfile
+void * loz_pool_writer( void * arg )
+{
+        lozfile_t       * lozfile = arg;
+        lozfile_pool_t  * pool    = lozfile->pool;
+        lozfile_job_t   * job;
+        struct timespec   ts;
+        long int          delay;
+        int               err;
+
+        pthread_mutex_lock( &pool->mutex );
+        while(!pool->stop)
+        {
+                //commit the oldest job if it is compressed
+                job = &pool->jobs[ pool->tail % pool->njobs ];
+                if( (pool->tail < pool->head) && (job->state == LOZ_JOB_DONE) ) {
+                        pthread_mutex_unlock( &pool->mutex );
+                        err = job->error;
+                        if(err)
+                                MYLOG_ERROR("could not compress section rawpos=%llu", (unsigned long long)job->section.rawpos);
+                        else if( (err = loz_commit_section( lozfile, job )) )
+                                MYLOG_ERROR("loz_commit_section() failed");
+                        pthread_mutex_lock( &pool->mutex );
+                        if(err)
+                                pool->error = 1;
+                        job->state = LOZ_JOB_FREE;
+                        pool->tail++;
+                        pthread_cond_broadcast( &pool->cond_done );
+                        continue;
+                }
+                pthread_mutex_unlock( &pool->mutex );
+
+                //submit aged data of wrbuff[] (it waits for free job if all of
+                //them are busy: next free one is committed by this thread).
+                //wr_mutex is locked by loz_write() of caller: try again soon.
+                delay = 1;
+                err   = LOZ_OK;
+                if( pthread_mutex_trylock( &pool->wr_mutex ) == 0 ) {
+                        err   = (loz_ring_drain( lozfile, 1 ) < 0);
+                        delay = pool->flush_ms;
+                        if(lozfile->wrbuff_pos > 0) {
+                                delay = pool->wr_time + pool->flush_ms - loz_time_ms();
+                                if( (delay <= 0) && (pool->head - pool->tail < pool->njobs) ) {
+                                        err   = (loz_flush_wrbuff_to_file( lozfile ) < 0);
+                                        delay = pool->flush_ms;
+                                }
+                                else if(delay <= 0) {
+                                        delay = pool->flush_ms; //all jobs are busy: wait for compressed one
+                                }
+                        }
+                        pthread_mutex_unlock( &pool->wr_mutex );
+                        //records of loz_append() are moved to wrbuff[] every half of flush_ms
+                        //(or when producer fills quarter of ring)
+                        if( __atomic_load_n( &pool->ring, __ATOMIC_ACQUIRE ) && (delay > pool->flush_ms / 2) )
+                                delay = (pool->flush_ms > 1) ? pool->flush_ms / 2 : 1;
+                }
+
+                pthread_mutex_lock( &pool->mutex );
+                if(err)
+                        pool->error = 1;
+                job = &pool->jobs[ pool->tail % pool->njobs ];
+                if( !pool->stop && !( (pool->tail < pool->head) && (job->state == LOZ_JOB_DONE) ) ) {
+                        //wait for compressed job or age of wrbuff[]
+                        clock_gettime( CLOCK_MONOTONIC, &ts );
+                        ts.tv_sec  += delay / 1000;
+                        ts.tv_nsec += (delay % 1000) * 1000000;
+                        if(ts.tv_nsec >= 1000000000) {
+                                ts.tv_sec++;
+                                ts.tv_nsec -= 1000000000;
+                        }
+                        pthread_cond_timedwait( &pool->cond_done, &pool->mutex, &ts );
+                }
+        }
+        pthread_mutex_unlock( &pool->mutex );
+        return NULL;
+}
+
+//------------------------------------------------------------------------------
+//Start pool of compression threads
+//inputs:   lozfile  = pointer to opened lozfile (buffers are allocated)
+//          nthreads = number of threads
+//          flush_ms = LOZ_FLAG_ASYNC: max delay of data in wrbuff[], ms (writer
+//                     thread is started), 0=jobs are committed by caller thread
+//          ring_size = LOZ_FLAG_ASYNC: size of loz_append() ring (rounded up to power of 2)
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = error
+int loz_pool_start( lozfile_t * lozfile, int nthreads, int flush_ms, int ring_size )
+{
+        lozfile_pool_t * pool;
+        pthread_condattr_t attr;
+        int              i;
+
+        MYLOG_TRACE("@(lozfile=%p,nthreads=%d,flush_ms=%d)", lozfile, nthreads, flush_ms);
+
+        pool = calloc( 1, sizeof(lozfile_pool_t) );
+        if(pool==NULL) {
+                MYLOG_ERROR("could not allocate memory for pool");
+                return LOZ_ERROR;
+        }
+        lozfile->pool = pool;
+
+        //two jobs per thread: one is compressed while other one is waiting for commit;
+        //writer thread holds one more while it is written, spare one takes burst of data
+        pool->njobs    = 2 * nthreads;
+        pool->flush_ms = flush_ms;
+        pool->ring_bits = 12;
+        while( (1 << pool->ring_bits) < ring_size )
+                pool->ring_bits++;
+        pool->ring_size = 1U << pool->ring_bits;
+        if(flush_ms)
+                pool->njobs += 2;
+        pool->jobs    = calloc( pool->njobs, sizeof(lozfile_job_t) );
+        pool->threads = calloc( nthreads, sizeof(pthread_t) );
+        if( (pool->jobs==NULL) || (pool->threads==NULL) ) {
+                MYLOG_ERROR("could not allocate memory for pool");
+                goto exit_fail;
+        }
+        //buffers of jobs are allocated by loz_pool_submit() on first use
+        for(i=0; i<pool->njobs; i++)
+                pool->jobs[i].state = LOZ_JOB_FREE;
+
+        pthread_mutex_init( &pool->mutex, NULL );
+        pthread_mutex_init( &pool->wr_mutex, NULL );
+        pthread_cond_init( &pool->cond_work, NULL );
+        pthread_condattr_init( &attr );
+        pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+        pthread_cond_init( &pool->cond_done, &attr );
+        pthread_condattr_destroy( &attr );
+
+        for(i=0; i<nthreads; i++) {
+                if( pthread_create( &pool->threads[i], NULL, loz_pool_worker, lozfile ) ) {
+                        MYLOG_ERROR("pthread_create() failed: err=%d: %s", errno, strerror(errno) );
                         goto exit_fail;
-                
-                case LOZ_OK:
-                        break;
-                
-                default:
-                        MYLOG_ERROR("loz_read_fileheader() return unexpected error: %d", err);
+                }
+                pool->nthreads++;
+        }
+        if(flush_ms) {
+                if( pthread_create( &pool->writer, NULL, loz_pool_writer, lozfile ) ) {
+                        MYLOG_ERROR("pthread_create() failed: err=%d: %s", errno, strerror(errno) );
                         goto exit_fail;
                 }
+                pool->writer_started = 1;
         }
+        MYLOG_DEBUG("compression pool started: %d threads, flush_ms=%d", nthreads, flush_ms);
+        return LOZ_OK;
+
+exit_fail:
+        loz_pool_stop( lozfile );
+        return LOZ_ERROR;
+}
+
+//------------------------------------------------------------------------------
+//Stop pool of compression threads and free it (jobs which are not committed are lost)
+//inputs:   lozfile = pointer to opened lozfile
+void loz_pool_stop( lozfile_t * lozfile )
+{
+        lozfile_pool_t * pool = lozfile->pool;
+        int              i;
+
+        MYLOG_TRACE("@(lozfile=%p)", lozfile);
+
+        if(pool==NULL)
+                return;
+
+        if( (pool->nthreads > 0) || pool->writer_started ) {
+                pthread_mutex_lock( &pool->mutex );
+                pool->stop = 1;
+                pthread_cond_broadcast( &pool->cond_work );
+                pthread_cond_broadcast( &pool->cond_done );
+                pthread_mutex_unlock( &pool->mutex );
+        }
+        for(i=0; i<pool->nthreads; i++)
+                pthread_join( pool->threads[i], NULL );
+        if(pool->writer_started)
+                pthread_join( pool->writer, NULL );
+        if(pool->threads) {
+                pthread_mutex_destroy( &pool->mutex );
+                pthread_mutex_destroy( &pool->wr_mutex );
+                pthread_cond_destroy( &pool->cond_work );
+                pthread_cond_destroy( &pool->cond_done );
+        }
+
+        if(pool->jobs) {
+                for(i=0; i<pool->njobs; i++) {
+                        free( pool->jobs[i].rawbuff );
+                        free( pool->jobs[i].lzbuff );
+                        free( pool->jobs[i].lzwork );
+                }
+                free( pool->jobs );
+        }
+        free( pool->ring );
+        free( pool->threads );
+        free( pool );
+        lozfile->pool = NULL;
+}
+
+//------------------------------------------------------------------------------
+//Commit compressed jobs to file in order of submission
+//inputs:   lozfile = pointer to opened lozfile
+//          wait    = 0: commit jobs which are already compressed
+//                    1: wait and commit all submitted jobs
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = error
+int loz_pool_commit( lozfile_t * lozfile, int wait )
+{
+        lozfile_pool_t * pool = lozfile->pool;
+        lozfile_job_t  * job;
+        int              done;
+        int              err;
+
+        while(pool->tail < pool->head)
+        {
+                job = &pool->jobs[ pool->tail % pool->njobs ];
+                
+                pthread_mutex_lock( &pool->mutex );
+                while( wait && (job->state != LOZ_JOB_DONE) )
+                        pthread_cond_wait( &pool->cond_done, &pool->mutex );
+                done = (job->state == LOZ_JOB_DONE);
+                pthread_mutex_unlock( &pool->mutex );
+                if(!done)
+                        return LOZ_OK; //oldest job is not compressed yet
+                
+                pool->tail++;
+                job->state = LOZ_JOB_FREE;
+                if(job->error) {
+                        MYLOG_ERROR("could not compress section rawpos=%llu", (unsigned long long)job->section.rawpos);
+                        return LOZ_ERROR;
+                }
+                err = loz_commit_section( lozfile, job );
+                if(err) {
+                        MYLOG_ERROR("loz_commit_section() failed");
+                        return LOZ_ERROR;
+                }
+        }
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Wait until writer thread commits all submitted jobs (LOZ_FLAG_ASYNC)
+//inputs:   lozfile = pointer to opened lozfile
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = writer thread could not write section
+int loz_pool_drain( lozfile_t * lozfile )
+{
+        lozfile_pool_t * pool = lozfile->pool;
+        int              err;
+
+        pthread_mutex_lock( &pool->mutex );
+        while( (pool->tail < pool->head) && !pool->error )
+                pthread_cond_wait( &pool->cond_done, &pool->mutex );
+        err = pool->error;
+        pthread_mutex_unlock( &pool->mutex );
+        return err ? LOZ_ERROR : LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Move records of loz_append() ring to wrbuff[] in order of reservation (up to
+//the first record which is not published yet), pool->wr_mutex is locked
+//inputs:   lozfile = pointer to opened lozfile
+//          writer  = 1: called by writer thread: it stops before record which
+//                    fills wrbuff[] if there is no free job (it must commit them)
+//returns:  n         = number of moved records
+//          LOZ_ERROR = error
+int loz_ring_drain( lozfile_t * lozfile, int writer )
+{
+        lozfile_pool_t * pool = lozfile->pool;
+        uint8_t        * ring;
+        uint64_t         pos;
+        uint64_t         header;
+        uint8_t        * data;
+        int              size;
+        int              n = 0;
+
+        ring = __atomic_load_n( &pool->ring, __ATOMIC_ACQUIRE );
+        if(ring==NULL)
+                return 0;
+
+        pos = pool->ring_release;
+        while(1)
+        {
+                data   = ring + (pos & (pool->ring_size - 1));
+                header = __atomic_load_n( (uint64_t*)data, __ATOMIC_ACQUIRE );
+                if( (header >> 32) != (uint32_t)((pos >> pool->ring_bits) + 1) )
+                        break; //record is not published yet (or ring is empty)
+                size = header & ~LOZ_RING_PAD & 0xFFFFFFFF;
+                if(header & LOZ_RING_PAD) {
+                        memset( data, 0, size );
+                        pos += size;
+                }
+                else {
+                        if( writer && (lozfile->wrbuff_pos + size >= lozfile->buffsize) &&
+                            (pool->head - pool->tail >= pool->njobs) )
+                                break;
+                        //records of writer thread could wait in ring for half of flush_ms
+                        if( loz_write_aged( lozfile, data + LOZ_RING_HEADER_SIZE, size,
+                                            writer ? pool->flush_ms / 2 : 0 ) != size ) {
+                                MYLOG_ERROR("could not write record of loz_append()");
+                                return LOZ_ERROR;
+                        }
+                        //consumed bytes are zeroed: stale record never looks published
+                        memset( data, 0, LOZ_RING_HEADER_SIZE + LOZ_RING_ALIGN(size) );
+                        pos += LOZ_RING_HEADER_SIZE + LOZ_RING_ALIGN(size);
+                        n++;
+                }
+                __atomic_store_n( &pool->ring_release, pos, __ATOMIC_RELEASE );
+        }
+        return n;
+}
+
+//------------------------------------------------------------------------------
+//Move all records of loz_append() reserved before the call to wrbuff[]
+//(pool->wr_mutex is locked): producers could be copying some of them yet
+//inputs:   lozfile = pointer to lozfile opened with LOZ_FLAG_ASYNC
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = error
+int loz_ring_sync( lozfile_t * lozfile )
+{
+        lozfile_pool_t * pool = lozfile->pool;
+        uint64_t         reserved;
+
+        reserved = __atomic_load_n( &pool->ring_reserve, __ATOMIC_ACQUIRE );
+        while( __atomic_load_n( &pool->ring_release, __ATOMIC_ACQUIRE ) < reserved ) {
+                if( loz_ring_drain( lozfile, 0 ) < 0 )
+                        return LOZ_ERROR;
+                if( __atomic_load_n( &pool->ring_release, __ATOMIC_ACQUIRE ) < reserved )
+                        sched_yield();
+        }
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Submit raw data to compression threads. Sections are written to file in order
+//of submission by loz_pool_commit().
+//inputs:   lozfile = pointer to opened lozfile
+//          rawpos  = position of data in uncompressed (raw) file
+//          rawdata = pointer to raw data: lozfile->wrbuff[] is swapped with
+//                    buffer of job, other data is copied
+//          rawsize = size of raw data (1..lozfile->buffsize)
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = error
+int loz_pool_submit( lozfile_t * lozfile, off_t rawpos, uint8_t * rawdata, int rawsize )
+{
+        lozfile_pool_t * pool = lozfile->pool;
+        lozfile_job_t  * job;
+        uint8_t        * p;
+        int              err;
+
+        if(pool->flush_ms) {
+                //wait for free job: the oldest one is committed by writer thread
+                pthread_mutex_lock( &pool->mutex );
+                while( (pool->head - pool->tail >= pool->njobs) && !pool->error )
+                        pthread_cond_wait( &pool->cond_done, &pool->mutex );
+                err = pool->error;
+                pthread_mutex_unlock( &pool->mutex );
+                if(err) {
+                        MYLOG_ERROR("writer thread could not write section");
+                        return LOZ_ERROR;
+                }
+        }
+        else {
+                //wait for free job: commit the oldest one
+                if(pool->head - pool->tail >= pool->njobs) {
+                        job = &pool->jobs[ pool->tail % pool->njobs ];
+                        pthread_mutex_lock( &pool->mutex );
+                        while(job->state != LOZ_JOB_DONE)
+                                pthread_cond_wait( &pool->cond_done, &pool->mutex );
+                        pthread_mutex_unlock( &pool->mutex );
+                }
+                err = loz_pool_commit( lozfile, 0 );
+                if(err)
+                        return LOZ_ERROR;
+        }
+
+        job = &pool->jobs[ pool->head % pool->njobs ];
+        if(job->lzbuff==NULL) {
+                job->lzbuff = malloc( LOZ_LZBUFF_SIZE( lozfile, lozfile->buffsize ) );
+                if(job->lzbuff==NULL) {
+                        MYLOG_ERROR("could not allocate memory for pool job");
+                        return LOZ_ERROR;
+                }
+        }
+        if( (job->lzwork==NULL) &&
+            ( (lozfile->compression == LOZ_COMPRESSION_LZ) ||
+              (lozfile->compression == LOZ_COMPRESSION_AUTO) ) ) {
+                job->lzwork = malloc( LOZ_LZWORK_SIZE(lozfile->buffsize) );
+                if(job->lzwork==NULL) {
+                        MYLOG_ERROR("could not allocate memory for pool job");
+                        return LOZ_ERROR;
+                }
+        }
+        if(job->rawbuff==NULL) {
+                job->rawbuff = malloc( lozfile->buffsize );
+                if(job->rawbuff==NULL) {
+                        MYLOG_ERROR("could not allocate memory for pool job");
+                        return LOZ_ERROR;
+                }
+        }
+        if(rawdata == lozfile->wrbuff) {
+                p                = job->rawbuff;
+                job->rawbuff     = lozfile->wrbuff;
+                lozfile->wrbuff  = p;
+        }
+        else {
+                memcpy( job->rawbuff, rawdata, rawsize );
+        }
+        job->rawdata         = job->rawbuff;
+        job->section.rawpos  = rawpos;
+        job->section.rawsize = rawsize;
+        job->error           = LOZ_OK;
+
+        pthread_mutex_lock( &pool->mutex );
+        job->state = LOZ_JOB_QUEUED;
+        pool->head++;
+        pthread_cond_signal( &pool->cond_work );
+        pthread_mutex_unlock( &pool->mutex );
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Compress raw data and write it to file as new section
+//inputs:   lozfile = pointer to opened lozfile
+//          rawpos  = position of data in uncompressed (raw) file
+//          rawdata = pointer to raw data (lozfile->wrbuff[] or caller buffer)
+//          rawsize = size of raw data (1..lozfile->buffsize)
+//returns:  written = number of bytes successfully written to file
+//          LOZ_ERROR = error
+int loz_write_section( lozfile_t * lozfile, off_t rawpos, uint8_t * rawdata, int rawsize )
+{
+        int              err;
+        lozfile_job_t    job;
+
+        MYLOG_TRACE("@(lozfile=%p,rawpos=%lld,rawdata=%p,rawsize=%d)", lozfile, (long long)rawpos, rawdata, rawsize);
+
+        //Check input arguments
+        if(lozfile==NULL) {
+                MYLOG_ERROR("invalid argument lozfile=NULL");
+                return LOZ_ERROR;
+        }
+        if(lozfile->fd==NULL) {
+                MYLOG_ERROR("lozfile is not opened yet");
+                return LOZ_ERROR;
+        }
+        if(rawdata==NULL) {
+                MYLOG_ERROR("invalid argument rawdata=NULL");
+                return LOZ_ERROR;
+        }
+        if( (rawsize <= 0) || (rawsize > lozfile->buffsize) ) {
+                MYLOG_ERROR("invalid argument rawsize=%d", rawsize);
+                return LOZ_ERROR;
+        }
+        if( (uint64_t)rawpos + rawsize > LOZ_RAWPOS_END_MAX(lozfile) ) {
+                MYLOG_ERROR("rawpos=%lld is beyond the max size of data of LOZ-file version %d",
+                            (long long)rawpos + rawsize, lozfile->version);
+                return LOZ_ERROR;
+        }
+
+        //compress section by worker threads
+        if(lozfile->pool) {
+                err = loz_pool_submit( lozfile, rawpos, rawdata, rawsize );
+                if(err) {
+                        MYLOG_ERROR("loz_pool_submit() failed");
+                        return LOZ_ERROR;
+                }
+                return rawsize;
+        }
+        
+        //buffer for compressed data is allocated by the first section
+        err = loz_buff_reserve( &lozfile->lzbuff, &lozfile->lzbuffsize, LOZ_LZBUFF_SIZE( lozfile, lozfile->buffsize ) );
+        if(err) {
+                MYLOG_ERROR("could not allocate memory for lzbuff");
+                return LOZ_ERROR;
+        }
+
+        //LZ match finder work area is kept across sections
+        if( ( (lozfile->compression == LOZ_COMPRESSION_LZ) ||
+              (lozfile->compression == LOZ_COMPRESSION_AUTO) ) &&
+            (lozfile->lzwork == NULL) ) {
+                lozfile->lzwork = malloc( LOZ_LZWORK_SIZE(lozfile->buffsize) );
+                if(lozfile->lzwork==NULL) {
+                        MYLOG_ERROR("could not allocate memory for lzwork");
+                        return LOZ_ERROR;
+                }
+        }
+
+        //compress rawdata[] into lzbuff[] and write section to file
+        job.rawdata          = rawdata;
+        job.lzbuff           = lozfile->lzbuff;
+        job.lzwork           = lozfile->lzwork;
+        job.section.rawpos   = rawpos;
+        job.section.rawsize  = rawsize;
+        
+        err = loz_encode_section( lozfile, &job );
+        if(err) {
+                MYLOG_ERROR("loz_encode_section() failed");
+                return LOZ_ERROR;
+        }
+        
+        err = loz_commit_section( lozfile, &job );
+        if(err) {
+                MYLOG_ERROR("loz_commit_section() failed");
+                return LOZ_ERROR;
+        }
+    
+        return rawsize;
+}
+
+//------------------------------------------------------------------------------
+//Write available data from lozfile->wrbuff[] to file
+//inputs:   lozfile = pointer to opened lozfile
+//returns:  written = number of bytes successfully written to file
+//          LOZ_ERROR = error
+int loz_flush_wrbuff_to_file( lozfile_t * lozfile )
+{
+        int              err;
+
+        MYLOG_TRACE("@(lozfile=%p)", lozfile);
+
+        //Check input arguments
+        if(lozfile==NULL) {
+                MYLOG_ERROR("invalid argument lozfile=NULL");
+                return LOZ_ERROR;
+        }
+        if(lozfile->wrbuff==NULL) {
+                MYLOG_DEBUG("There is no lozfile->wrbuff[] yet - nothing written to file");
+                return 0;
+        }
+
+        if(lozfile->wrbuff_pos == 0) {
+                MYLOG_DEBUG("There is no data in lozfile->wrbuff[] - nothing written to file");
+                return 0;
+        }
+
+        err = loz_write_section( lozfile,
+                                 lozfile->wr_rawpos - lozfile->wrbuff_pos,
+                                 lozfile->wrbuff,
+                                 lozfile->wrbuff_pos );
+        if(err != lozfile->wrbuff_pos) {
+                MYLOG_ERROR("loz_write_section() failed");
+                return LOZ_ERROR;
+        }
+
+        lozfile->wrbuff_pos = 0;
+        return err;
+}
+
+//------------------------------------------------------------------------------
+//Read section from lozfile->rd_fpos: header to *section, compressed data to lozfile->lzbuff[]
+//(lozfile->lzdata points to it or to mapping of file).
+//Invalid header is repaired from the next valid section-> On success lozfile->rd_fpos
+//is moved to the next section->
+//inputs:   lozfile = pointer to opened lozfile
+//outputs:  section = header of readed section (rawsize/compsize are repaired)
+//returns:  LOZ_OK      = ok, section->compsize bytes are available in lozfile->lzdata[]
+//          LOZ_BAD_CRC = section data is lost, section->rawsize bytes must be filled by LOZ_FILLER
+//          LOZ_EOF     = no more data could be readed from file
+//          LOZ_ERROR   = error
+int loz_load_section( lozfile_t * lozfile, lozfile_section_t * section )
+{
+        int                err;
+        lozfile_section_t  next;
+
+        MYLOG_DEBUG("lozfile->rd_rawpos=%lld", (long long)lozfile->rd_rawpos);
+
+        //read section header from file
+        err = loz_read_section_header( lozfile, section, lozfile->rd_fpos );
+        if(err==LOZ_ERROR) {
+                MYLOG_ERROR("loz_read_section_header() failed");
+                return LOZ_ERROR;
+        }
+        else if(err==LOZ_EOF) {
+                MYLOG_ERROR("loz_read_section_header() return End Of File");
+                return LOZ_EOF;
+        }
+        else if(err==LOZ_BAD_CRC) {
+                MYLOG_DEBUG("loz_read_section_header() return Bad CRC. Try to repair it!");
+                //go-go-go
+        }
+        
+        MYLOG_DEBUG("section.fpos           =%lld", (long long)section->fpos);
+        MYLOG_DEBUG("section.header_is_valid=%d",  section->header_is_valid);
+        MYLOG_DEBUG("section.rawpos         =%llu", (unsigned long long)section->rawpos);
+        MYLOG_DEBUG("section.rawpos_end     =%llu", (unsigned long long)section->rawpos_end);
+        MYLOG_DEBUG("section.rawsize        =%d",  section->rawsize);
+        MYLOG_DEBUG("section.compsize       =%d",  section->compsize);
+        MYLOG_DEBUG("section.codec          =%s",  compression_to_str(section->codec) );
+        
+        if(!section->header_is_valid)
+        {
+                //1.try to search for the next section,
+                //2.calculate rawsize/compsize of current (invalid) section
+                
+                err = loz_section_next ( lozfile, section, &next );
+                if(err==LOZ_ERROR) {
+                        MYLOG_ERROR("Current section is invalid, could not get next section");
+                        return LOZ_EOF;
+                }
+                else if(err==LOZ_EOF) {
+                        MYLOG_ERROR("Current section is invalid and last: could not get next section");
+                        return LOZ_EOF;
+                }
+                else if(err==LOZ_BAD_CRC) {
+                        MYLOG_ERROR("Current section is invalid, next section is invalid");
+                        return LOZ_EOF;
+                }
+                
+                MYLOG_DEBUG("try to repair section.rawsize: next.rawpos=%lld, lozfile->rd_rawpos=%lld",
+                            (long long)next.rawpos, (long long)lozfile->rd_rawpos);
+                
+                if(next.rawpos - lozfile->rd_rawpos > LOZ_BLOCKSIZE_MAX) {
+                        MYLOG_ERROR("Too big value of repaired section.rawsize=%lld > LOZ_BLOCKSIZE_MAX=%d",
+                                    (long long)(next.rawpos - lozfile->rd_rawpos), LOZ_BLOCKSIZE_MAX);
+                        return LOZ_EOF;
+                }
+                section->rawsize = next.rawpos - lozfile->rd_rawpos;
+                
+                section->compsize = next.fpos - section->fpos - LOZ_SECTIONHEADER_SIZE(lozfile) - LOZ_DATACRC_SIZE(lozfile);
+
+                //codec byte is corrupted: stored section has compsize==rawsize,
+                //compressed one usually has the same codec as neighbour sections
+                if(section->codec > LOZ_COMPRESSION_MAX)
+                        section->codec = (section->compsize == section->rawsize) ? LOZ_COMPRESSION_NONE : next.codec;
+        }
+
+        //read compressed data to lzbuff[] (it grows to the largest section,
+        //compressed data of mapped file is used in place)
+        if( (section->compsize > LOZ_COMPSIZE_MAX(lozfile)) ||
+            ( (lozfile->map==NULL) &&
+              loz_buff_reserve( &lozfile->lzbuff, &lozfile->lzbuffsize,
+                                LOZ_MAX( (int)section->compsize, LOZ_LZBUFF_SIZE( lozfile, lozfile->buffsize ) ) ) ) ) {
+                MYLOG_WARNING("section.compsize=%u does not fit lzbuff: section data is lost", section->compsize);
+                err = LOZ_BAD_CRC;
+        }
+        else {
+                lozfile->lzdata = lozfile->lzbuff;
+                err = loz_read_compdata( lozfile,
+                                        section->fpos + LOZ_SECTIONHEADER_SIZE(lozfile),
+                                        &lozfile->lzdata,
+                                        section->compsize );
+        }
+        if(err==LOZ_ERROR) {
+                MYLOG_ERROR("loz_read_compdata() failed with LOZ_ERROR");
+                return LOZ_ERROR;
+        }
+        else if(err==LOZ_EOF) {
+                MYLOG_WARNING("loz_read_compdata() failed with LOZ_EOF");
+                return LOZ_EOF;
+        }
+        else if( (err!=LOZ_OK) && (err!=LOZ_BAD_CRC) ) {
+                MYLOG_ERROR("Unexpected error of loz_read_compdata(): %d", err);
+                return LOZ_ERROR;
+        }
+        
+        lozfile->rd_fpos = section->fpos + LOZ_SECTIONHEADER_SIZE(lozfile) + section->compsize + LOZ_DATACRC_SIZE(lozfile);
+        return err;
+}
+
+//------------------------------------------------------------------------------
+//Uncompress section data loaded by loz_load_section() from lozfile->lzdata[] to outbuff[]
+//inputs:   lozfile = pointer to opened lozfile
+//          section = section header returned by loz_load_section()
+//          loaded  = return code of loz_load_section(): LOZ_OK or LOZ_BAD_CRC
+//          outbuff = destination buffer (lozfile->rdbuff[] or caller buffer)
+//          outsize = size of outbuff[], must be >= section->rawsize
+//returns:  decompsize = number of bytes written to outbuff[]
+//          LOZ_ERROR  = error
+int loz_decode_section( lozfile_t * lozfile, lozfile_section_t * section, int loaded, uint8_t * outbuff, int outsize )
+{
+        int                err;
+        int                decompsize;
+
+        if(section->rawsize > outsize) {
+                MYLOG_ERROR("section.rawsize=%u does not fit outbuff[%d]", section->rawsize, outsize);
+                return LOZ_ERROR;
+        }
+
+        if(loaded==LOZ_BAD_CRC) {
+                //fill outbuff[] with LOZ_FILLER
+                memset(outbuff, LOZ_FILLER, section->rawsize);
+                return section->rawsize;
+        }
+
+        //uncompress data from lzdata[] to outbuff[]
+        err = loz_uncompress_data ( section->codec,
+                                   lozfile->lzdata,
+                                   section->compsize,
+                                   outbuff,
+                                   outsize,
+                                   &decompsize );
+        if( (err != LOZ_OK) && !section->header_is_valid ) {
+                //codec of repaired section is wrong: fill outbuff[] with LOZ_FILLER
+                MYLOG_WARNING("Could not uncompress repaired section: section data is lost");
+                memset(outbuff, LOZ_FILLER, section->rawsize);
+                return section->rawsize;
+        }
+        if(err != LOZ_OK) {
+                //corrupted data (not checked with LOZ_FLAG_NOVERIFY): fill outbuff[] with LOZ_FILLER
+                MYLOG_WARNING("Could not uncompress section-data: section data is lost");
+                memset(outbuff, LOZ_FILLER, section->rawsize);
+                return section->rawsize;
+        }
+        
+        if(decompsize != (int)section->rawsize) {
+                //short/long decode leaves stale bytes in outbuff[]: fill it with LOZ_FILLER
+                MYLOG_WARNING("decompsize=%d does not match section.rawsize=%u: section data is lost",
+                              decompsize, section->rawsize);
+                memset(outbuff, LOZ_FILLER, section->rawsize);
+                return section->rawsize;
+        }
+        return decompsize;
+}
+
+//------------------------------------------------------------------------------
+//Read section from lozfile->rd_fpos (from cache if it is there) and uncompress
+//its data to outbuff[] if whole section fits it, else to lozfile->rdbuff[].
+//On success lozfile->rd_fpos is moved to the next section.
+//inputs:   lozfile = pointer to opened lozfile
+//          outbuff = destination buffer (NULL=always use lozfile->rdbuff[])
+//          outsize = size of outbuff[]
+//returns:  n         = number of bytes written to outbuff[] (0=data is in
+//                      lozfile->rdbuff[], lozfile->rdbuff_n bytes)
+//          LOZ_EOF   = no more data could be readed from file
+//          LOZ_ERROR = error
+int loz_read_section( lozfile_t * lozfile, uint8_t * outbuff, int outsize )
+{
+        int                err;
+        int                n;
+        off_t              fpos;
+        uint8_t          * dest;
+        lozfile_section_t  section;
+
+        lozfile->rdbuff_pos = 0;
+        lozfile->rdbuff_n   = 0;
+
+        if(lozfile->cache) {
+                n = loz_cache_get( lozfile, outbuff, outsize );
+                if(n != LOZ_EOF)
+                        return n;
+        }
+
+        fpos = lozfile->rd_fpos;
+        err  = loz_load_section( lozfile, &section );
+        if( (err!=LOZ_OK) && (err!=LOZ_BAD_CRC) )
+                return err;
+
+        dest = outbuff;
+        if( (outbuff==NULL) || (section.rawsize > outsize) ) {
+                //rdbuff[] grows to the largest section
+                if( (section.rawsize > LOZ_BLOCKSIZE_MAX) ||
+                    loz_buff_reserve( &lozfile->rdbuff, &lozfile->rdbuffsize,
+                                      LOZ_MAX( (int)section.rawsize, lozfile->buffsize ) ) )
+                {
+                        //section is lost (as by loz_uncompress_section): rdbuff[] is filled by LOZ_FILLER
+                        if( loz_buff_reserve( &lozfile->rdbuff, &lozfile->rdbuffsize, lozfile->buffsize ) )
+                                return LOZ_ERROR;
+                        MYLOG_WARNING("section.rawsize=%u does not fit rdbuff: section data is lost", section.rawsize);
+                        n = (section.rawsize > (uint32_t)lozfile->rdbuffsize) ? lozfile->rdbuffsize : (int)section.rawsize;
+                        memset(lozfile->rdbuff, LOZ_FILLER, n);
+                        lozfile->rdbuff_n = n;
+                        return 0;
+                }
+                dest = lozfile->rdbuff;
+        }
+
+        n = loz_decode_section( lozfile, &section, err, dest, (dest == outbuff) ? outsize : lozfile->rdbuffsize );
+        if(n < 0)
+                return LOZ_ERROR;
+
+        //repaired and corrupted sections are not cached: they could be torn tail of file
+        if( lozfile->cache && (err == LOZ_OK) && section.header_is_valid )
+                loz_cache_put( lozfile, fpos, lozfile->rd_fpos, dest, n );
+
+        if(dest == outbuff)
+                return n;
+        lozfile->rdbuff_n = n;
+        return 0;
+}
+
+//------------------------------------------------------------------------------
+//Read section from lozfile->rd_fpos and uncompress its data to lozfile->rdbuff[]
+//inputs:   lozfile = pointer to opened lozfile
+//returns:  LOZ_OK    = ok, lozfile->rdbuff_n bytes are available in lozfile->rdbuff[]
+//          LOZ_EOF   = no more data could be readed from file
+//          LOZ_ERROR = error
+int loz_fill_rdbuff( lozfile_t * lozfile )
+{
+        int err;
+
+        err = loz_read_section( lozfile, NULL, 0 );
+        if(err < 0)
+                return err;
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Get slot of section in hash table of cache. Called with cache->mutex locked.
+//returns:  slot = pointer to link to entry of section (*slot==NULL: section is not cached)
+lozfile_cache_entry_t ** loz_cache_slot( lozfile_cache_t * cache, uint64_t dev, uint64_t ino, off_t fpos )
+{
+        uint64_t                 h;
+        lozfile_cache_entry_t ** slot;
+
+        h = ((uint64_t)fpos ^ (ino << 24) ^ (dev << 48)) * 0x9E3779B97F4A7C15ULL;
+        slot = &cache->buckets[ (h >> 32) & (cache->nbuckets - 1) ];
+        while( *slot && ( ((*slot)->fpos != fpos) || ((*slot)->ino != ino) || ((*slot)->dev != dev) ) )
+                slot = &(*slot)->hnext;
+        return slot;
+}
+
+//------------------------------------------------------------------------------
+//Remove entry from LRU list of cache. Called with cache->mutex locked.
+void loz_cache_lru_unlink( lozfile_cache_t * cache, lozfile_cache_entry_t * entry )
+{
+        if(entry->prev) entry->prev->next = entry->next;
+        else            cache->head       = entry->next;
+        if(entry->next) entry->next->prev = entry->prev;
+        else            cache->tail       = entry->prev;
+}
+
+//------------------------------------------------------------------------------
+//Add entry to the head (most recently used) of LRU list of cache.
+//Called with cache->mutex locked.
+void loz_cache_lru_push( lozfile_cache_t * cache, lozfile_cache_entry_t * entry )
+{
+        entry->prev = NULL;
+        entry->next = cache->head;
+        if(cache->head) cache->head->prev = entry;
+        else            cache->tail       = entry;
+        cache->head = entry;
+}
+
+//------------------------------------------------------------------------------
+//Remove entry from cache and free it. Called with cache->mutex locked.
+void loz_cache_remove( lozfile_cache_t * cache, lozfile_cache_entry_t * entry )
+{
+        lozfile_cache_entry_t ** slot;
+
+        slot = loz_cache_slot( cache, entry->dev, entry->ino, entry->fpos );
+        *slot = entry->hnext;
+        loz_cache_lru_unlink( cache, entry );
+        cache->stats.used -= LOZ_CACHE_ENTRY_SIZE( entry->rawsize );
+        cache->stats.sections--;
+        free( entry );
+}
+
+//------------------------------------------------------------------------------
+//Double hash table of cache. Called with cache->mutex locked.
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = error (cache is not changed)
+int loz_cache_grow( lozfile_cache_t * cache )
+{
+        lozfile_cache_entry_t ** old     = cache->buckets;
+        int                      nold    = cache->nbuckets;
+        lozfile_cache_entry_t  * entry;
+        lozfile_cache_entry_t  * next;
+        int                      i;
+
+        cache->buckets = calloc( 2 * nold, sizeof(lozfile_cache_entry_t *) );
+        if(cache->buckets==NULL) {
+                cache->buckets = old;
+                return LOZ_ERROR;
+        }
+        cache->nbuckets = 2 * nold;
+
+        for(i=0; i<nold; i++) {
+                for(entry = old[i]; entry; entry = next) {
+                        next         = entry->hnext;
+                        entry->hnext = NULL;
+                        *loz_cache_slot( cache, entry->dev, entry->ino, entry->fpos ) = entry;
+                }
+        }
+        free( old );
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Copy section at lozfile->rd_fpos from cache to outbuff[] if whole section
+//fits it, else to lozfile->rdbuff[] (as loz_read_section() does)
+//returns:  n       = number of bytes copied to outbuff[] (0=data is in lozfile->rdbuff[])
+//          LOZ_EOF = section is not cached
+int loz_cache_get( lozfile_t * lozfile, uint8_t * outbuff, int outsize )
+{
+        lozfile_cache_t       * cache = lozfile->cache;
+        lozfile_cache_entry_t * entry;
+        int                     n = LOZ_EOF;
+
+        pthread_mutex_lock( &cache->mutex );
+        entry = *loz_cache_slot( cache, lozfile->file_dev, lozfile->file_ino, lozfile->rd_fpos );
+        if( entry &&
+            ( (outbuff && (entry->rawsize <= outsize)) ||
+              (loz_buff_reserve( &lozfile->rdbuff, &lozfile->rdbuffsize,
+                                 LOZ_MAX( entry->rawsize, lozfile->buffsize ) ) == LOZ_OK) ) ) {
+                if( outbuff && (entry->rawsize <= outsize) ) {
+                        memcpy( outbuff, entry->data, entry->rawsize );
+                        n = entry->rawsize;
+                }
+                else {
+                        memcpy( lozfile->rdbuff, entry->data, entry->rawsize );
+                        lozfile->rdbuff_n = entry->rawsize;
+                        n = 0;
+                }
+                lozfile->rd_fpos = entry->next_fpos;
+                loz_cache_lru_unlink( cache, entry );
+                loz_cache_lru_push( cache, entry );
+                cache->stats.hits++;
+        }
+        else {
+                cache->stats.misses++;
+        }
+        pthread_mutex_unlock( &cache->mutex );
+        return n;
+}
+
+//------------------------------------------------------------------------------
+//Copy part of section at fpos from cache (see loz_pread())
+//inputs:   fpos   = begining of section in file
+//          offset = offset of data in section
+//          size   = max number of bytes to be copied to buf[]
+//returns:  n       = number of bytes copied to buf[] (0=offset is the end of section)
+//          LOZ_EOF = section is not cached
+int loz_cache_copy( lozfile_t * lozfile, off_t fpos, int offset, uint8_t * buf, int size )
+{
+        lozfile_cache_t       * cache = lozfile->cache;
+        lozfile_cache_entry_t * entry;
+        int                     n = LOZ_EOF;
+
+        pthread_mutex_lock( &cache->mutex );
+        entry = *loz_cache_slot( cache, lozfile->file_dev, lozfile->file_ino, fpos );
+        if( entry && (offset <= entry->rawsize) ) {
+                n = entry->rawsize - offset;
+                if(n > size)
+                        n = size;
+                memcpy( buf, entry->data + offset, n );
+                loz_cache_lru_unlink( cache, entry );
+                loz_cache_lru_push( cache, entry );
+                cache->stats.hits++;
+        }
+        else {
+                cache->stats.misses++;
+        }
+        pthread_mutex_unlock( &cache->mutex );
+        return n;
+}
+
+//------------------------------------------------------------------------------
+//Add uncompressed section to cache, the least recently used sections are
+//evicted to keep cache size. Section is not cached if memory is not available.
+//inputs:   lozfile   = pointer to opened lozfile
+//          fpos      = begining of section in file
+//          next_fpos = begining of the next section in file
+//          data      = uncompressed section data
+//          rawsize   = size of data[]
+void loz_cache_put( lozfile_t * lozfile, off_t fpos, off_t next_fpos, uint8_t * data, int rawsize )
+{
+        lozfile_cache_t        * cache = lozfile->cache;
+        lozfile_cache_entry_t ** slot;
+        lozfile_cache_entry_t  * entry;
+
+        if(LOZ_CACHE_ENTRY_SIZE(rawsize) > cache->stats.size)
+                return;
+
+        pthread_mutex_lock( &cache->mutex );
+        if( *loz_cache_slot( cache, lozfile->file_dev, lozfile->file_ino, fpos ) ) {
+                //section is cached by other handle or thread
+                pthread_mutex_unlock( &cache->mutex );
+                return;
+        }
+        while( cache->tail && (cache->stats.used + LOZ_CACHE_ENTRY_SIZE(rawsize) > cache->stats.size) ) {
+                loz_cache_remove( cache, cache->tail );
+                cache->stats.evictions++;
+        }
+        if(cache->stats.sections >= cache->nbuckets)
+                loz_cache_grow( cache ); //longer hash chains if memory is not available
+
+        //slot is taken after eviction: removed entry could hold link to it
+        slot  = loz_cache_slot( cache, lozfile->file_dev, lozfile->file_ino, fpos );
+        entry = malloc( LOZ_CACHE_ENTRY_SIZE(rawsize) );
+        if(entry==NULL) {
+                pthread_mutex_unlock( &cache->mutex );
+                return;
+        }
+        entry->hnext     = NULL;
+        entry->dev       = lozfile->file_dev;
+        entry->ino       = lozfile->file_ino;
+        entry->fpos      = fpos;
+        entry->next_fpos = next_fpos;
+        entry->rawsize   = rawsize;
+        memcpy( entry->data, data, rawsize );
+        *slot = entry;
+        loz_cache_lru_push( cache, entry );
+        cache->stats.used += LOZ_CACHE_ENTRY_SIZE(rawsize);
+        cache->stats.sections++;
+        pthread_mutex_unlock( &cache->mutex );
+}
+
+//------------------------------------------------------------------------------
+//Remove cached sections of file starting at fpos or after it (file is cleared
+//or its tail is going to be overwritten)
+void loz_cache_purge( lozfile_t * lozfile, off_t fpos )
+{
+        lozfile_cache_t       * cache = lozfile->cache;
+        lozfile_cache_entry_t * entry;
+        lozfile_cache_entry_t * next;
+
+        pthread_mutex_lock( &cache->mutex );
+        for(entry = cache->head; entry; entry = next) {
+                next = entry->next;
+                if( (entry->dev == lozfile->file_dev) &&
+                    (entry->ino == lozfile->file_ino) &&
+                    (entry->fpos >= fpos) )
+                        loz_cache_remove( cache, entry );
+        }
+        pthread_mutex_unlock( &cache->mutex );
+}
+
+//------------------------------------------------------------------------------
+//Read one section and uncompress its data to rawbuff[]. Section data is filled
+//by LOZ_FILLER if it is corrupted (as by loz_read()). Only pread() is used:
+//sections could be uncompressed in parallel.
+//inputs:   lozfile    = pointer to opened lozfile
+//          section    = section to be uncompressed (compsize/rawsize of corrupted section are repaired)
+//          lzbuff     = buffer for compressed data (NULL if file is mapped)
+//          lzbuffsize = size of lzbuff[]
+//          rawbuff    = buffer for uncompressed data
+//          rawsizemax = size of rawbuff[] (scratch->rawbuffsize or section->rawsize)
+//outputs:  valid      = 1: data is uncompressed from valid section, 0: data is LOZ_FILLER or repaired
+//returns:  decompsize = number of bytes written to rawbuff[]
+//          LOZ_ERROR  = error
+int loz_uncompress_section( lozfile_t * lozfile, lozfile_index_t * section, uint8_t * lzbuff, int lzbuffsize,
+                            uint8_t * rawbuff, int rawsizemax, int * valid )
+{
+        int                err;
+        int                decompsize;
+        uint8_t          * compdata;
+        lozfile_section_t  header;
+        lozfile_section_t  next;
+
+        *valid = 0;
+
+        //codec of section is in its header (LOZ_VERSION_2), index has no codec
+        header.codec           = lozfile->compression;
+        header.header_is_valid = 1;
+        if(lozfile->version >= LOZ_VERSION_2) {
+                err = loz_read_section_header( lozfile, &header, section->fpos );
+                if(err == LOZ_ERROR) {
+                        MYLOG_ERROR("could not read section-header at fpos=%lld", (long long)section->fpos);
+                        return LOZ_ERROR;
+                }
+                //codec byte is corrupted: stored section has compsize==rawsize,
+                //compressed one usually has the same codec as neighbour sections
+                if( (err != LOZ_OK) || (header.codec > LOZ_COMPRESSION_MAX) ) {
+                        header.header_is_valid = 0;
+                        err = loz_read_section_header( lozfile, &next, section->fpos + LOZ_SECTIONHEADER_SIZE(lozfile) +
+                                                                       section->compsize + LOZ_DATACRC_SIZE(lozfile) );
+                        if(header.codec > LOZ_COMPRESSION_MAX) {
+                                if(section->compsize == section->rawsize)
+                                        header.codec = LOZ_COMPRESSION_NONE;
+                                else if(err == LOZ_OK)
+                                        header.codec = next.codec;
+                        }
+                }
+        }
+
+        if( (section->compsize > 0) &&
+            (section->compsize <= (lozfile->map ? LOZ_COMPSIZE_MAX(lozfile) : lzbuffsize)) &&
+            (section->rawsize <= rawsizemax) &&
+            (header.codec <= LOZ_COMPRESSION_MAX) )
+        {
+                compdata = lzbuff;
+                err = loz_read_compdata( lozfile,
+                                        section->fpos + LOZ_SECTIONHEADER_SIZE(lozfile),
+                                        &compdata,
+                                        section->compsize );
+        }
+        else {
+                MYLOG_WARNING("section at fpos=%lld does not fit buffers: section data is lost", (long long)section->fpos);
+                err = LOZ_BAD_CRC;
+        }
+
+        if(err == LOZ_OK) {
+                //uncompress data from lzbuff[] (or mapping of file) to rawbuff[]
+                err = loz_uncompress_data ( header.codec,
+                                           compdata,
+                                           section->compsize,
+                                           rawbuff,
+                                           rawsizemax,
+                                           &decompsize );
+                if( (err != LOZ_OK) && !header.header_is_valid ) {
+                        MYLOG_WARNING("Could not uncompress repaired section at fpos=%lld: section data is lost", (long long)section->fpos);
+                        err = LOZ_BAD_CRC;
+                }
+                else if(err != LOZ_OK) {
+                        //corrupted data (not checked with LOZ_FLAG_NOVERIFY)
+                        MYLOG_WARNING("Could not uncompress section at fpos=%lld: section data is lost", (long long)section->fpos);
+                        err = LOZ_BAD_CRC;
+                }
+                else if(decompsize != (int)section->rawsize) {
+                        MYLOG_WARNING("decompsize=%d does not match rawsize=%u of section at fpos=%lld: section data is lost",
+                                      decompsize, section->rawsize, (long long)section->fpos);
+                        err = LOZ_BAD_CRC;
+                }
+                else {
+                        *valid = header.header_is_valid;
+                }
+        }
+        if( (err == LOZ_BAD_CRC) || (err == LOZ_EOF) ) {
+                //fill rawbuff[] with LOZ_FILLER
+                decompsize = section->rawsize;
+                if(decompsize > rawsizemax)
+                        decompsize = rawsizemax;
+                memset(rawbuff, LOZ_FILLER, decompsize);
+        }
+        else if(err != LOZ_OK) {
+                MYLOG_ERROR("loz_read_compdata() failed with error=%d", err);
+                return LOZ_ERROR;
+        }
+        return decompsize;
+}
+
+//------------------------------------------------------------------------------
+//Uncompress one section and write it to output file at section->rawpos.
+//Section data is filled by LOZ_FILLER if it is corrupted (as by loz_read()).
+//Only pread()/pwrite() are used: sections could be extracted in parallel.
+//inputs:   lozfile = pointer to opened lozfile
+//          section = section to be extracted (compsize/rawsize of corrupted section are repaired)
+//          scratch = buffers of extraction thread (grow to the section)
+//          fid     = output file
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = error
+int loz_extract_section( lozfile_t * lozfile, lozfile_index_t * section,
+                         lozfile_scratch_t * scratch, int fid )
+{
+        int                decompsize;
+        int                valid;
+        ssize_t            n;
+        int                written;
+        uint8_t          * rawbuff;
+
+        if( loz_scratch_reserve( lozfile, scratch, section ) != LOZ_OK ) {
+                MYLOG_ERROR("could not allocate memory for extraction buffers");
+                return LOZ_ERROR;
+        }
+        rawbuff    = scratch->rawbuff;
+        decompsize = loz_uncompress_section( lozfile, section, scratch->lzbuff, scratch->lzbuffsize,
+                                             rawbuff, scratch->rawbuffsize, &valid );
+        if(decompsize < 0)
+                return LOZ_ERROR;
+
+        //write data to output file at rawpos
+        written = 0;
+        while(written < decompsize) {
+                n = pwrite( fid, rawbuff + written, decompsize - written, (off_t)section->rawpos + written );
+                if(n < 0) {
+                        if(errno == EINTR)
+                                continue;
+                        MYLOG_ERROR("pwrite(%lld) failed: err=%d: %s", (long long)(section->rawpos + written), errno, strerror(errno) );
+                        return LOZ_ERROR;
+                }
+                written += n;
+        }
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Get next section to be extracted: valid section from index or corrupted
+//section before it (rawsize/compsize are repaired from the valid section).
+//Called with ext->mutex locked.
+//outputs:  section = section to be extracted
+//returns:  LOZ_OK  = ok
+//          LOZ_EOF = all sections are extracted
+int loz_extract_next( lozfile_extract_t * ext, lozfile_index_t * section )
+{
+        lozfile_t       * lozfile = ext->lozfile;
+        lozfile_index_t * e       = &ext->cursor.entry;
+
+        if(!ext->more)
+                return LOZ_EOF;
+
+        if(e->rawpos > ext->rawpos) {
+                //corrupted section: repair rawsize/compsize from the next valid section
+                section->fpos     = ext->fpos;
+                section->rawpos   = ext->rawpos;
+                section->rawsize  = e->rawpos - ext->rawpos;
+                if(e->rawpos - ext->rawpos > 0xFFFFFFFFULL)
+                        section->rawsize = 0xFFFFFFFF; //data is lost, only filler of buffsize is written
+                section->compsize = e->fpos - ext->fpos - LOZ_SECTIONHEADER_SIZE(lozfile) - LOZ_DATACRC_SIZE(lozfile);
+                if(e->fpos - ext->fpos < LOZ_SECTIONHEADER_SIZE(lozfile) + LOZ_DATACRC_SIZE(lozfile))
+                        section->compsize = 0;
+                ext->rawpos = e->rawpos;
+                return LOZ_OK;
+        }
+
+        *section    = *e;
+        ext->fpos   = e->fpos + LOZ_SECTIONHEADER_SIZE(lozfile) + e->compsize + LOZ_DATACRC_SIZE(lozfile);
+        ext->rawpos = e->rawpos + e->rawsize;
+        ext->more   = (loz_index_next( lozfile, &ext->cursor ) == LOZ_OK);
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Extraction thread: extract sections until all of them are done
+//inputs:   arg = pointer to lozfile_extract_t
+void * loz_extract_worker( void * arg )
+{
+        lozfile_extract_t * ext     = arg;
+        lozfile_t         * lozfile = ext->lozfile;
+        lozfile_scratch_t   scratch;
+        lozfile_index_t     section;
+        int                 err = LOZ_OK;
+
+        memset( &scratch, 0, sizeof(scratch) ); //buffers are allocated by the first section
+
+        while(!err)
+        {
+                pthread_mutex_lock( &ext->mutex );
+                if( ext->error || (loz_extract_next( ext, &section ) != LOZ_OK) ) {
+                        pthread_mutex_unlock( &ext->mutex );
+                        break;
+                }
+                pthread_mutex_unlock( &ext->mutex );
+
+                err = loz_extract_section( lozfile, &section, &scratch, ext->fid );
+        }
+
+        if(err) {
+                pthread_mutex_lock( &ext->mutex );
+                ext->error = 1;
+                pthread_mutex_unlock( &ext->mutex );
+        }
+        free( scratch.lzbuff );
+        free( scratch.rawbuff );
+        return NULL;
+}
+
+//------------------------------------------------------------------------------
+//Free thread-local buffers of loz_pread() (destructor of loz_scratch_key)
+void loz_scratch_free( void * arg )
+{
+        lozfile_scratch_t * scratch = arg;
+
+        free( scratch->lzbuff );
+        free( scratch->rawbuff );
+        free( scratch );
+}
+
+//------------------------------------------------------------------------------
+//Create key of thread-local buffers of loz_pread() (called once)
+void loz_scratch_init( void )
+{
+        pthread_key_create( &loz_scratch_key, loz_scratch_free );
+}
+
+//------------------------------------------------------------------------------
+//Grow read buffers to buffsize of lozfile and to the section (if it is not
+//bigger than LOZ_BLOCKSIZE_MAX, else data of section is lost anyway)
+//inputs:   lozfile = pointer to opened lozfile
+//          scratch = buffers to be grown
+//          section = section to be uncompressed, NULL=only buffsize
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = could not allocate memory
+int loz_scratch_reserve( lozfile_t * lozfile, lozfile_scratch_t * scratch, lozfile_index_t * section )
+{
+        int rawsize  = lozfile->buffsize;
+        int compsize = LOZ_LZBUFF_SIZE( lozfile, lozfile->buffsize );
+
+        if( section && (section->rawsize <= LOZ_BLOCKSIZE_MAX) )
+                rawsize = LOZ_MAX( rawsize, (int)section->rawsize );
+        if( section && (section->compsize <= LOZ_COMPSIZE_MAX(lozfile)) )
+                compsize = LOZ_MAX( compsize, (int)section->compsize );
+
+        //compressed data of mapped file is used in place
+        if( (lozfile->map==NULL) &&
+            loz_buff_reserve( &scratch->lzbuff, &scratch->lzbuffsize, compsize ) )
+                return LOZ_ERROR;
+        return loz_buff_reserve( &scratch->rawbuff, &scratch->rawbuffsize, rawsize );
+}
+
+//------------------------------------------------------------------------------
+//Get thread-local buffers of loz_pread() large enough for lozfile
+//returns:  scratch = buffers of calling thread
+//          NULL    = error
+lozfile_scratch_t * loz_scratch_get( lozfile_t * lozfile )
+{
+        lozfile_scratch_t * scratch;
+
+        pthread_once( &loz_scratch_once, loz_scratch_init );
+
+        scratch = pthread_getspecific( loz_scratch_key );
+        if(scratch==NULL) {
+                scratch = calloc( 1, sizeof(lozfile_scratch_t) );
+                if(scratch==NULL)
+                        return NULL;
+                if( pthread_setspecific( loz_scratch_key, scratch ) ) {
+                        free( scratch );
+                        return NULL;
+                }
+        }
+        if( loz_scratch_reserve( lozfile, scratch, NULL ) != LOZ_OK )
+                return NULL;
+        return scratch;
+}
+
+/******************************************************************************/
+/* FUNCTIONS                                                                  */
+/******************************************************************************/
+
+//------------------------------------------------------------------------------
+//Open lozfile. If file does not exist, it will be created.
+//
+//inputs:   filename    = name of logfile
+//          rwmode      = read/write mode:
+//                        "r"-read only
+//                        "r+"-read/write-update (create/update file, if file does not exist it will be created)
+//                        "w+"-read/write-clear (clear existing file, if file does not exist it will be created)
+//          buffsize    = size of read-write buffers (LOZ_BLOCKSIZE_MIN .. LOZ_BLOCKSIZE_MAX), -1=use default value
+//          compression = type of compression for new data to be written
+//
+//returns:  lozfile   = pointer to opened lz-file
+//          NULL     = error
+lozfile_t * loz_open ( const char * filename, char * rwmode, int buffsize, int compression )
+{
+        return loz_open_ex( filename, rwmode, buffsize, compression, NULL );
+}
+
+//------------------------------------------------------------------------------
+//Open lozfile with extended options. If file does not exist, it will be created.
+//
+//inputs:   filename, rwmode, buffsize, compression - see loz_open()
+//          opts        = extended options (see lozfile_opts_t), NULL=use default values
+//
+//returns:  lozfile   = pointer to opened lz-file
+//          NULL     = error
+lozfile_t * loz_open_ex ( const char * filename, char * rwmode, int buffsize, int compression, const lozfile_opts_t * opts )
+{
+        lozfile_t         * lozfile = NULL;
+        int                err;
+        int                exists;
+        lozfile_section_t   section;
+        off_t              indexpos;
+
+        MYLOG_TRACE("@(filename=%s,rwmode=%s,buffsize=%d,compression=%s,opts=%p)",
+                    filename, rwmode, buffsize, compression_to_str(compression), opts );
+
+        //Check input arguments
+        if(filename==NULL) {
+                MYLOG_ERROR("invalid argument: filename=NULL");
+                return NULL;
+        }
+        if(filename[0]=='\0') {
+                MYLOG_ERROR("invalid argument: filename=\"\"");
+                return NULL;
+        }
+        if(rwmode==NULL) {
+                MYLOG_ERROR("invalid argument: rwmode=NULL");
+                return NULL;
+        }
+        if( (buffsize < LOZ_BLOCKSIZE_MIN) ||
+            (buffsize > LOZ_BLOCKSIZE_MAX)  ) {
+                MYLOG_ERROR("invalid argument: buffsize=%d, must be %d..%d", buffsize, LOZ_BLOCKSIZE_MIN, LOZ_BLOCKSIZE_MAX );
+                return NULL;
+        }
+        if( opts && ( (opts->nthreads < 0) || (opts->nthreads > LOZ_THREADS_MAX) ) ) {
+                MYLOG_ERROR("invalid argument: opts->nthreads=%d, must be 0..%d", opts->nthreads, LOZ_THREADS_MAX );
+                return NULL;
+        }
+        if( opts && (opts->flush_ms < 0) ) {
+                MYLOG_ERROR("invalid argument: opts->flush_ms=%d", opts->flush_ms );
+                return NULL;
+        }
+        if( opts && ( (opts->append_size < 0) || (opts->append_size > LOZ_APPEND_SIZE_MAX) ) ) {
+                MYLOG_ERROR("invalid argument: opts->append_size=%d, must be 0..%d", opts->append_size, LOZ_APPEND_SIZE_MAX );
+                return NULL;
+        }
+        if( opts && ( (opts->auto_ratio < 0) || (opts->auto_ratio > 100) ) ) {
+                MYLOG_ERROR("invalid argument: opts->auto_ratio=%d, must be 0..100", opts->auto_ratio );
+                return NULL;
+        }
+        if( opts && opts->checksum &&
+            (opts->checksum != LOZ_CHECKSUM_CRC8) && (opts->checksum != LOZ_CHECKSUM_CRC32C) ) {
+                MYLOG_ERROR("unsupported opts->checksum=%d", opts->checksum );
+                return NULL;
+        }
+        if( opts && (opts->cache_size < 0) ) {
+                MYLOG_ERROR("invalid argument: opts->cache_size=%ld", opts->cache_size );
+                return NULL;
+        }
+
+        switch(compression)
+        {
+        case LOZ_COMPRESSION_NONE:   
+        case LOZ_COMPRESSION_RLE:    
+        case LOZ_COMPRESSION_RLE2:    
+        case LOZ_COMPRESSION_LZ:     
+        case LOZ_COMPRESSION_FASTLZ1:
+        case LOZ_COMPRESSION_FASTLZ2:
+        case LOZ_COMPRESSION_AUTO:
+                break;
+        default:
+                MYLOG_ERROR("unsupported compression=%d",compression);
+                return NULL;
+        }
+
+        //allocate memory
+        lozfile = malloc(sizeof(lozfile_t));
+        if(lozfile==NULL)
+                return NULL;
+
+        lozfile->version        = LOZ_VERSION_4; //for new files
+        lozfile->checksum       = (opts && opts->checksum) ? opts->checksum : LOZ_CHECKSUM_DEFAULT;
+        lozfile->compression    = compression;
+        lozfile->flags          = opts ? opts->flags : 0;
+        lozfile->auto_ratio     = (opts && opts->auto_ratio) ? opts->auto_ratio : LOZ_AUTO_RATIO_DEFAULT;
+        lozfile->filesize       = 0L;
+        lozfile->rwmode         = LOZ_READWRITE;
+        lozfile->fd             = NULL;
+        lozfile->fid            = -1;
+        lozfile->map            = NULL;
+        lozfile->mapsize        = 0;
+        lozfile->map_random     = 0;
+        lozfile->rd_fpos        = 0;
+        lozfile->wr_fpos        = 0;
+        lozfile->rd_rawpos      = 0;
+        lozfile->wr_rawpos      = 0;
+                           
+        lozfile->buffsize       = 0;
+        lozfile->rdbuffsize     = 0;
+        lozfile->lzbuffsize     = 0;
+        lozfile->strbuffsize    = 0;
+        lozfile->wrbuff         = NULL;
+        lozfile->rdbuff         = NULL;
+        lozfile->lzbuff         = NULL;
+        lozfile->lzdata         = NULL;
+        lozfile->strbuff        = NULL;
+        lozfile->scanbuff       = NULL;
+        lozfile->lzwork         = NULL;
+        lozfile->wrbuff_pos     = 0;
+        lozfile->rdbuff_pos     = 0;
+        lozfile->rdbuff_n       = 0;
+        lozfile->index_blocks   = NULL;
+        lozfile->index_blocks_size = 0;
+        lozfile->index_data     = NULL;
+        lozfile->index_data_size = 0;
+        lozfile->index_eytz     = NULL;
+        loz_index_reset( lozfile );
+        pthread_mutex_init( &lozfile->index_mutex, NULL );
+        lozfile->pool           = NULL;
+        memset( &lozfile->stats, 0, sizeof(lozfile->stats) );
+        lozfile->cache          = NULL;
+        lozfile->cache_own      = 0;
+        lozfile->file_dev       = 0;
+        lozfile->file_ino       = 0;
+
+        //check if file already exists
+        exists = file_exists(filename);
+        if(exists < 0) {
+                MYLOG_ERROR("file_exists() failed");
+                goto exit_fail;
+        }
+
+        //open file in defined rwmode
+        if(0==strcmp(rwmode,"r")) {
+                lozfile->rwmode = LOZ_READONLY;
+                if(!exists) {
+                        MYLOG_ERROR("file \"%s\" does not exist", filename);
+                        return NULL;
+                }
+                lozfile->fd = fopen( filename, "rb" ); //read only
+        }
+        else if(0==strcmp(rwmode,"r+")) {
+                lozfile->rwmode = LOZ_READWRITE;
+                lozfile->fd = fopen( filename, "r+b" ); //read/write/update
+        }
+        else if(0==strcmp(rwmode,"w+")) {
+                lozfile->rwmode = LOZ_READWRITE_CLEAR;
+                lozfile->fd = fopen( filename, "w+b" ); //read/write/clear
+        }
+        else {
+                MYLOG_ERROR("unsupported rwmode=\"%s\"", rwmode);
+                goto exit_fail;
+        }
+        
+        if(lozfile->fd==NULL)
+                goto exit_fail;
+
+        lozfile->fid = fileno( lozfile->fd );
+        if(lozfile->fid == -1)
+                goto exit_fail;
+
+        //map read-only file to memory
+        if( (lozfile->rwmode == LOZ_READONLY) && (lozfile->flags & LOZ_FLAG_MMAP) ) {
+                if( loz_map_open( lozfile ) != LOZ_OK )
+                        MYLOG_WARNING("file \"%s\" is not mapped, it is read by pread()", filename);
+        }
+
+        //attach cache of uncompressed sections
+        if( opts && (opts->cache || opts->cache_size) )
+        {
+                struct stat st;
+                if( fstat( lozfile->fid, &st ) ) {
+                        MYLOG_ERROR("fstat() failed: err=%d: %s", errno, strerror(errno) );
+                        goto exit_fail;
+                }
+                lozfile->file_dev = st.st_dev;
+                lozfile->file_ino = st.st_ino;
+                if(opts->cache) {
+                        lozfile->cache = opts->cache;
+                }
+                else {
+                        lozfile->cache = loz_cache_create( opts->cache_size );
+                        if(lozfile->cache==NULL) {
+                                MYLOG_ERROR("loz_cache_create() failed");
+                                goto exit_fail;
+                        }
+                        lozfile->cache_own = 1;
+                }
+        }
+
+        //read/write buffers are allocated on first use (up to LOZ_BLOCKSIZE_MAX each),
+        //strbuff is allocated by the first line of loz_printf() which spills wrbuff[]
+        lozfile->buffsize = buffsize;
+
+        //Check/create opened file
         
+        //read & check LZ-file header
+        if( lozfile->rwmode != LOZ_READWRITE_CLEAR )
+        {
+                err = loz_read_fileheader(lozfile);
+                switch(err)
+                {
+                case LOZ_ERROR:
+                        MYLOG_ERROR("Could not read file-header: loz_read_fileheader() failed with LOZ_ERROR");
+                        goto exit_fail;
+                
+                case LOZ_UNSUPPORTED:
+                        MYLOG_ERROR("Unsupported LZF version: loz_read_fileheader() failed with LOZ_UNSUPPORTED");
+                        goto exit_fail;
+                
+                case LOZ_EOF:
+                        MYLOG_ERROR("LZF file \"%s\" is empty", filename);
+                        goto exit_fail;
+                
+                case LOZ_OK:
+                        break;
+                
+                default:
+                        MYLOG_ERROR("loz_read_fileheader() return unexpected error: %d", err);
+                        goto exit_fail;
+                }
+        }
+
         switch(lozfile->rwmode)
         {
         case LOZ_READONLY:
                 //move rd_fpos into the begining of data (to the 1st file-section)
-                lozfile->rd_fpos   = LOZ_FILEHEADER_SIZE;
+                lozfile->rd_fpos   = LOZ_FILEHEADER_SIZE(lozfile);
                 lozfile->wr_fpos   = 0L; //will not be used in read-only mode
                 
                 lozfile->rd_rawpos = 0L;
                 lozfile->wr_rawpos = 0L; //will not be used in read-only mode
+
+                //load section index if file has it (else it will be built on first seek)
+                if(lozfile->version >= LOZ_VERSION_1) {
+                        err = loz_read_index( lozfile, &indexpos );
+                        if(err == LOZ_ERROR) {
+                                MYLOG_ERROR("loz_read_index() failed with LOZ_ERROR");
+                                goto exit_fail;
+                        }
+                }
                 break;
         
         case LOZ_READWRITE:
                 //move rdpos into the begining of data (to the 1st file-section)
-                lozfile->rd_fpos   = LOZ_FILEHEADER_SIZE;
+                lozfile->rd_fpos   = LOZ_FILEHEADER_SIZE(lozfile);
                 lozfile->rd_rawpos = 0L;
+
+                //get wrpos from section index at the end of file
+                if(lozfile->version >= LOZ_VERSION_1) {
+                        err = loz_read_index( lozfile, &indexpos );
+                        if(err == LOZ_ERROR) {
+                                MYLOG_ERROR("loz_read_index() failed with LOZ_ERROR");
+                                goto exit_fail;
+                        }
+                        if(err == LOZ_OK) {
+                                lozfile->wr_fpos   = indexpos;
+                                lozfile->wr_rawpos = 0L;
+                                if(lozfile->index_n > 0)
+                                        lozfile->wr_rawpos = lozfile->index_last.rawpos +
+                                                             lozfile->index_last.rawsize;
+                                break;
+                        }
+                }
                 
                 //move wrpos after last valid file-section
                 err = loz_section_last( lozfile, &section );
@@ -1471,7 +4236,7 @@ lozfile_t * loz_open ( const char * filename, char * rwmode, int buffsize, int c
                 
                 case LOZ_EOF:
                         MYLOG_DEBUG("lozfile is empty: loz_section_last() failed with LOZ_EOF");
-                        lozfile->wr_fpos   = LOZ_FILEHEADER_SIZE;
+                        lozfile->wr_fpos   = LOZ_FILEHEADER_SIZE(lozfile);
                         lozfile->wr_rawpos = 0L;
                         break;
                 
@@ -1479,115 +4244,968 @@ lozfile_t * loz_open ( const char * filename, char * rwmode, int buffsize, int c
                         MYLOG_DEBUG("lozfile is corrupted: loz_section_last() failed with LOZ_BAD_CRC");
                         goto exit_fail;
                 
-                case LOZ_OK:
-                        lozfile->wr_fpos   = section.fpos + LOZ_SECTIONHEADER_SIZE + section.compsize + LOZ_CRC_SIZE;
-                        lozfile->wr_rawpos = section.rawpos + section.rawsize;
+                case LOZ_OK:
+                        lozfile->wr_fpos   = section.fpos + LOZ_SECTIONHEADER_SIZE(lozfile) + section.compsize + LOZ_DATACRC_SIZE(lozfile);
+                        lozfile->wr_rawpos = section.rawpos + section.rawsize;
+                        break;
+                
+                default:
+                        MYLOG_ERROR("loz_section_last() failed with unexpected error=%d", err);
+                        goto exit_fail;
+                }
+                break;
+        
+        case LOZ_READWRITE_CLEAR:
+                //write LZ-file header into the file
+                err = loz_write_fileheader(lozfile);
+                if(err) {
+                        MYLOG_ERROR("could not write LZ-file header");
+                        goto exit_fail;
+                }
+                //move rd_fpos,wr_fpos into the begining of data (to the 1st file-section position)
+                lozfile->rd_fpos = LOZ_FILEHEADER_SIZE(lozfile); //skip file-header
+                lozfile->wr_fpos = LOZ_FILEHEADER_SIZE(lozfile); //skip file-header
+                lozfile->rd_rawpos = 0L;
+                lozfile->wr_rawpos = 0L;
+                //file is empty: index is valid, new sections will be added to it
+                lozfile->index_valid = 1;
+                break;
+        
+        default:
+                MYLOG_ERROR("unexpected value of rwmode: %d", lozfile->rwmode);
+                goto exit_fail;
+        }
+
+        //remove index-block (and torn tail) of file opened for update:
+        //new sections will be written here, index is written again on loz_close()
+        if( (lozfile->rwmode == LOZ_READWRITE) &&
+            (lozfile->version >= LOZ_VERSION_1) )
+        {
+                err = ftruncate( lozfile->fid, lozfile->wr_fpos );
+                if(err) {
+                        MYLOG_ERROR("ftruncate(%lld) failed: err=%d: %s", (long long)lozfile->wr_fpos, errno, strerror(errno) );
+                        goto exit_fail;
+                }
+        }
+
+        //cached sections after the end of data are going to be overwritten
+        if( lozfile->cache && (lozfile->rwmode != LOZ_READONLY) )
+                loz_cache_purge( lozfile, lozfile->wr_fpos );
+
+        //start compression threads (and writer thread of LOZ_FLAG_ASYNC)
+        if( opts && ( (opts->nthreads > 1) || (opts->flags & LOZ_FLAG_ASYNC) ) &&
+            (lozfile->rwmode != LOZ_READONLY) )
+        {
+                err = loz_pool_start( lozfile, (opts->nthreads > 1) ? opts->nthreads : 1,
+                                      (opts->flags & LOZ_FLAG_ASYNC) ?
+                                      (opts->flush_ms ? opts->flush_ms : LOZ_FLUSH_MS_DEFAULT) : 0,
+                                      opts->append_size ? opts->append_size : LOZ_APPEND_SIZE_DEFAULT );
+                if(err) {
+                        MYLOG_ERROR("loz_pool_start() failed");
+                        goto exit_fail;
+                }
+        }
+
+        return lozfile;
+
+exit_fail:
+        if(lozfile) {
+                //close file without flushing/writing index
+                if(lozfile->fd) {
+                        fclose(lozfile->fd);
+                        lozfile->fd = NULL;
+                }
+                loz_close( lozfile );
+        }
+        return NULL;
+}
+
+//------------------------------------------------------------------------------
+//Stream write data to lozfile
+//returns: written  = number of bytes written to file (in normal case written==size)
+//         LOZ_ERROR = error
+int loz_write( lozfile_t * lozfile, char * data, int size )
+{
+        lozfile_pool_t * pool;
+        int              n;
+
+        MYLOG_TRACE("@(lozfile=%p,data=%p,size=%d)", lozfile, data, size);
+
+        //Check input arguments
+        if(lozfile==NULL) {
+                MYLOG_ERROR("invalid argument lozfile=NULL");
+                return LOZ_ERROR;
+        }
+        if(lozfile->fd==NULL) {
+                MYLOG_ERROR("lozfile is not opened yet");
+                return LOZ_ERROR;
+        }
+        if(data==NULL) {
+                MYLOG_ERROR("invalid argument data=NULL");
+                return LOZ_ERROR;
+        }
+        if(size <= 0) {
+                MYLOG_ERROR("invalid argument size=%d", size);
+                return LOZ_ERROR;
+        }
+
+        pool = lozfile->pool;
+        if( (pool==NULL) || (pool->flush_ms==0) )
+                return loz_write_data( lozfile, (uint8_t*)data, size );
+
+        //LOZ_FLAG_ASYNC: wrbuff[] is shared with writer thread
+        pthread_mutex_lock( &pool->wr_mutex );
+        n = loz_write_aged( lozfile, (uint8_t*)data, size, 0 );
+        pthread_mutex_unlock( &pool->wr_mutex );
+        return n;
+}
+
+//------------------------------------------------------------------------------
+//Add data to wrbuff[] of LOZ_FLAG_ASYNC handle (pool->wr_mutex is locked):
+//writer thread submits data of wrbuff[] after flush_ms since the oldest data
+//was added
+//inputs:   lozfile = pointer to opened lozfile
+//          data    = data to be written
+//          size    = size of data (> 0)
+//          age     = how long data is waiting already, ms
+//returns:  written   = number of bytes written (size)
+//          LOZ_ERROR = error
+int loz_write_aged( lozfile_t * lozfile, uint8_t * data, int size, long int age )
+{
+        lozfile_pool_t * pool = lozfile->pool;
+        off_t            start;
+        int              pos;
+        int              n;
+
+        pos   = lozfile->wrbuff_pos;
+        start = lozfile->wr_rawpos - pos;
+        n     = loz_write_data( lozfile, data, size );
+        if( (pos == 0) || (lozfile->wr_rawpos - lozfile->wrbuff_pos != start) )
+                pool->wr_time = loz_time_ms() - age;
+        return n;
+}
+
+//------------------------------------------------------------------------------
+//Allocate wrbuff[] on first write
+//inputs:   lozfile = pointer to opened lozfile
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = error
+int loz_alloc_wrbuff( lozfile_t * lozfile )
+{
+        if(lozfile->map) {
+                MYLOG_ERROR("lozfile is opened for reading only (mapped)");
+                return LOZ_ERROR;
+        }
+        lozfile->wrbuff = malloc( lozfile->buffsize );
+        if(lozfile->wrbuff==NULL) {
+                MYLOG_ERROR("could not allocate %d bytes for wrbuff", lozfile->buffsize);
+                return LOZ_ERROR;
+        }
+        return LOZ_OK;
+}
+
+//------------------------------------------------------------------------------
+//Format printf line directly to free tail of wrbuff[] (see loz_vprintf()). Line
+//which does not fit is formatted again to strbuff (or to heap if it is longer
+//than strbuffsize) and written by loz_write_data() across blocks.
+//inputs:   lozfile = pointer to opened lozfile
+//          format  = format of printf
+//          arg     = arguments of format
+//returns:  n         = number of written bytes
+//          LOZ_ERROR = error
+int loz_write_format( lozfile_t * lozfile, const char * format, va_list arg )
+{
+        uint8_t   * p;
+        int         free_size;
+        int         n;
+        int         err;
+        va_list     arg2;
+
+        if( (lozfile->wrbuff==NULL) && (loz_alloc_wrbuff( lozfile ) < 0) )
+                return LOZ_ERROR;
+
+        //common case: line fits into wrbuff[] without filling it
+        free_size = lozfile->buffsize - lozfile->wrbuff_pos;
+        va_copy( arg2, arg );
+        n = vsnprintf( (char*)lozfile->wrbuff + lozfile->wrbuff_pos, free_size, format, arg2 );
+        va_end( arg2 );
+        if(n < 0) {
+                MYLOG_ERROR("vsnprintf() failed with error=%d", n);
+                return LOZ_ERROR;
+        }
+        if(n < free_size) {
+                lozfile->wrbuff_pos += n;
+                lozfile->wr_rawpos  += n;
+                return n;
+        }
+
+        //line spills to next block: format it again to separate buffer
+        if(n < LOZ_STRLEN_MAX) {
+                if(lozfile->strbuff==NULL) {
+                        lozfile->strbuff = malloc( LOZ_STRLEN_MAX );
+                        if(lozfile->strbuff==NULL) {
+                                MYLOG_ERROR("could not allocate %d bytes for strbuff", LOZ_STRLEN_MAX);
+                                return LOZ_ERROR;
+                        }
+                        lozfile->strbuffsize = LOZ_STRLEN_MAX;
+                }
+                p = lozfile->strbuff;
+        }
+        else {
+                p = malloc( n + 1 );
+                if(p==NULL) {
+                        MYLOG_ERROR("could not allocate %d bytes for line", n + 1);
+                        return LOZ_ERROR;
+                }
+        }
+        vsnprintf( (char*)p, n + 1, format, arg );
+        err = loz_write_data( lozfile, p, n );
+        if(p != lozfile->strbuff)
+                free( p );
+        return err;
+}
+
+//------------------------------------------------------------------------------
+//Add data to wrbuff[], compress full blocks (see loz_write())
+//inputs:   lozfile = pointer to opened lozfile
+//          data    = data to be written
+//          size    = size of data (> 0)
+//returns:  written   = number of bytes written (size)
+//          LOZ_ERROR = error
+int loz_write_data( lozfile_t * lozfile, uint8_t * data, int size )
+{
+        uint8_t * p;
+        int       left;
+        int       n;
+        int       err;
+
+        if( (lozfile->wrbuff==NULL) && (loz_alloc_wrbuff( lozfile ) < 0) )
+                return LOZ_ERROR;
+        
+        p    = data;
+
+        //common case of small write: data fits into wrbuff[] without filling it
+        if(size < lozfile->buffsize - lozfile->wrbuff_pos)
+        {
+                if(size == 1)
+                        lozfile->wrbuff[lozfile->wrbuff_pos] = *p;
+                else
+                        memcpy( lozfile->wrbuff + lozfile->wrbuff_pos, p, size );
+                lozfile->wrbuff_pos += size;
+                lozfile->wr_rawpos  += size;
+                return size;
+        }
+
+        left = size;
+        while(left > 0)
+        {
+                if( (lozfile->wrbuff_pos == 0) && (left >= lozfile->buffsize) )
+                {
+                        //full block of caller data: compress it directly (without wrbuff[])
+                        n = lozfile->buffsize;
+                        err = loz_write_section( lozfile, lozfile->wr_rawpos, p, n );
+                        if(err != n) {
+                                MYLOG_ERROR("loz_write_section() returns error=%d", err);
+                                return err;
+                        }
+                        lozfile->wr_rawpos += n;
+                }
+                else
+                {
+                        //add data to wrbuff[] up to the end of block
+                        n = lozfile->buffsize - lozfile->wrbuff_pos;
+                        if(n > left)
+                                n = left;
+                        memcpy( lozfile->wrbuff + lozfile->wrbuff_pos, p, n );
+                        lozfile->wrbuff_pos += n;
+                        lozfile->wr_rawpos  += n;
+
+                        //is full block formed?
+                        if(lozfile->wrbuff_pos >= lozfile->buffsize)
+                        {
+                                //compress wrbuff[] into lzbuff[], write to file
+                                err = loz_flush_wrbuff_to_file( lozfile );
+                                if(err != lozfile->buffsize) {
+                                        MYLOG_ERROR("loz_flush_wrbuff_to_file() returns error=%d", err);
+                                        return err;
+                                }
+                        }
+                }
+                p    += n;
+                left -= n;
+        }
+    
+        return size;
+}
+
+//------------------------------------------------------------------------------
+//Read data from lz-file
+//inputs:   lozfile = pointer to lz-file
+//returns:  readed = number of valid bytes successfully readed from file (size - corrupted bytes)
+//          LOZ_ERROR
+//          LOZ_UNSUPPORTED
+int loz_read( lozfile_t * lozfile, void * ptr, int size )
+{
+        int                n;
+        uint8_t          * p;
+        int                readed;
+
+        MYLOG_TRACE("@(lozfile=%p,ptr=%p,size=%d)", lozfile, ptr, size);
+
+        //check input arguments
+        if(lozfile==NULL) {
+                MYLOG_ERROR("invalid argument: lozfile=NULL");
+                return LOZ_ERROR;
+        }
+        if(lozfile->fd==NULL) {
+                MYLOG_ERROR("invalid argument: lozfile->fd=NULL");
+                return LOZ_ERROR;
+        }
+        if(lozfile->buffsize==0) {
+                MYLOG_ERROR("invalid argument: lozfile->buffsize=0");
+                return LOZ_ERROR;
+        }
+        if(ptr==NULL) {
+                MYLOG_ERROR("invalid argument: ptr=NULL");
+                return LOZ_ERROR;
+        }
+        if(size<=0) {
+                MYLOG_ERROR("invalid argument: size=%d", size);
+                return LOZ_ERROR;
+        }
+
+        p = ptr;
+
+        //common case of small read: all data is available in rdbuff[]
+        if(size <= lozfile->rdbuff_n)
+        {
+                if(size == 1)
+                        *p = lozfile->rdbuff[ lozfile->rdbuff_pos ];
+                else
+                        memcpy( p, lozfile->rdbuff + lozfile->rdbuff_pos, size );
+                lozfile->rdbuff_pos += size;
+                lozfile->rdbuff_n   -= size;
+                lozfile->rd_rawpos  += size;
+                return size;
+        }
+
+        readed = 0;
+        while(readed < size)
+        {
+                //output available data from rdbuff[]
+                if(lozfile->rdbuff_n > 0)
+                {
+                        n = size - readed;
+                        if(n > lozfile->rdbuff_n)
+                                n = lozfile->rdbuff_n;
+                        memcpy( p, lozfile->rdbuff + lozfile->rdbuff_pos, n );
+                        lozfile->rdbuff_pos += n;
+                        lozfile->rdbuff_n   -= n;
+                        lozfile->rd_rawpos  += n;
+                        p      += n;
+                        readed += n;
+                        continue;
+                }
+                
+                //read next section: full section is uncompressed directly
+                //to the caller buffer, partial one to rdbuff[]
+                n = loz_read_section( lozfile, p, size - readed );
+                if(n==LOZ_EOF)
+                        return readed;
+                else if(n < 0)
+                        return LOZ_ERROR;
+                lozfile->rd_rawpos += n;
+                p      += n;
+                readed += n;
+        }
+        return size;
+}
+
+//------------------------------------------------------------------------------
+//printf to the end of lz-file
+//inputs:   lozfile = pointer to lz-file
+//          format, ...  - printf string
+//returns:  n  = number of written bytes
+//         -1  = error
+int loz_printf( lozfile_t * lozfile, const char * format, ... )
+{
+        int         n;
+        va_list     arg;
+
+        MYLOG_TRACE("@(lozfile=%p,format=%s,...)", lozfile, format);
+
+        va_start(arg,format);
+        n = loz_vprintf( lozfile, format, arg );
+        va_end(arg);
+        return n;
+}
+
+//------------------------------------------------------------------------------
+//vprintf to the end of lz-file: line is formatted directly to wrbuff[] (see
+//loz_write_format()), it has no limit of length
+//inputs:   lozfile = pointer to lz-file
+//          format  = printf string
+//          arg     = arguments of format
+//returns:  n  = number of written bytes
+//         -1  = error
+int loz_vprintf( lozfile_t * lozfile, const char * format, va_list arg )
+{
+        lozfile_pool_t * pool;
+        off_t            start;
+        int              pos;
+        int              n;
+
+        MYLOG_TRACE("@(lozfile=%p,format=%s,...)", lozfile, format);
+
+        //check input arguments
+        if(lozfile==NULL) {
+                MYLOG_ERROR("invalid argument lozfile=NULL");
+                return -1;
+        }
+        if(lozfile->fd==NULL) {
+                MYLOG_ERROR("lozfile is not opened yet");
+                return -1;
+        }
+        if(format==NULL) {
+                MYLOG_ERROR("invalid argument format=NULL");
+                return -1;
+        }
+
+        pool = lozfile->pool;
+        if( (pool==NULL) || (pool->flush_ms==0) ) {
+                n = loz_write_format( lozfile, format, arg );
+        }
+        else {
+                //LOZ_FLAG_ASYNC: wrbuff[] is shared with writer thread (see loz_write_aged())
+                pthread_mutex_lock( &pool->wr_mutex );
+                pos   = lozfile->wrbuff_pos;
+                start = lozfile->wr_rawpos - pos;
+                n     = loz_write_format( lozfile, format, arg );
+                if( (n > 0) && ((pos == 0) || (lozfile->wr_rawpos - lozfile->wrbuff_pos != start)) )
+                        pool->wr_time = loz_time_ms();
+                pthread_mutex_unlock( &pool->wr_mutex );
+        }
+        if(n < 0) {
+                MYLOG_ERROR("could not write line: loz_write_format() failed");
+                return -1;
+        }
+
+        //flush
+        //loz_flush( lozfile );
+
+        return n;
+}
+
+//------------------------------------------------------------------------------
+//Append record to lozfile from any thread (LOZ_FLAG_ASYNC only): record is
+//copied to lock-free ring, writer thread moves records to wrbuff[]. Bytes of
+//record are contiguous in file, records of one thread are in order of calls.
+//inputs:   lozfile = pointer to lz-file opened with LOZ_FLAG_ASYNC
+//          data    = record
+//          size    = size of record
+//returns:  written   = size
+//          LOZ_ERROR = error
+int loz_append( lozfile_t * lozfile, const void * data, int size )
+{
+        lozfile_pool_t * pool;
+        uint8_t        * ring;
+        uint8_t        * p;
+        uint64_t         pos;
+        uint64_t         end;
+        uint32_t         off;
+        uint32_t         need;
+        uint32_t         pad;
+        int              n;
+
+        MYLOG_TRACE("@(lozfile=%p,data=%p,size=%d)", lozfile, data, size);
+
+        //check input arguments
+        if(lozfile==NULL) {
+                MYLOG_ERROR("invalid argument lozfile=NULL");
+                return LOZ_ERROR;
+        }
+        if(lozfile->fd==NULL) {
+                MYLOG_ERROR("lozfile is not opened yet");
+                return LOZ_ERROR;
+        }
+        if(data==NULL) {
+                MYLOG_ERROR("invalid argument data=NULL");
+                return LOZ_ERROR;
+        }
+        if(size <= 0) {
+                MYLOG_ERROR("invalid argument size=%d", size);
+                return LOZ_ERROR;
+        }
+        pool = lozfile->pool;
+        if( (pool==NULL) || (pool->flush_ms==0) ) {
+                MYLOG_ERROR("lozfile is not opened with LOZ_FLAG_ASYNC");
+                return LOZ_ERROR;
+        }
+
+        //big record is written directly after records reserved before it
+        if( (size > pool->ring_size / 4) || (size > lozfile->buffsize) ) {
+                pthread_mutex_lock( &pool->wr_mutex );
+                n = loz_ring_sync( lozfile );
+                if(n == LOZ_OK)
+                        n = loz_write_aged( lozfile, (uint8_t*)data, size, 0 );
+                pthread_mutex_unlock( &pool->wr_mutex );
+                return n;
+        }
+
+        //ring is allocated by the first record (zeroed: no valid headers)
+        ring = __atomic_load_n( &pool->ring, __ATOMIC_ACQUIRE );
+        if(ring==NULL) {
+                p = calloc( 1, pool->ring_size );
+                if(p==NULL) {
+                        MYLOG_ERROR("could not allocate %u bytes for ring", pool->ring_size);
+                        return LOZ_ERROR;
+                }
+                if( __atomic_compare_exchange_n( &pool->ring, &ring, p, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) )
+                        ring = p;
+                else
+                        free( p ); //allocated by other thread
+        }
+
+        //reserve space: record does not wrap, end of ring is padded
+        need = LOZ_RING_HEADER_SIZE + LOZ_RING_ALIGN(size);
+        pos  = __atomic_load_n( &pool->ring_reserve, __ATOMIC_RELAXED );
+        while(1)
+        {
+                off = pos & (pool->ring_size - 1);
+                pad = (off + need > pool->ring_size) ? pool->ring_size - off : 0;
+                end = pos + pad + need;
+                if( end - __atomic_load_n( &pool->ring_release, __ATOMIC_ACQUIRE ) > pool->ring_size ) {
+                        //ring is full: wake writer thread and let it run
+                        pthread_cond_broadcast( &pool->cond_done );
+                        sched_yield();
+                        pos = __atomic_load_n( &pool->ring_reserve, __ATOMIC_RELAXED );
+                        continue;
+                }
+                if( __atomic_compare_exchange_n( &pool->ring_reserve, &pos, end, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED ) )
                         break;
-                
-                default:
-                        MYLOG_ERROR("loz_section_last() failed with unexpected error=%d", err);
-                        goto exit_fail;
+        }
+
+        //copy record and publish it by header
+        if(pad) {
+                __atomic_store_n( (uint64_t*)(ring + off),
+                                  LOZ_RING_HEADER( pos, pool->ring_bits, LOZ_RING_PAD | pad ), __ATOMIC_RELEASE );
+                off = 0;
+        }
+        memcpy( ring + off + LOZ_RING_HEADER_SIZE, data, size );
+        __atomic_store_n( (uint64_t*)(ring + off),
+                          LOZ_RING_HEADER( pos + pad, pool->ring_bits, size ), __ATOMIC_RELEASE );
+
+        //wake writer thread every quarter of ring (else it moves records by timer)
+        if( (pos >> (pool->ring_bits - 2)) != (end >> (pool->ring_bits - 2)) )
+                pthread_cond_broadcast( &pool->cond_done );
+        return size;
+}
+
+//------------------------------------------------------------------------------
+//Append formatted record to lozfile from any thread (see loz_append())
+//inputs:   lozfile = pointer to lz-file opened with LOZ_FLAG_ASYNC
+//          format  = format of printf
+//returns:  n  = number of appended bytes
+//         -1  = error
+int loz_appendf( lozfile_t * lozfile, const char * format, ... )
+{
+        char        line[LOZ_APPEND_LINE];
+        char      * p = line;
+        int         n;
+        int         err;
+        va_list     arg;
+
+        MYLOG_TRACE("@(lozfile=%p,format=%s,...)", lozfile, format);
+
+        if(format==NULL) {
+                MYLOG_ERROR("invalid argument format=NULL");
+                return -1;
+        }
+
+        //format to stack, long line is formatted again to heap
+        va_start(arg,format);
+        n = vsnprintf( line, sizeof(line), format, arg );
+        va_end(arg);
+        if(n >= (int)sizeof(line)) {
+                p = malloc( n + 1 );
+                if(p==NULL)
+                        return -1;
+                va_start(arg,format);
+                vsnprintf( p, n + 1, format, arg );
+                va_end(arg);
+        }
+        if(n <= 0)
+                return n;
+
+        err = loz_append( lozfile, p, n );
+        if(p != line)
+                free( p );
+        return (err == n) ? n : -1;
+}
+
+//------------------------------------------------------------------------------
+//Close lz-file.
+//inputs:   lozfile = pointer to lz-file
+void loz_close( lozfile_t * lozfile )
+{
+        MYLOG_TRACE("@(lozfile=%p)", lozfile);
+        
+        if(lozfile) {
+                if(lozfile->fd) {
+                        //fflush data
+                        loz_flush(lozfile);
+                        loz_pool_stop(lozfile);
+                        //write section index to the end of file
+                        if( (lozfile->rwmode != LOZ_READONLY) &&
+                            (lozfile->version >= LOZ_VERSION_1) )
+                        {
+                                if(!lozfile->index_valid && loz_index_build(lozfile) != LOZ_OK)
+                                        MYLOG_ERROR("loz_index_build() failed, file is closed without index");
+                                else if(loz_write_index(lozfile) != LOZ_OK)
+                                        MYLOG_ERROR("loz_write_index() failed, file is closed without index");
+                        }
+                        //close file
+                        fclose(lozfile->fd);
                 }
-                break;
+                if(lozfile->map)
+                        munmap(lozfile->map, lozfile->mapsize);
+                if(lozfile->rdbuff)
+                        free(lozfile->rdbuff);
+                if(lozfile->wrbuff)
+                        free(lozfile->wrbuff);
+                if(lozfile->strbuff)
+                        free(lozfile->strbuff);
+                if(lozfile->lzbuff)
+                        free(lozfile->lzbuff);
+                if(lozfile->scanbuff)
+                        free(lozfile->scanbuff);
+                if(lozfile->lzwork)
+                        free(lozfile->lzwork);
+                if(lozfile->index_blocks)
+                        free(lozfile->index_blocks);
+                if(lozfile->index_data)
+                        free(lozfile->index_data);
+                if(lozfile->index_eytz)
+                        free(lozfile->index_eytz);
+                if(lozfile->cache_own)
+                        loz_cache_destroy(lozfile->cache);
+                pthread_mutex_destroy(&lozfile->index_mutex);
+                free(lozfile);
+        }
+        return;
+}
+
+//------------------------------------------------------------------------------
+//Flush lz-file.
+//inputs:   lozfile = pointer to lz-file
+void loz_flush( lozfile_t * lozfile )
+{
+        lozfile_pool_t * pool;
+        int              err;
         
-        case LOZ_READWRITE_CLEAR:
-                //write LZ-file header into the file
-                err = loz_write_fileheader(lozfile);
+        MYLOG_TRACE("@(lozfile=%p)", lozfile);
+
+        //check input arguments
+        if(lozfile==NULL)
+                return;
+        if(lozfile->fd==NULL)
+                return;
+        if(lozfile->rwmode==LOZ_READONLY)
+                return;
+
+        //flush available data from wrbuff[]
+        if( lozfile->pool && lozfile->pool->flush_ms ) {
+                pool = lozfile->pool;
+                pthread_mutex_lock( &pool->wr_mutex );
+                err = loz_ring_sync( lozfile );
+                if(err >= 0)
+                        err = loz_flush_wrbuff_to_file( lozfile );
+                pthread_mutex_unlock( &pool->wr_mutex );
+        }
+        else {
+                err = loz_flush_wrbuff_to_file( lozfile );
+        }
+        if(err < LOZ_OK) {
+                MYLOG_ERROR("loz_flush_wrbuff_to_file() failed with error=%d", err);
+        }
+
+        //LOZ_FLAG_ASYNC: wait until writer thread writes all sections
+        if( lozfile->pool && lozfile->pool->flush_ms ) {
+                err = loz_pool_drain( lozfile );
                 if(err) {
-                        MYLOG_ERROR("could not write LZ-file header");
-                        goto exit_fail;
+                        MYLOG_ERROR("loz_pool_drain() failed with error=%d", err);
                 }
-                //move rd_fpos,wr_fpos into the begining of data (to the 1st file-section position)
-                lozfile->rd_fpos = LOZ_FILEHEADER_SIZE; //skip file-header
-                lozfile->wr_fpos = LOZ_FILEHEADER_SIZE; //skip file-header
-                lozfile->rd_rawpos = 0L;
-                lozfile->wr_rawpos = 0L;
-                break;
+        }
+        //write all sections compressed by worker threads
+        else if(lozfile->pool) {
+                err = loz_pool_commit( lozfile, 1 );
+                if(err) {
+                        MYLOG_ERROR("loz_pool_commit() failed with error=%d", err);
+                }
+        }
+        return;
+}
+
+//------------------------------------------------------------------------------
+//Get current valid size of LOZ-file.
+//inputs:   lozfile = pointer to loz-file
+//returns:  current size of LOZ-file
+//          0 = error
+off_t loz_filesize( lozfile_t * lozfile )
+{
+        MYLOG_TRACE("@(lozfile=%p)", lozfile);
+
+        //check input arguments
+        if(lozfile==NULL)
+                return 0L;
+        if(lozfile->fd==NULL)
+                return 0L;
         
-        default:
-                MYLOG_ERROR("unexpected value of rwmode: %d", lozfile->rwmode);
-                goto exit_fail;
+        return lozfile->filesize;
+}
+
+//------------------------------------------------------------------------------
+//Set read position of LOZ-file to defined position in uncompressed (raw) data.
+//Section index is built on first call, so seek costs one index lookup
+//and one section decompression.
+//inputs:   lozfile = pointer to loz-file
+//          rawpos  = new read position in uncompressed data
+//returns:  LOZ_OK    = ok
+//          LOZ_EOF   = rawpos is beyond the end of data
+//          LOZ_ERROR = error
+int loz_fseek( lozfile_t * lozfile, off_t rawpos )
+{
+        int               err;
+        off_t             skip;
+        lozfile_index_t   entry;
+
+        MYLOG_TRACE("@(lozfile=%p,rawpos=%lld)", lozfile, (long long)rawpos);
+
+        //check input arguments
+        if(lozfile==NULL) {
+                MYLOG_ERROR("invalid argument: lozfile=NULL");
+                return LOZ_ERROR;
+        }
+        if(lozfile->fd==NULL) {
+                MYLOG_ERROR("invalid argument: lozfile->fd=NULL");
+                return LOZ_ERROR;
+        }
+        if(rawpos < 0) {
+                MYLOG_ERROR("invalid argument: rawpos=%lld", (long long)rawpos);
+                return LOZ_ERROR;
+        }
+
+        //rawpos is inside section in rdbuff[]: it is not readed again
+        if( (rawpos >= lozfile->rd_rawpos - lozfile->rdbuff_pos) &&
+            (rawpos <  lozfile->rd_rawpos + lozfile->rdbuff_n) )
+        {
+                skip = rawpos - lozfile->rd_rawpos;
+                lozfile->rdbuff_pos += skip;
+                lozfile->rdbuff_n   -= skip;
+                lozfile->rd_rawpos   = rawpos;
+                return LOZ_OK;
+        }
+
+        //build section index on first seek
+        err = loz_index_ready( lozfile );
+        if(err != LOZ_OK) {
+                MYLOG_ERROR("loz_index_ready() failed");
+                return LOZ_ERROR;
+        }
+
+        //get section containing rawpos (or the last valid section before it)
+        err = loz_index_find( lozfile, rawpos, &entry );
+        if(err == LOZ_ERROR) {
+                MYLOG_ERROR("loz_index_find() failed");
+                return LOZ_ERROR;
+        }
+        if(err == LOZ_EOF) {
+                lozfile->rd_fpos   = LOZ_FILEHEADER_SIZE(lozfile);
+                lozfile->rd_rawpos = 0L;
+        }
+        else {
+                lozfile->rd_fpos   = entry.fpos;
+                lozfile->rd_rawpos = entry.rawpos;
         }
+        lozfile->rdbuff_n   = 0;
+        lozfile->rdbuff_pos = 0;
+
+        //uncompress section(s) till rawpos: normally only one section is
+        //uncompressed, more if rawpos is inside corrupted (not indexed) section
+        while(1) {
+                err = loz_fill_rdbuff( lozfile );
+                if(err == LOZ_EOF) {
+                        if(lozfile->rd_rawpos == rawpos)
+                                return LOZ_OK; //rawpos is the end of data
+                        MYLOG_ERROR("rawpos=%lld is beyond the end of data", (long long)rawpos);
+                        return LOZ_EOF;
+                }
+                else if(err != LOZ_OK) {
+                        MYLOG_ERROR("loz_fill_rdbuff() failed");
+                        return LOZ_ERROR;
+                }
+
+                skip = rawpos - lozfile->rd_rawpos;
+                if(skip < lozfile->rdbuff_n) {
+                        lozfile->rdbuff_pos += skip;
+                        lozfile->rdbuff_n   -= skip;
+                        lozfile->rd_rawpos   = rawpos;
+                        return LOZ_OK;
+                }
+                lozfile->rd_rawpos += lozfile->rdbuff_n;
+                lozfile->rdbuff_n   = 0;
+        }
+}
+
+//------------------------------------------------------------------------------
+//Get current read position of LOZ-file in uncompressed (raw) data.
+//inputs:   lozfile = pointer to loz-file
+//returns:  rawpos    = current read position
+//          LOZ_ERROR = error
+off_t loz_ftell( lozfile_t * lozfile )
+{
+        MYLOG_TRACE("@(lozfile=%p)", lozfile);
 
-        return lozfile;
+        //check input arguments
+        if(lozfile==NULL)
+                return LOZ_ERROR;
+        if(lozfile->fd==NULL)
+                return LOZ_ERROR;
 
-exit_fail:
-        if(lozfile) {
-                loz_close( lozfile );
-                free(lozfile);
-        }
-        return NULL;
+        return lozfile->rd_rawpos;
 }
 
 //------------------------------------------------------------------------------
-//Stream write data to lozfile
-//returns: written  = number of bytes written to file (in normal case written==size)
-//         LOZ_ERROR = error
-int loz_write( lozfile_t * lozfile, char * data, int size )
+//Extract (uncompress) whole LOZ-file to output file by nthreads threads.
+//Section headers are walked once (or index is loaded from the end of file),
+//then sections are uncompressed in parallel and every section is written by
+//pwrite() at its rawpos. Corrupted section between valid ones is repaired or
+//filled by LOZ_FILLER, the same as by loz_read().
+//inputs:   lozfile  = pointer to lz-file opened for reading
+//          fid      = output file (opened for writing, it is truncated to size of data)
+//          nthreads = number of threads (1..LOZ_THREADS_MAX)
+//returns:  size      = size of extracted (uncompressed) data
+//          LOZ_ERROR = error
+off_t loz_extract( lozfile_t * lozfile, int fid, int nthreads )
 {
-        int       i;
-        uint8_t * p;
-        int       err;
+        int                 err;
+        int                 i;
+        int                 n;
+        off_t               size;
+        lozfile_extract_t   ext;
+        pthread_t         * threads;
 
-        MYLOG_TRACE("@(lozfile=%p,data=%p,size=%d)", lozfile, data, size);
+        MYLOG_TRACE("@(lozfile=%p,fid=%d,nthreads=%d)", lozfile, fid, nthreads);
 
-        //Check input arguments
+        //check input arguments
         if(lozfile==NULL) {
-                MYLOG_ERROR("invalid argument lozfile=NULL");
+                MYLOG_ERROR("invalid argument: lozfile=NULL");
                 return LOZ_ERROR;
         }
         if(lozfile->fd==NULL) {
-                MYLOG_ERROR("lozfile is not opened yet");
+                MYLOG_ERROR("invalid argument: lozfile->fd=NULL");
                 return LOZ_ERROR;
         }
-        if(data==NULL) {
-                MYLOG_ERROR("invalid argument data=NULL");
+        if(fid < 0) {
+                MYLOG_ERROR("invalid argument: fid=%d", fid);
                 return LOZ_ERROR;
         }
-        if(size <= 0) {
-                MYLOG_ERROR("invalid argument size=%d", size);
+        if( (nthreads < 1) || (nthreads > LOZ_THREADS_MAX) ) {
+                MYLOG_ERROR("invalid argument: nthreads=%d, must be 1..%d", nthreads, LOZ_THREADS_MAX);
                 return LOZ_ERROR;
         }
-        
-        p = (uint8_t*)data;
-        for(i=0; i<size; i++)
-        {
-                //add data to wrbuff[]
-                lozfile->wrbuff[ lozfile->wrbuff_pos++ ] = *p++;
-                lozfile->wr_rawpos++;
-                
-                //is full block formed?
-                if(lozfile->wrbuff_pos >= lozfile->buffsize)
-                {
-                        //compress wrbuff[] into lzbuff[], write to file
-                        err = loz_flush_wrbuff_to_file( lozfile );
-                        if(err != lozfile->buffsize) {
-                                MYLOG_ERROR("loz_flush_wrbuff_to_file() returns error=%d", err);
-                                return err;
-                        }
+
+        //write all data of lozfile to file
+        loz_flush( lozfile );
+
+        //walk section headers once
+        if(!lozfile->index_valid) {
+                err = loz_index_build( lozfile );
+                if(err) {
+                        MYLOG_ERROR("loz_index_build() failed");
+                        return LOZ_ERROR;
                 }
         }
-    
+
+        //sections are extracted in order of file
+        if( lozfile->map && lozfile->map_random ) {
+                loz_map_advise( lozfile, 0, lozfile->mapsize, MADV_SEQUENTIAL );
+                lozfile->map_random = 0;
+        }
+
+        //sections are taken from index by loz_extract_next()
+        memset( &ext, 0, sizeof(ext) );
+        ext.lozfile  = lozfile;
+        ext.fid      = fid;
+        ext.fpos     = LOZ_FILEHEADER_SIZE(lozfile);
+        ext.rawpos   = 0;
+        ext.more     = (loz_index_seek( lozfile, 0, &ext.cursor ) == LOZ_OK);
+        threads      = calloc( nthreads, sizeof(pthread_t) );
+        if(threads==NULL) {
+                MYLOG_ERROR("could not allocate memory for threads");
+                return LOZ_ERROR;
+        }
+        size = 0;
+        if(lozfile->index_n > 0)
+                size = lozfile->index_last.rawpos + lozfile->index_last.rawsize;
+        MYLOG_DEBUG("extract %d sections (%lld bytes) by %d threads", lozfile->index_n, (long long)size, nthreads);
+
+        pthread_mutex_init( &ext.mutex, NULL );
+        n = 0;
+        for(i=0; i<nthreads; i++) {
+                if( pthread_create( &threads[i], NULL, loz_extract_worker, &ext ) ) {
+                        MYLOG_ERROR("pthread_create() failed: err=%d: %s", errno, strerror(errno) );
+                        pthread_mutex_lock( &ext.mutex );
+                        ext.error = 1;
+                        pthread_mutex_unlock( &ext.mutex );
+                        break;
+                }
+                n++;
+        }
+        for(i=0; i<n; i++)
+                pthread_join( threads[i], NULL );
+        pthread_mutex_destroy( &ext.mutex );
+        free( threads );
+
+        if(ext.error) {
+                MYLOG_ERROR("could not extract sections");
+                return LOZ_ERROR;
+        }
+
+        err = ftruncate( fid, size );
+        if(err) {
+                MYLOG_ERROR("ftruncate(%lld) failed: err=%d: %s", (long long)size, errno, strerror(errno) );
+                return LOZ_ERROR;
+        }
         return size;
 }
 
 //------------------------------------------------------------------------------
-//Read data from lz-file
-//inputs:   lozfile = pointer to lz-file
-//returns:  readed = number of valid bytes successfully readed from file (size - corrupted bytes)
-//          LOZ_ERROR
-//          LOZ_UNSUPPORTED
-int loz_read( lozfile_t * lozfile, void * ptr, int size )
+//Read data from lozfile at rawpos. Read position of lozfile (loz_read(),
+//loz_fseek()) is not used and not changed: many threads could call
+//loz_pread() on one handle at the same time (file must not be written then).
+//Corrupted data is readed as LOZ_FILLER (as by loz_read()).
+//inputs:   lozfile = pointer to opened lz-file
+//          ptr     = buffer for data
+//          size    = number of bytes to be readed
+//          rawpos  = position in uncompressed data
+//returns:  readed    = number of bytes readed to ptr[] (less than size at the end of data)
+//          LOZ_ERROR = error
+int loz_pread( lozfile_t * lozfile, void * ptr, int size, off_t rawpos )
 {
-        int                err;
-        int                i;
-        uint8_t          * p;
-        lozfile_section_t   section;
-        lozfile_section_t   next;
-        int                decompsize;
-        int                readed;
-
-        MYLOG_TRACE("@(lozfile=%p,ptr=%p,size=%d)", lozfile, ptr, size);
+        int                 err;
+        int                 n;
+        int                 offset;
+        int                 indexed;
+        int                 lost;
+        int                 valid;
+        int                 readed;
+        uint8_t           * p;
+        lozfile_index_t     section;
+        lozfile_index_t     next;
+        lozfile_scratch_t * scratch;
+
+        MYLOG_TRACE("@(lozfile=%p,ptr=%p,size=%d,rawpos=%lld)", lozfile, ptr, size, (long long)rawpos);
 
         //check input arguments
         if(lozfile==NULL) {
@@ -1598,14 +5216,6 @@ int loz_read( lozfile_t * lozfile, void * ptr, int size )
                 MYLOG_ERROR("invalid argument: lozfile->fd=NULL");
                 return LOZ_ERROR;
         }
-        if(lozfile->rdbuff==NULL) {
-                MYLOG_ERROR("invalid argument: lozfile->rdbuff=NULL");
-                return LOZ_ERROR;
-        }
-        if(lozfile->buffsize==0) {
-                MYLOG_ERROR("invalid argument: lozfile->buffsize=0");
-                return LOZ_ERROR;
-        }
         if(ptr==NULL) {
                 MYLOG_ERROR("invalid argument: ptr=NULL");
                 return LOZ_ERROR;
@@ -1614,336 +5224,219 @@ int loz_read( lozfile_t * lozfile, void * ptr, int size )
                 MYLOG_ERROR("invalid argument: size=%d", size);
                 return LOZ_ERROR;
         }
+        if(rawpos < 0) {
+                MYLOG_ERROR("invalid argument: rawpos=%lld", (long long)rawpos);
+                return LOZ_ERROR;
+        }
+
+        //build section index by the first reader
+        err = loz_index_ready( lozfile );
+        if(err != LOZ_OK) {
+                MYLOG_ERROR("loz_index_ready() failed");
+                return LOZ_ERROR;
+        }
 
+        scratch = loz_scratch_get( lozfile );
+        if(scratch==NULL) {
+                MYLOG_ERROR("could not allocate memory for read buffers");
+                return LOZ_ERROR;
+        }
+
+        p      = ptr;
         readed = 0;
-        p = ptr;
-        for(i=0; i<size; i++)
+        while(readed < size)
         {
-                //has full block been readed?
-                if( (lozfile->rdbuff_n == 0) ||
-                    (lozfile->rdbuff_pos >= lozfile->buffsize) )
+                //get section containing rawpos
+                err = loz_index_find( lozfile, rawpos, &section );
+                if(err == LOZ_ERROR) {
+                        MYLOG_ERROR("loz_index_find() failed");
+                        return LOZ_ERROR;
+                }
+                indexed = (err == LOZ_OK) && (rawpos < (off_t)section.rawpos + section.rawsize);
+                lost    = 0;
+                if(!indexed)
                 {
-                        MYLOG_DEBUG("lozfile->rd_rawpos=%ld", lozfile->rd_rawpos);
-
-                        lozfile->rdbuff_pos = 0;
-
-                        //read section header from file
-                        err = loz_read_section_header( lozfile, &section, lozfile->rd_fpos );
-                        if(err==LOZ_ERROR) {
-                                MYLOG_ERROR("loz_read_section_header() failed");
-                                return LOZ_ERROR;
-                        }
-                        else if(err==LOZ_EOF) {
-                                MYLOG_ERROR("loz_read_section_header() return End Of File");
-                                return readed;
+                        //rawpos is in corrupted sections between valid ones:
+                        //they are repaired as one section (as by loz_extract())
+                        if(err == LOZ_EOF) {
+                                section.fpos     = LOZ_FILEHEADER_SIZE(lozfile);
+                                section.rawpos   = 0;
                         }
-                        else if(err==LOZ_BAD_CRC) {
-                                MYLOG_DEBUG("loz_read_section_header() return Bad CRC. Try to repair it!");
-                                //go-go-go
+                        else {
+                                section.fpos    += LOZ_SECTIONHEADER_SIZE(lozfile) + section.compsize + LOZ_DATACRC_SIZE(lozfile);
+                                section.rawpos  += section.rawsize;
                         }
-                        
-                        MYLOG_DEBUG("section.fpos           =%ld", section.fpos);
-                        MYLOG_DEBUG("section.header_is_valid=%d",  section.header_is_valid);
-                        MYLOG_DEBUG("section.rawpos         =%d",  section.rawpos);
-                        MYLOG_DEBUG("section.rawpos_end     =%d",  section.rawpos_end);
-                        MYLOG_DEBUG("section.rawsize        =%d",  section.rawsize);
-                        MYLOG_DEBUG("section.compsize       =%d",  section.compsize);
-                        MYLOG_DEBUG("lozfile.compression     =%s",  compression_to_str(lozfile->compression) );
-                        
-                        if(section.header_is_valid)
-                        {
-                                //read compressed data to lzbuff[]
-                                err = loz_read_compdata( lozfile,
-                                                        section.fpos + LOZ_SECTIONHEADER_SIZE,
-                                                        lozfile->lzbuff,
-                                                        section.compsize );
-                                if(err==LOZ_ERROR) {
-                                        MYLOG_ERROR("loz_read_compdata() failed with LOZ_ERROR");
-                                        return LOZ_ERROR;
-                                }
-                                else if(err==LOZ_EOF) {
-                                        MYLOG_WARNING("loz_read_compdata() failed with LOZ_EOF");
-                                        return readed;
-                                }
-                                else if(err==LOZ_BAD_CRC) {
-                                        MYLOG_WARNING("loz_read_compdata() failed with LOZ_BAD_CRC");
-                                        //fill rdbuff[] with LOZ_FILLER
-                                        memset(lozfile->rdbuff, LOZ_FILLER, section.rawsize);
-                                }
-                                else if(err==LOZ_OK) {
-                                        //uncompress data from lzbuff[] to rdbuff[]
-                                        err = loz_uncompress_data ( lozfile->compression,
-                                                                   lozfile->lzbuff,
-                                                                   section.compsize,
-                                                                   lozfile->rdbuff,
-                                                                   lozfile->buffsize,
-                                                                   &decompsize );
-                                        if(err != LOZ_OK) {
-                                                MYLOG_ERROR("Could not uncompress section-data: loz_uncompress_data() failed with error=%d", err);
-                                                return LOZ_ERROR;
-                                        }
-                                        
-                                }
-                                else {
-                                        MYLOG_ERROR("Unexpected error of loz_read_compdata(): %d", err);
-                                        return LOZ_ERROR;
-                                }
-                                
-                                lozfile->rd_fpos = section.fpos + LOZ_SECTIONHEADER_SIZE + section.compsize + LOZ_CRC_SIZE;
+                        if( loz_index_upper( lozfile, rawpos, &next ) != LOZ_OK )
+                                break; //end of data
+                        if(next.rawpos - section.rawpos > LOZ_BLOCKSIZE_MAX) {
+                                //more than one section is lost: filler up to next section
+                                lost = 1;
+                                section.rawpos  = rawpos;
+                                section.rawsize = (next.rawpos - rawpos > 0x7FFFFFFF) ? 0x7FFFFFFF : next.rawpos - rawpos;
                         }
                         else {
-                                //1.try to search for the next section,
-                                //2.calculate rawsize of current (invalid) section,
-                                //3.fill rdbuff[] with LOZ_FILLER byte
-                                
-                                err = loz_section_next ( lozfile, &section, &next );
-                                if(err==LOZ_ERROR) {
-                                        MYLOG_ERROR("Current section is invalid, could not get next section");
-                                        return readed;
-                                }
-                                else if(err==LOZ_EOF) {
-                                        MYLOG_ERROR("Current section is invalid and last: could not get next section");
-                                        return readed;
-                                }
-                                else if(err==LOZ_BAD_CRC) {
-                                        MYLOG_ERROR("Current section is invalid, next section is invalid");
-                                        return readed;
-                                }
-                                
-                                MYLOG_DEBUG("try to repair section.rawsize: next.rawpos=%ld, lozfile->rd_rawpos=%ld",
-                                            next.rawpos, lozfile->rd_rawpos);
-                                
-                                section.rawsize = next.rawpos - lozfile->rd_rawpos;
-                                if(section.rawsize > lozfile->buffsize) {
-                                        MYLOG_ERROR("Too big value of repaired section.rawsize=%d > lozfile->buffsize=%d",
-                                                    section.rawsize, lozfile->buffsize);
-                                        return readed;
-                                }
-                                
-                                section.compsize = next.fpos - section.fpos - LOZ_SECTIONHEADER_SIZE - LOZ_CRC_SIZE;
-                                
-                                //read compressed data to lzbuff[]
-                                err = loz_read_compdata( lozfile,
-                                                        section.fpos + LOZ_SECTIONHEADER_SIZE,
-                                                        lozfile->lzbuff,
-                                                        section.compsize );
-                                if(err==LOZ_ERROR) {
-                                        MYLOG_ERROR("loz_read_compdata() failed with LOZ_ERROR");
-                                        return LOZ_ERROR;
-                                }
-                                else if(err==LOZ_EOF) {
-                                        MYLOG_WARNING("loz_read_compdata() failed with LOZ_EOF");
-                                        return readed;
-                                }
-                                else if(err==LOZ_BAD_CRC) {
-                                        MYLOG_WARNING("loz_read_compdata() failed with LOZ_BAD_CRC");
-                                        //fill rdbuff[] with LOZ_FILLER
-                                        memset(lozfile->rdbuff, LOZ_FILLER, section.rawsize);
-                                }
-                                else if(err==LOZ_OK) {
-                                        //uncompress data from lzbuff[] to rdbuff[]
-                                        err = loz_uncompress_data ( lozfile->compression,
-                                                                   lozfile->lzbuff,
-                                                                   section.compsize,
-                                                                   lozfile->rdbuff,
-                                                                   lozfile->buffsize,
-                                                                   &decompsize );
-                                        if(err != LOZ_OK) {
-                                                MYLOG_ERROR("Could not uncompress section-data: loz_uncompress_data() failed with error=%d", err);
-                                                return LOZ_ERROR;
-                                        }
-                                        
-                                }
-                                else {
-                                        MYLOG_ERROR("Unexpected error of loz_read_compdata(): %d", err);
-                                        return LOZ_ERROR;
-                                }
-                                
-                                lozfile->rd_fpos = section.fpos + LOZ_SECTIONHEADER_SIZE + section.compsize + LOZ_CRC_SIZE;
-                                
-                                //fill rdbuff[] with LOZ_FILLER
-                                //memset(lozfile->rdbuff, LOZ_FILLER, section.rawsize);
+                                section.rawsize  = next.rawpos - section.rawpos;
                         }
-                        
-                        if(decompsize > lozfile->buffsize) {
-                                MYLOG_ERROR("decompsize=%d is too big (lozfile->buffsize=%d)", decompsize, lozfile->buffsize);
+                        section.compsize = 0;
+                        if(next.fpos - section.fpos > LOZ_SECTIONHEADER_SIZE(lozfile) + LOZ_DATACRC_SIZE(lozfile))
+                                section.compsize = next.fpos - section.fpos - LOZ_SECTIONHEADER_SIZE(lozfile) - LOZ_DATACRC_SIZE(lozfile);
+                }
+                offset = rawpos - section.rawpos;
+                n      = size - readed;
+                if(n > (off_t)section.rawsize - offset)
+                        n = section.rawsize - offset;
+
+                if(lost) {
+                        //more than one section is lost
+                        memset( p, LOZ_FILLER, n );
+                }
+                else if( loz_scratch_reserve( lozfile, scratch, &section ) != LOZ_OK ) {
+                        MYLOG_ERROR("could not allocate memory for read buffers");
+                        return LOZ_ERROR;
+                }
+                else if( lozfile->cache && indexed &&
+                         ((err = loz_cache_copy( lozfile, section.fpos, offset, p, n )) >= 0) ) {
+                        //cached section costs one memcpy
+                        n = err;
+                }
+                else if( (offset == 0) && (n == section.rawsize) && !lozfile->cache ) {
+                        //full section: uncompress it directly to the caller buffer
+                        n = loz_uncompress_section( lozfile, &section, scratch->lzbuff, scratch->lzbuffsize, p, n, &valid );
+                        if(n < 0)
                                 return LOZ_ERROR;
-                        }
-                        
-                        lozfile->rdbuff_n += decompsize;
                 }
-                
-                //output data from rdbuff[]
-                *p++ = lozfile->rdbuff[ lozfile->rdbuff_pos++ ];
-                
-                lozfile->rd_rawpos ++;
-                lozfile->rdbuff_n --;
-                
-                readed ++;
+                else {
+                        //partial section: uncompress it to thread-local buffer
+                        err = loz_uncompress_section( lozfile, &section, scratch->lzbuff, scratch->lzbuffsize,
+                                                     scratch->rawbuff, scratch->rawbuffsize, &valid );
+                        if(err < 0)
+                                return LOZ_ERROR;
+                        if( lozfile->cache && indexed && valid )
+                                loz_cache_put( lozfile, section.fpos,
+                                               section.fpos + LOZ_SECTIONHEADER_SIZE(lozfile) +
+                                               section.compsize + LOZ_DATACRC_SIZE(lozfile),
+                                               scratch->rawbuff, err );
+                        if(n > err - offset)
+                                n = err - offset;
+                        if(n > 0)
+                                memcpy( p, scratch->rawbuff + offset, n );
+                }
+                if(n <= 0)
+                        break; //section is shorter than its header says
+                p      += n;
+                readed += n;
+                rawpos += n;
         }
-        return size;
+        return readed;
 }
 
 //------------------------------------------------------------------------------
-//printf to the end of lz-file
-//inputs:   lozfile = pointer to lz-file
-//          format, ...  - printf string
-//returns:  0 = ok
-//         -1 = error
-int loz_printf( lozfile_t * lozfile, const char * format, ... )
+//Get statistics of sections written by lozfile handle since loz_open(): number
+//of sections, raw and compressed data size by codec. Sections which are not
+//written to file yet (data in write buffer, pool jobs) are not counted, call
+//loz_flush() before to count all of them.
+//inputs:   lozfile = pointer to opened lz-file
+//outputs:  stats   = statistics
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = error
+int loz_stats( lozfile_t * lozfile, lozfile_stats_t * stats )
 {
-        int         n;
-        int         err;
-        va_list     arg;
+        MYLOG_TRACE("@(lozfile=%p,stats=%p)", lozfile, stats);
 
-        MYLOG_TRACE("@(lozfile=%p,format=%s,...)", lozfile, format);
-
-        //Check input arguments
+        //check input arguments
         if(lozfile==NULL) {
-                MYLOG_ERROR("invalid argument lozfile=NULL");
-                return -1;
-        }
-        if(lozfile->fd==NULL) {
-                MYLOG_ERROR("lozfile is not opened yet");
-                return -1;
-        }
-        if(format==NULL) {
-                MYLOG_ERROR("invalid argument format=NULL");
-                return -1;
+                MYLOG_ERROR("invalid argument: lozfile=NULL");
+                return LOZ_ERROR;
         }
-
-        //printf
-        va_start(arg,format);
-        n = vsnprintf( (char*)lozfile->strbuff, lozfile->buffsize, format, arg );
-        va_end(arg);
-
-        if(n<0)
-                return -1;
-
-        //write data to file
-        err = loz_write( lozfile, (char*)lozfile->strbuff, n );
-        if(err != n) {
-                MYLOG_ERROR("could not write %d bytes: loz_write() failed", n);
-                return -1;
+        if(stats==NULL) {
+                MYLOG_ERROR("invalid argument: stats=NULL");
+                return LOZ_ERROR;
         }
-        
-        //flush
-        //loz_flush( lozfile );
 
-        return n;
+        memcpy( stats, &lozfile->stats, sizeof(lozfile_stats_t) );
+        return LOZ_OK;
 }
 
 //------------------------------------------------------------------------------
-//vprintf to the end of lz-file
-//inputs:   lozfile = pointer to lz-file
-//          format, ...  - printf string
-//returns:  0 = ok
-//         -1 = error
-int loz_vprintf( lozfile_t * lozfile, const char * format, va_list arg )
+//Create cache of uncompressed sections. Cache could be shared by many lozfile
+//handles (see lozfile_opts_t.cache), it must be destroyed after all of them
+//are closed.
+//inputs:   size  = max size of cached data, bytes
+//returns:  cache = pointer to created cache
+//          NULL  = error
+lozfile_cache_t * loz_cache_create( long int size )
 {
-        int      n;
-        int      err;
+        lozfile_cache_t * cache;
 
-        MYLOG_TRACE("@(lozfile=%p,format=%s,...)", lozfile, format);
+        MYLOG_TRACE("@(size=%ld)", size);
 
         //check input arguments
-        if(lozfile==NULL)
-                return -1;
-        if(lozfile->fd==NULL)
-                return -1;
-        if(lozfile->wrbuff==NULL)
-                return -1;
-        if(lozfile->buffsize==0)
-                return -1;
-        if(format==NULL)
-                return -1;
-
-        //vprintf
-        n = vsnprintf( (char*)lozfile->strbuff, lozfile->buffsize, format, arg );
-        if(n<0)
-                return -1;
-
-        //write data to file
-        err = loz_write( lozfile, (char*)lozfile->strbuff, n );
-        if(err != 1)
-                return -1;
-
-        //flush
-        //loz_flush( lozfile );
-
-        return n;
-}
+        if(size <= 0) {
+                MYLOG_ERROR("invalid argument: size=%ld", size);
+                return NULL;
+        }
 
-//------------------------------------------------------------------------------
-//Close lz-file.
-//inputs:   lozfile = pointer to lz-file
-void loz_close( lozfile_t * lozfile )
-{
-        MYLOG_TRACE("@(lozfile=%p)", lozfile);
-        
-        if(lozfile) {
-                if(lozfile->fd) {
-                        //fflush data
-                        loz_flush(lozfile);
-                        //close file
-                        fclose(lozfile->fd);
-                }
-                if(lozfile->rdbuff)
-                        free(lozfile->rdbuff);
-                if(lozfile->wrbuff)
-                        free(lozfile->wrbuff);
-                if(lozfile->strbuff)
-                        free(lozfile->strbuff);
-                if(lozfile->lzbuff)
-                        free(lozfile->lzbuff);
-                free(lozfile);
+        cache = calloc( 1, sizeof(lozfile_cache_t) );
+        if(cache==NULL) {
+                MYLOG_ERROR("could not allocate memory for cache");
+                return NULL;
         }
-        return;
+        cache->nbuckets = LOZ_CACHE_BUCKETS_MIN;
+        cache->buckets  = calloc( cache->nbuckets, sizeof(lozfile_cache_entry_t *) );
+        if(cache->buckets==NULL) {
+                MYLOG_ERROR("could not allocate memory for cache");
+                free( cache );
+                return NULL;
+        }
+        cache->stats.size = size;
+        pthread_mutex_init( &cache->mutex, NULL );
+        return cache;
 }
 
 //------------------------------------------------------------------------------
-//Flush lz-file.
-//inputs:   lozfile = pointer to lz-file
-void loz_flush( lozfile_t * lozfile )
+//Destroy cache of uncompressed sections and free all cached sections
+//inputs:   cache = pointer to cache
+void loz_cache_destroy( lozfile_cache_t * cache )
 {
-        int err;
-        
-        MYLOG_TRACE("@(lozfile=%p)", lozfile);
+        lozfile_cache_entry_t * entry;
+        lozfile_cache_entry_t * next;
 
-        //check input arguments
-        if(lozfile==NULL)
-                return;
-        if(lozfile->fd==NULL)
-                return;
-        if(lozfile->wrbuff==NULL)
-                return;
-        if(lozfile->lzbuff==NULL)
-                return;
+        MYLOG_TRACE("@(cache=%p)", cache);
 
-        //flush available data from wrbuff[]
-        err = loz_flush_wrbuff_to_file( lozfile );
-        if(err < LOZ_OK) {
-                MYLOG_ERROR("loz_flush_wrbuff_to_file() failed with error=%d", err);
+        if(cache) {
+                for(entry = cache->head; entry; entry = next) {
+                        next = entry->next;
+                        free( entry );
+                }
+                pthread_mutex_destroy( &cache->mutex );
+                free( cache->buckets );
+                free( cache );
         }
-
-        fflush( lozfile->fd );
-        return;
 }
 
 //------------------------------------------------------------------------------
-//Get current valid size of LOZ-file.
-//inputs:   lozfile = pointer to loz-file
-//returns:  current size of LOZ-file
-//          0 = error
-long int loz_filesize( lozfile_t * lozfile )
+//Get statistics of cache of uncompressed sections: hits, misses, evictions,
+//size of cached data (cache of handle is lozfile->cache)
+//inputs:   cache = pointer to cache
+//outputs:  stats = statistics
+//returns:  LOZ_OK    = ok
+//          LOZ_ERROR = error
+int loz_cache_stats( lozfile_cache_t * cache, lozfile_cache_stats_t * stats )
 {
-        MYLOG_TRACE("@(lozfile=%p)", lozfile);
+        MYLOG_TRACE("@(cache=%p,stats=%p)", cache, stats);
 
         //check input arguments
-        if(lozfile==NULL)
-                return 0L;
-        if(lozfile->fd==NULL)
-                return 0L;
-        
-        return lozfile->filesize;
+        if(cache==NULL) {
+                MYLOG_ERROR("invalid argument: cache=NULL");
+                return LOZ_ERROR;
+        }
+        if(stats==NULL) {
+                MYLOG_ERROR("invalid argument: stats=NULL");
+                return LOZ_ERROR;
+        }
+
+        pthread_mutex_lock( &cache->mutex );
+        memcpy( stats, &cache->stats, sizeof(lozfile_cache_stats_t) );
+        pthread_mutex_unlock( &cache->mutex );
+        return LOZ_OK;
 }
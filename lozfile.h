@@ -26,7 +26,13 @@
 
 #include "types.h"
 #include <stdio.h>
+#include <sys/types.h>
 #include <stdarg.h>
+#include <pthread.h>
+
+//lozfile_t and API use off_t: library and its users must be built with the same
+//64-bit off_t (on 32-bit hosts it is 32-bit without _FILE_OFFSET_BITS=64)
+_Static_assert( sizeof(off_t) == 8, "build with -D_FILE_OFFSET_BITS=64" );
 
 /******************************************************************************/
 /* DESCRIPTION                                                                */
@@ -65,6 +71,77 @@
  * [  ]
  * [  ]
  *
+ * LOZ-file version 1 has the same file-header and data-sections, plus
+ * section index written after the last data-section on loz_close():
+ * -Index-block:--------------------
+ * [ 0]   - Index-begin-marker, byte[0] (0xFA)
+ * [ 1]   - Index-begin-marker, byte[1] (0xF6)
+ * [ 2]   - Index-entry[0]: RAWPOS   - uint64 (start position of section data in uncompressed raw file)
+ * [10]   - Index-entry[0]: FPOS     - uint64 (begining of section in file)
+ * [18]   - Index-entry[0]: RAWSIZE  - uint32 (uncompressed section data size)
+ * [22]   - Index-entry[0]: COMPSIZE - uint32 (compressed section data size)
+ * [26]   - Index-entry[1]...
+ * [XX]   - Index-block.CRC/VALID ([2..XX-1]: 0=invalid, 1..255=CRC (0x00 result of crc8() is replaced by 0x01 value)
+ * -Footer (last 16 bytes of file):-
+ * [ 0]   - INDEXPOS, uint64 (begining of index-block in file)
+ * [ 8]   - ENTRIES, uint32 (number of entries in index-block)
+ * [12]   - FMT byte 'L'
+ * [13]   - FMT byte 'Z'
+ * [14]   - FMT byte 'I'
+ * [15]   - Footer.CRC/VALID ([0..14]: 0=invalid, 1..255=CRC (0x00 result of crc8() is replaced by 0x01 value)
+ * All numbers are little-endian. If footer is missing or does not match
+ * index-block and data-sections (file was not closed properly), readers
+ * scan data-sections as for version 0. Opening file in "r+" mode removes
+ * index-block, it is written again on loz_close().
+ *
+ * LOZ-file version 2 is version 1 with codec id in every section-header,
+ * so sections of one file could be compressed by different codecs:
+ * -Data-section:-------------------
+ * [ 0]   - Section-begin-marker, byte[0] (0xFA)
+ * [ 1]   - Section-begin-marker, byte[1] (0xF5)
+ * [ 2]   - RAWPOS, unsigned int
+ * [ 6]   - RAWSIZE, unsigned int
+ * [10]   - COMPSIZE, unsigned int
+ * [14]   - CODEC, byte[1] - compression of section data (LOZ_COMPRESSION_xxx)
+ * [15]   - Section-Header.CRC/VALID ([2..14]: 0=invalid, 1..255=CRC (0x00 result of crc8() is replaced by 0x01 value)
+ * [..]   - Compressed-Data, Compressed-Data.CRC/VALID (as in version 0)
+ * COMPRESSION of file-header is codec of the first writer of file, sections
+ * appended in "r+" mode use compression passed to loz_open(). Files of
+ * version 0 and 1 keep their format on update: all sections use codec of
+ * file-header.
+ *
+ * LOZ-file version 3 is version 2 with checksum type in file-header, CRC of
+ * compressed data of every section is calculated by this checksum:
+ * -File-header:--------------------
+ * [ 0]   - FMT bytes 'L','O','Z'
+ * [ 3]   - 0x03 - version of LOZ-file format
+ * [ 4]   - COMPRESSION, byte[1]
+ * [ 5]   - CHECKSUM, byte[1] - type of data checksum (LOZ_CHECKSUM_xxx)
+ * [ 6]   - File-header.CRC/VALID ([3..5]: 0=invalid, 1..255=CRC (0x00 result of crc8() is replaced by 0x01 value)
+ * -Data-section:-------------------
+ * [ 0]   - Section-header (as in version 2)
+ * [16]   - Compressed-Data
+ * [..]   - Compressed-Data.CRC/VALID: LOZ_CHECKSUM_CRC8:   byte[1]
+ *                                     LOZ_CHECKSUM_CRC32C: uint32 (0=invalid, 0x00000000
+ *                                     result of crc32c() is replaced by 0x00000001 value)
+ * Section-headers, index-block and footer are protected by crc8 as before.
+ *
+ * LOZ-file version 4 is version 3 with 64-bit RAWPOS in section-header, so
+ * uncompressed data of file is not limited by 4 GB:
+ * -Data-section:-------------------
+ * [ 0]   - Section-begin-marker, byte[0] (0xFA)
+ * [ 1]   - Section-begin-marker, byte[1] (0xF5)
+ * [ 2]   - RAWPOS, uint64
+ * [10]   - RAWSIZE, unsigned int
+ * [14]   - COMPSIZE, unsigned int
+ * [18]   - CODEC, byte[1]
+ * [19]   - Section-Header.CRC/VALID ([2..18]: 0=invalid, 1..255=CRC (0x00 result of crc8() is replaced by 0x01 value)
+ * [..]   - Compressed-Data, Compressed-Data.CRC/VALID (as in version 3)
+ * Files of older versions keep their format on update, data could not be
+ * appended to them after 4 GB of uncompressed data (loz_write() fails).
+ * In-file positions are off_t: library is built with _FILE_OFFSET_BITS=64
+ * (sizeof(off_t) is checked by lozfile.h).
+ *
  */
 
 /******************************************************************************/
@@ -82,11 +159,31 @@
 #define  LOZ_COMPRESSION_MIN        LOZ_COMPRESSION_NONE
 #define  LOZ_COMPRESSION_MAX        LOZ_COMPRESSION_FASTLZ2
 
+#define  LOZ_COMPRESSION_AUTO       0x80 // codec is chosen for every section (see below)
+
+#define  LOZ_AUTO_RATIO_DEFAULT     50   // default lozfile_opts_t.auto_ratio, %
+
 #define  LOZ_VERSION_0              0x00
+#define  LOZ_VERSION_1              0x01 // + section index at the end of file
+
+#define  LOZ_VERSION_2              0x02 // + codec id in section-header
+
+#define  LOZ_VERSION_3              0x03 // + checksum type in file-header
+
+#define  LOZ_VERSION_4              0x04 // + 64-bit rawpos in section-header
+
+#define  LOZ_VERSION_MAX            LOZ_VERSION_4
+
+//checksum of section data
+#define  LOZ_CHECKSUM_CRC8          0x01 // crc8 (LOZ_VERSION_0..LOZ_VERSION_2)
+#define  LOZ_CHECKSUM_CRC32C        0x02 // crc32c: SSE4.2 instruction or slicing-by-8 tables
+
+#define  LOZ_CHECKSUM_DEFAULT       LOZ_CHECKSUM_CRC32C
 
 #define  LOZ_BLOCKSIZE_MIN          32
-#define  LOZ_BLOCKSIZE_MAX          65535
+#define  LOZ_BLOCKSIZE_MAX          16777216 // 16 MB (see below)
 #define  LOZ_STRLEN_MAX             16384
+#define  LOZ_THREADS_MAX            64
 
 #define  LOZ_READONLY               0    // "r"-read only
 #define  LOZ_READWRITE              1    // "r+"-read/write-update (create/update file, if file does not exist it will be created)
@@ -100,6 +197,179 @@
     
 #define LOZ_FILLER                  '?'
 
+//flags of lozfile_opts_t
+#define  LOZ_FLAG_ORDERED           0x0001 // crash-ordered sections (see below)
+#define  LOZ_FLAG_NOVERIFY          0x0002 // trusted read: CRC of section data is not checked
+#define  LOZ_FLAG_MMAP              0x0004 // "r" mode: file is read through mmap() (see below)
+#define  LOZ_FLAG_ASYNC             0x0008 // sections are compressed and written by background threads (see below)
+
+#define  LOZ_FLUSH_MS_DEFAULT       1000 // LOZ_FLAG_ASYNC: max delay of written data, ms
+#define  LOZ_APPEND_SIZE_DEFAULT    (1024*1024) // LOZ_FLAG_ASYNC: size of ring of loz_append()
+#define  LOZ_APPEND_SIZE_MAX        (1024*1024*1024)
+
+/* Every data-section is written by one pwritev() call (header, data, data CRC).
+ * After crash of process file is consistent: section is either written
+ * completely or not written at all. After power loss some blocks of last
+ * sections could be not on disk yet: valid section-header could precede its
+ * data, such section is readed as LOZ_FILLER (data CRC is invalid).
+ * LOZ_FLAG_ORDERED keeps section invalid until it is complete on disk:
+ * section is written with header CRC=0, synced by fdatasync() and then actual
+ * header CRC is written. It costs one fdatasync() per section.
+ *
+ * LOZ_FLAG_NOVERIFY skips calculation of CRC of compressed data on read (for
+ * archives verified before or stored on checksumming filesystems). Headers,
+ * index-block and invalid data status (CRC=0) are still checked. Decoders
+ * are bounds-safe: corrupted section data never reads or writes outside of
+ * buffers. If it could not be uncompressed to section rawsize it is replaced
+ * by LOZ_FILLER, else corrupted data is returned as decoded (undetected).
+ *
+ * LOZ_FLAG_MMAP maps file opened in "r" mode to memory: headers and CRC are
+ * checked in place and codecs read compressed data from the mapping, there
+ * is no buffer for compressed data (memory of handle is one rdbuff). The
+ * mapping is read sequentially (MADV_SEQUENTIAL) until the first loz_fseek()
+ * or loz_pread(), then every section is prefetched (MADV_WILLNEED) without
+ * readahead of neighbour pages (MADV_RANDOM). Data appended to file after
+ * loz_open_ex() is not visible. If file could not be mapped, it is read by
+ * pread() as without this flag. The flag is ignored in "r+" and "w+" modes.
+ * File must not be truncated by other process while it is mapped: reading of
+ * mapped pages after the new end of file raises SIGBUS in the reading thread,
+ * while pread() (without this flag) returns short read there and section is
+ * handled as the end of file (LOZ_EOF).
+ *
+ * Section size is limited by buffsize of writer: 32 bytes .. 16 MB (large
+ * sections compress better, small ones are faster for random access). Buffers
+ * of handle are allocated on first use: wrbuff and lzbuff by first write,
+ * rdbuff by first read, so a handle only for writing or reading takes no
+ * memory of the other side. A reader is not limited by its own buffsize: its
+ * buffers grow to the largest section read (up to LOZ_BLOCKSIZE_MAX).
+ */
+
+typedef struct lozfile_cache_t lozfile_cache_t; //cache of uncompressed sections (lozfile.c)
+
+//Extended options of loz_open_ex()
+typedef struct lozfile_opts_t lozfile_opts_t;
+struct lozfile_opts_t
+{
+        int        flags;       //LOZ_FLAG_xxx
+        int        nthreads;    //number of compression threads (0,1=compress in caller thread)
+        int        auto_ratio;  //LOZ_COMPRESSION_AUTO: target compsize/rawsize, % (0=LOZ_AUTO_RATIO_DEFAULT)
+        int        checksum;    //checksum of section data of new file, LOZ_CHECKSUM_xxx (0=LOZ_CHECKSUM_DEFAULT)
+        lozfile_cache_t * cache; //shared cache of uncompressed sections (see loz_cache_create), NULL=no shared cache
+        long int   cache_size;  //size of own cache of handle, bytes (used if cache==NULL, 0=no cache)
+        int        flush_ms;    //LOZ_FLAG_ASYNC: max delay of written data before it is written to file, ms (0=LOZ_FLUSH_MS_DEFAULT)
+        int        append_size; //LOZ_FLAG_ASYNC: size of ring of loz_append(), bytes (0=LOZ_APPEND_SIZE_DEFAULT)
+};
+
+/* loz_pread() reads data at rawpos without read position of handle: it uses
+ * section index, pread() of file and thread-local buffers, so many threads
+ * could read one handle at the same time (and with loz_read() of one more
+ * thread). Handle must not be written while it is read by loz_pread().
+ */
+
+/* Cache of uncompressed sections keeps the last used sections of random-access
+ * readers: section is uncompressed once, then loz_read() after loz_fseek()
+ * copies it from cache. Sections are cached by file (device, inode) and fpos,
+ * so one cache created by loz_cache_create() could be shared by many handles
+ * (and threads) of the same or different files, its memory is bounded by size
+ * given on creation: the least recently used sections are evicted. Handle
+ * which opens file in "r+"/"w+" mode drops cached sections after its end of
+ * data; files changed by other processes are not tracked. Corrupted sections
+ * (readed as LOZ_FILLER) are not cached.
+ */
+
+//Statistics of cache of uncompressed sections (see loz_cache_stats)
+typedef struct lozfile_cache_stats_t lozfile_cache_stats_t;
+struct lozfile_cache_stats_t
+{
+        uint64_t   hits;        //sections found in cache
+        uint64_t   misses;      //sections not found in cache (readed from file)
+        uint64_t   evictions;   //sections removed to free space
+        long int   size;        //max size of cached data, bytes
+        long int   used;        //size of cached data, bytes (with per-section overhead)
+        int        sections;    //number of cached sections
+};
+
+/* LOZ_COMPRESSION_AUTO chooses codec for every block (LOZ_VERSION_2 and later
+ * files, older files keep codec of file-header). Block with entropy close to
+ * 8 bits per byte is stored. Otherwise codecs are tried on a small sample of
+ * block from the fastest one (RLE2 if block has runs, FASTLZ1, FASTLZ2, LZ):
+ * the first codec which compresses sample to auto_ratio % or better is used,
+ * if no one does, codec with the best result on sample is used.
+ * auto_ratio=100 prefers speed, auto_ratio=1 prefers compression ratio.
+ */
+
+//Statistics of sections written by lozfile handle (see loz_stats)
+typedef struct lozfile_stats_t lozfile_stats_t;
+struct lozfile_stats_t
+{
+        uint32_t   sections[LOZ_COMPRESSION_MAX+1]; //number of sections by codec
+        uint64_t   rawsize [LOZ_COMPRESSION_MAX+1]; //uncompressed data size by codec
+        uint64_t   compsize[LOZ_COMPRESSION_MAX+1]; //compressed data size by codec
+};
+
+/* With nthreads > 1 full blocks are compressed by pool of threads and
+ * sections are written in order of rawpos by thread which calls loz_write(),
+ * loz_flush() or loz_close(), file is the same as with one thread.
+ * Compressed sections are written to file by next loz_write() calls,
+ * all of them are written by loz_flush() and loz_close().
+ *
+ * LOZ_FLAG_ASYNC takes compression and file writes out of loz_write() and
+ * loz_printf() (for loggers which write from request paths): full wrbuff is
+ * swapped with free buffer of pool and compressed by pool (one thread if
+ * nthreads <= 1), sections are written by background writer thread. Writer
+ * thread also submits data which stays in wrbuff longer than flush_ms, so
+ * data is in file within flush_ms (plus time of compression and write) after
+ * loz_write() without loz_flush(). loz_write() waits only if all buffers of
+ * pool are busy (disk is slower than writes). loz_flush() submits wrbuff and
+ * waits until all data is written. Other functions of handle (loz_read(),
+ * loz_pread(), loz_stats()) must not be mixed with loz_write() without
+ * loz_flush() before them. Error of writer thread is returned by the next
+ * loz_write() which submits a block.
+ *
+ * lozfile_t is not thread-safe, except loz_append() and loz_appendf() of
+ * LOZ_FLAG_ASYNC handle: many threads append records to one handle without
+ * lock. Producer reserves space in ring (one compare-and-swap), copies record
+ * and publishes it; writer thread moves published records to wrbuff in order
+ * of reservation, so every record is contiguous in file. Ring is allocated by
+ * the first loz_append() (append_size rounded up to power of 2), record
+ * bigger than quarter of ring or buffsize is written to wrbuff by producer
+ * after records reserved before it. If ring is full, producer yields to
+ * writer thread. Records reach file within
+ * flush_ms as data of loz_write(), loz_flush() writes all records appended
+ * before it. loz_write()/loz_printf() of the same handle must be called by
+ * one thread at a time (as without LOZ_FLAG_ASYNC).
+ */
+
+typedef struct lozfile_pool_t lozfile_pool_t; //pool of compression threads (lozfile.c)
+
+
+//Entry of in-memory section index (decoded)
+typedef struct lozfile_index_t lozfile_index_t;
+struct lozfile_index_t
+{
+        off_t      fpos;        //begining of section in file
+        uint64_t   rawpos;      //start position of section data in uncompressed raw file
+        uint32_t   rawsize;     //uncompressed section data size
+        uint32_t   compsize;    //compressed section data size
+};
+
+/* In-memory section index is compact: entries are grouped by LOZ_INDEX_BLOCK,
+ * block keeps rawpos/fpos of its 1st entry, entries are delta-encoded after
+ * previous entry (flags byte and varints of rawsize/compsize, usually 2..4
+ * bytes per section). Blocks are searched by rawpos in Eytzinger layout
+ * (breadth-first order of binary search tree, built on first lookup after
+ * new blocks are added), then entries of one block are decoded.
+ */
+#define  LOZ_INDEX_BLOCK            16   // entries per block of section index
+
+//Block of in-memory section index
+typedef struct lozfile_index_block_t lozfile_index_block_t;
+struct lozfile_index_block_t
+{
+        off_t      fpos;        //begining of 1st section of block in file
+        uint64_t   rawpos;      //rawpos of 1st section of block
+        uint32_t   offset;      //offset of encoded entries of block in index_data[]
+};
 
 //LOZ-file structure
 typedef struct lozfile_t lozfile_t;
@@ -108,45 +378,78 @@ struct lozfile_t
         FILE     * fd;          // pointer to opened file
         int        version;
         int        rwmode;
-        uint8_t    compression; //currently used compression format for new data to be written into file
+        uint8_t    compression; //compression format for new sections (version < 2: codec of whole file)
+        int        auto_ratio;  //target ratio of LOZ_COMPRESSION_AUTO, %
+        int        flags;       //LOZ_FLAG_xxx
+        uint8_t    checksum;    //LOZ_CHECKSUM_xxx of section data (version < 3: LOZ_CHECKSUM_CRC8)
 
         int        fid;         //id of opened file
-        long int   filesize;
+        uint8_t  * map;         //mapping of file (LOZ_FLAG_MMAP), NULL=file is read by pread()
+        off_t      mapsize;     //size of mapping
+        char       map_random;  //mapping is accessed randomly (MADV_RANDOM)
+        off_t      filesize;
         uint8_t    fileheader_crc;
 
-        long int   rd_fpos;     //current read  position in file (compressed data)
-        long int   wr_fpos;     //current write position in file (compressed data)
+        off_t      rd_fpos;     //current read  position in file (compressed data)
+        off_t      wr_fpos;     //current write position in file (compressed data)
 
-        long int   rd_rawpos;   //current read  position in file (uncompressed data)
-        long int   wr_rawpos;   //current write position in file (uncompressed data)
+        off_t      rd_rawpos;   //current read  position in file (uncompressed data)
+        off_t      wr_rawpos;   //current write position in file (uncompressed data)
         
-        int        buffsize;    //size of wrbuff, rdbuff
-        int        lzbuffsize;  //size of lzbuff
-        int        strbuffsize; //size of wrbuff, rdbuff
+        int        buffsize;    //size of sections written (size of wrbuff)
+        int        rdbuffsize;  //allocated size of rdbuff (buffsize or larger section read, 0=not allocated)
+        int        lzbuffsize;  //allocated size of lzbuff (0=not allocated)
+        int        strbuffsize; //allocated size of strbuff (0=not allocated)
 
         uint8_t  * wrbuff;      //write buffer for uncompressed (raw) data 
         uint8_t  * rdbuff;      //read  buffer for uncompressed (raw) data
         uint8_t  * lzbuff;      //read/write buffer for compressed data
-        uint8_t  * strbuff;     //repair buffer for string functions
+        uint8_t  * lzdata;      //compressed data of section loaded by loz_load_section() (lzbuff or map)
+        uint8_t  * strbuff;     //buffer of loz_printf() line which spills wrbuff (allocated on first use)
+        uint8_t  * scanbuff;    //buffer for searching sections in file (allocated on first use)
+        uint32_t * lzwork;      //match finder work area of LZ compression (allocated on first use)
 
         int        rdbuff_n;    //available bytes in rdbuff
         int        rdbuff_pos;  //current position in read buffer
         int        wrbuff_pos;  //current position in write buffer
         
         int        error;       //last error
+
+        //sorted rawpos->fpos table of valid sections (see loz_fseek)
+        lozfile_index_block_t * index_blocks; //blocks of LOZ_INDEX_BLOCK entries
+        int        index_blocks_size; //number of allocated blocks
+        uint8_t  * index_data;  //delta-encoded entries
+        uint32_t   index_data_n;    //used bytes of index_data[]
+        uint32_t   index_data_size; //allocated bytes of index_data[]
+        lozfile_index_block_t * index_eytz; //blocks in Eytzinger order, [1..index_eytz_n]
+        int        index_eytz_n; //number of blocks in index_eytz[] (0=not built)
+        lozfile_index_t index_last; //last entry of index
+        int        index_n;     //number of entries in index
+        char       index_valid; //index covers all sections of file
+        pthread_mutex_t index_mutex; //index is built by one of loz_pread() threads
+
+        lozfile_pool_t  * pool;  //compression threads (opts->nthreads > 1 or LOZ_FLAG_ASYNC), NULL=compress in caller thread
+
+        lozfile_stats_t   stats; //sections written since loz_open()
+
+        lozfile_cache_t * cache; //cache of uncompressed sections, NULL=no cache
+        char       cache_own;   //cache is created by loz_open_ex() (opts->cache_size)
+        uint64_t   file_dev;    //device of opened file (key of cached sections)
+        uint64_t   file_ino;    //inode of opened file (key of cached sections)
 };
 
 typedef struct lozfile_section_t lozfile_section_t;
 struct lozfile_section_t
 {
-        long int   fpos; //begining of section in file
+        off_t      fpos; //begining of section in file
         char       header_is_valid;
         
         uint8_t    beginmarker[2];
-        uint32_t   rawpos;
-        uint32_t   rawpos_end;
+        uint64_t   rawpos;
+        uint64_t   rawpos_end;
         uint32_t   rawsize;
         uint32_t   compsize;
+        uint8_t    codec;       //LOZ_COMPRESSION_xxx of section data
         uint8_t    crc;
 };
     
@@ -157,16 +460,24 @@ struct lozfile_section_t
 /* FUNCTION DEFINITIONS                                                       */
 /******************************************************************************/
 lozfile_t * loz_open        ( const char * filename, char * rwmode, int buffsize, int compression );
+lozfile_t * loz_open_ex     ( const char * filename, char * rwmode, int buffsize, int compression, const lozfile_opts_t * opts );
 int         loz_write       ( lozfile_t * lozfile, char * data, int size );
 int         loz_read        ( lozfile_t * lozfile, void * ptr, int size );
 int         loz_printf      ( lozfile_t * lozfile, const char * format, ... );
 int         loz_vprintf     ( lozfile_t * lozfile, const char * format, va_list arg );
+int         loz_append      ( lozfile_t * lozfile, const void * data, int size );
+int         loz_appendf     ( lozfile_t * lozfile, const char * format, ... );
 void        loz_close       ( lozfile_t * lozfile );
 void        loz_flush       ( lozfile_t * lozfile );
-long int    loz_filesize    ( lozfile_t * lozfile );
-/*              
-void        loz_fseek       ( lozfile_t * lozfile, long int fpos );
-long int    loz_ftell       ( lozfile_t * lozfile );
-*/  
+off_t       loz_filesize    ( lozfile_t * lozfile );
+int         loz_fseek       ( lozfile_t * lozfile, off_t rawpos );
+off_t       loz_ftell       ( lozfile_t * lozfile );
+off_t       loz_extract     ( lozfile_t * lozfile, int fid, int nthreads );
+int         loz_pread       ( lozfile_t * lozfile, void * ptr, int size, off_t rawpos );
+int         loz_stats       ( lozfile_t * lozfile, lozfile_stats_t * stats );
+
+lozfile_cache_t * loz_cache_create  ( long int size );
+void        loz_cache_destroy       ( lozfile_cache_t * cache );
+int         loz_cache_stats         ( lozfile_cache_t * cache, lozfile_cache_stats_t * stats );
 
 #endif /* LOZFILE_H */